@@ -115,15 +115,20 @@ paddr_t ram_getfirstfree(void);
  * TLB shootdown bits.
  *
  * We'll take up to 16 invalidations before just flushing the whole TLB.
+ *
+ * ts_done, if not NULL, is V'd by each CPU once it has acted on the
+ * shootdown, so the sender can wait for all of them.
  */
 
+struct semaphore;
+
 struct tlbshootdown {
-	/*
-	 * Change this to what you need for your VM design.
-	 */
-	int ts_placeholder;
+	vaddr_t ts_vaddr;		/* page to drop, or TLBSHOOTDOWN_ALL */
+	struct semaphore *ts_done;	/* signaled when handled, or NULL */
 };
 
+#define TLBSHOOTDOWN_ALL 0xffffffff
+
 #define TLBSHOOTDOWN_MAX 16
 
 
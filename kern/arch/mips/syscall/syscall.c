@@ -36,6 +36,7 @@
 #include <current.h>
 #include <syscall.h>
 #include <file.h>
+#include <vfs.h>
 #include <endian.h>
 #include <copyinout.h>
 
@@ -83,6 +84,11 @@ syscall(struct trapframe *tf)
 {
 	int callno;
 	int32_t retval;
+	off_t retval64;
+	uint64_t offset64;
+	uint32_t stackargs[2];
+	int whence;
+	bool is64 = false;
 	int err;
 
 	KASSERT(curthread != NULL);
@@ -112,54 +118,83 @@ syscall(struct trapframe *tf)
 				 (userptr_t)tf->tf_a1);
 		break;
 
-		case SYS_open:
-		err = sys_open((const char *)tf->tf_a0,(int)tf->tf_a1,(mode_t)tf->tf_a2);
-		retval = err;
-		if(err > 0){
-			err = 0;
-		}
+	    case SYS_open:
+		err = sys_open((const_userptr_t)tf->tf_a0, tf->tf_a1,
+			       tf->tf_a2, &retval);
+		break;
+
+	    case SYS_read:
+		err = sys_read(tf->tf_a0, (userptr_t)tf->tf_a1, tf->tf_a2,
+			       &retval);
+		break;
+
+	    case SYS_write:
+		err = sys_write(tf->tf_a0, (const_userptr_t)tf->tf_a1,
+				tf->tf_a2, &retval);
+		break;
+
+	    case SYS_readv:
+		err = sys_readv(tf->tf_a0, (const_userptr_t)tf->tf_a1,
+				tf->tf_a2, &retval);
+		break;
+
+	    case SYS_writev:
+		err = sys_writev(tf->tf_a0, (const_userptr_t)tf->tf_a1,
+				 tf->tf_a2, &retval);
 		break;
 
-		case SYS_read:
-		retval = sys_read((int)tf->tf_a0,(void *)tf->tf_a1,(size_t)tf->tf_a2, &err);
-		//retval = tf->tf_a2;
-		if (err >= 0){
-			err = 0;
+	    case SYS_pread:
+	    case SYS_pwrite:
+	    case SYS_preadv:
+	    case SYS_pwritev:
+		/* a3 is skipped; the 64-bit offset is on the stack */
+		err = copyin((const_userptr_t)(tf->tf_sp + 16), stackargs,
+			     sizeof(stackargs));
+		if (err) {
+			break;
+		}
+		join32to64(stackargs[0], stackargs[1], &offset64);
+		if (callno == SYS_pread) {
+			err = sys_pread(tf->tf_a0, (userptr_t)tf->tf_a1,
+					tf->tf_a2, offset64, &retval);
+		}
+		else if (callno == SYS_pwrite) {
+			err = sys_pwrite(tf->tf_a0, (const_userptr_t)tf->tf_a1,
+					 tf->tf_a2, offset64, &retval);
+		}
+		else if (callno == SYS_preadv) {
+			err = sys_preadv(tf->tf_a0, (const_userptr_t)tf->tf_a1,
+					 tf->tf_a2, offset64, &retval);
+		}
+		else {
+			err = sys_pwritev(tf->tf_a0,
+					  (const_userptr_t)tf->tf_a1,
+					  tf->tf_a2, offset64, &retval);
 		}
 		break;
 
-		case SYS_write:
-		retval = sys_write((int)tf->tf_a0,(const_userptr_t)tf->tf_a1,(size_t)tf->tf_a2, &err);
-		//retval = tf->tf_a2;
-		if(retval >= 0){
-			err = 0;
+	    case SYS_lseek:
+		/* offset is in a2/a3; whence is on the stack */
+		join32to64(tf->tf_a2, tf->tf_a3, &offset64);
+		err = copyin((const_userptr_t)(tf->tf_sp + 16), &whence,
+			     sizeof(whence));
+		if (err) {
+			break;
 		}
+		err = sys_lseek(tf->tf_a0, offset64, whence, &retval64);
+		is64 = true;
 		break;
 
-		case SYS_lseek:
-		;
-		/* nessesary variable */
-		uint64_t offset;
-		int whence;
-		off_t retval64 = 0;
-        /* load the 64bit offset */
-		join32to64(tf->tf_a2, tf->tf_a3, &offset);
-		copyin((userptr_t)tf->tf_sp + 16, &whence, sizeof(int));
-		split64to32(retval64, &tf->tf_v0, &tf->tf_v1);
-		
-		retval64 = sys_lseek((int)tf->tf_a0,(off_t) offset,(int) whence, &err);
-		split64to32(retval64, &tf->tf_v0, &tf->tf_v1);
-		retval = tf->tf_v0;
+	    case SYS_close:
+		err = sys_close(tf->tf_a0);
 		break;
 
-		case SYS_close:
-		err = sys_close((int)tf->tf_a0);
-		retval = err;
+	    case SYS_dup2:
+		err = sys_dup2(tf->tf_a0, tf->tf_a1, &retval);
 		break;
 
-		case SYS_dup2:
-		err = sys_dup2((int)tf->tf_a0,(int)tf->tf_a1);
-		retval = tf->tf_a1;
+	    case SYS_sync:
+		err = vfs_sync();
 		break;
 
 	    /* Add stuff here */
@@ -177,11 +212,14 @@ syscall(struct trapframe *tf)
 		 * userlevel to a return value of -1 and the error
 		 * code in errno.
 		 */
-		//kprintf("there is a error happend!\n");
-		//kprintf("this is error number:%d\n",err);
 		tf->tf_v0 = err;
 		tf->tf_a3 = 1;      /* signal an error */
 	}
+	else if (is64) {
+		/* Success, with a 64-bit return value in v0/v1. */
+		split64to32(retval64, &tf->tf_v0, &tf->tf_v1);
+		tf->tf_a3 = 0;      /* signal no error */
+	}
 	else {
 		/* Success. */
 		tf->tf_v0 = retval;
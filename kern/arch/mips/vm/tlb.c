@@ -0,0 +1,175 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * MIPS TLB management for the VM system.
+ *
+ * We don't use address space IDs, so the TLB only ever holds
+ * mappings for the current address space and is flushed on every
+ * address space switch. Refills replace a random entry, using the
+ * hardware's random register, unless there's already an entry for
+ * the page (e.g. on a write to a page that was loaded read-only), in
+ * which case that entry is overwritten.
+ *
+ * Shootdowns are synchronous: the sender waits on tlb_shootsem until
+ * each CPU it sent to has acted on the request. Senders hold the
+ * paging lock, so there is only ever one waiting and one semaphore
+ * does.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <spl.h>
+#include <cpu.h>
+#include <current.h>
+#include <synch.h>
+#include <mips/tlb.h>
+#include <vm.h>
+
+static struct semaphore *tlb_shootsem;
+
+void
+vm_tlb_bootstrap(void)
+{
+	tlb_shootsem = sem_create("tlb_shootsem", 0);
+	if (tlb_shootsem == NULL) {
+		panic("vm: Could not create shootdown semaphore\n");
+	}
+}
+
+void
+vm_tlb_load(vaddr_t vaddr, paddr_t paddr, bool writable)
+{
+	uint32_t ehi, elo;
+	int spl, ix;
+
+	KASSERT((vaddr & PAGE_FRAME) == vaddr);
+	KASSERT((paddr & PAGE_FRAME) == paddr);
+
+	ehi = vaddr;
+	elo = paddr | TLBLO_VALID;
+	if (writable) {
+		elo |= TLBLO_DIRTY;
+	}
+
+	/* Disable interrupts on this CPU while frobbing the TLB. */
+	spl = splhigh();
+	ix = tlb_probe(ehi, 0);
+	if (ix >= 0) {
+		tlb_write(ehi, elo, ix);
+	}
+	else {
+		tlb_random(ehi, elo);
+	}
+	splx(spl);
+}
+
+void
+vm_tlb_invalidate(vaddr_t vaddr)
+{
+	int spl, ix;
+
+	spl = splhigh();
+	ix = tlb_probe(vaddr & PAGE_FRAME, 0);
+	if (ix >= 0) {
+		tlb_write(TLBHI_INVALID(ix), TLBLO_INVALID(), ix);
+	}
+	splx(spl);
+}
+
+void
+vm_tlb_flush(void)
+{
+	int spl, i;
+
+	spl = splhigh();
+	for (i=0; i<NUM_TLB; i++) {
+		tlb_write(TLBHI_INVALID(i), TLBLO_INVALID(), i);
+	}
+	splx(spl);
+}
+
+/*
+ * Send TS to the other CPUs running AS and wait until they're done.
+ */
+static
+void
+vm_tlb_shootsync(struct addrspace *as, struct tlbshootdown *ts)
+{
+	unsigned n;
+
+	KASSERT(vm_pagelock_held());
+	KASSERT(curcpu->c_spinlocks == 0);
+
+	ts->ts_done = tlb_shootsem;
+	n = ipi_tlbshootdown_as(as, ts);
+	while (n-- > 0) {
+		P(tlb_shootsem);
+	}
+}
+
+void
+vm_tlb_shootdown(struct addrspace *as, vaddr_t vaddr)
+{
+	struct tlbshootdown ts;
+
+	vm_tlb_invalidate(vaddr);
+	ts.ts_vaddr = vaddr & PAGE_FRAME;
+	vm_tlb_shootsync(as, &ts);
+}
+
+void
+vm_tlb_shootdown_all(struct addrspace *as)
+{
+	struct tlbshootdown ts;
+
+	vm_tlb_flush();
+	ts.ts_vaddr = TLBSHOOTDOWN_ALL;
+	vm_tlb_shootsync(as, &ts);
+}
+
+/*
+ * Handle a shootdown from another CPU. It may have been sent on
+ * behalf of an address space we've since switched away from; then
+ * the entry is either already gone or harmlessly reloaded. Either
+ * way, tell the sender we're done.
+ */
+void
+vm_tlbshootdown(const struct tlbshootdown *ts)
+{
+	if (ts->ts_vaddr == TLBSHOOTDOWN_ALL) {
+		vm_tlb_flush();
+	}
+	else {
+		vm_tlb_invalidate(ts->ts_vaddr);
+	}
+	if (ts->ts_done != NULL) {
+		V(ts->ts_done);
+	}
+}
@@ -36,7 +36,8 @@
 #include <lib.h>
 #include <uio.h>
 #include <membar.h>
-#include <synch.h>
+#include <spinlock.h>
+#include <wchan.h>
 #include <platform/bus.h>
 #include <vfs.h>
 #include <lamebus/lhd.h>
@@ -95,22 +96,216 @@ int lhd_code_to_errno(struct lhd_softc *lh, int code)
 	return EAGAIN;
 }
 
+////////////////////////////////////////////////////////////
+// Request queue
+
+/*
+ * A request: a run of consecutive sectors to transfer to or from a
+ * kernel buffer. Requests are queued in lh_queue, sorted by starting
+ * sector, and sent to the disk in C-SCAN order: the head sweeps
+ * upward through the queue, then returns to the lowest pending
+ * request and sweeps upward again. (One-directional sweeps keep the
+ * wait for requests at the ends of the disk from being twice as long
+ * as for those in the middle.)
+ *
+ * A request for the sectors just after (or just before) a pending
+ * request in the same direction is merged with it: the two are
+ * chained through r_merged and dispatched as one run, so nothing
+ * else can get between them. The disk still takes one command per
+ * sector; it has no way to do more.
+ *
+ * Sectors are transferred one at a time by the interrupt handler,
+ * which copies the data between the request's buffer and the
+ * on-card buffer and starts the next sector right away. The
+ * submitting thread only sleeps on lh_wchan until r_done is set.
+ */
+struct lhd_request {
+	struct lhd_request *r_next;	/* next in lh_queue */
+	struct lhd_request *r_merged;	/* next in merged run */
+	uint32_t r_sector;		/* next sector to transfer */
+	uint32_t r_nsect;		/* sectors left to transfer */
+	char *r_data;			/* where its data goes/comes from */
+	bool r_iswrite;			/* true for writes */
+	bool r_done;			/* true when finished */
+	int r_result;			/* errno value, when finished */
+};
+
 /*
- * Record that an I/O has completed: save the result and poke the
- * completion semaphore.
+ * Get the last request in a merged run.
+ */
+static
+struct lhd_request *
+lhd_runtail(struct lhd_request *r)
+{
+	while (r->r_merged != NULL) {
+		r = r->r_merged;
+	}
+	return r;
+}
+
+/*
+ * Add a request to the queue, merging it with an adjacent one if
+ * possible. A request can be merged onto the end of the run on the
+ * disk right now, too.
+ */
+static
+void
+lhd_enqueue(struct lhd_softc *lh, struct lhd_request *req)
+{
+	struct lhd_request **pp, *tail;
+
+	KASSERT(spinlock_do_i_hold(&lh->lh_lock));
+
+	req->r_next = req->r_merged = NULL;
+
+	/* Back merge onto the run in progress? */
+	if (lh->lh_cur != NULL) {
+		tail = lhd_runtail(lh->lh_cur);
+		if (tail->r_iswrite == req->r_iswrite &&
+		    tail->r_sector + tail->r_nsect == req->r_sector) {
+			tail->r_merged = req;
+			return;
+		}
+	}
+
+	for (pp = &lh->lh_queue; *pp != NULL; pp = &(*pp)->r_next) {
+		if ((*pp)->r_iswrite == req->r_iswrite) {
+			/* Back merge: REQ continues the run at *PP */
+			tail = lhd_runtail(*pp);
+			if (tail->r_sector + tail->r_nsect == req->r_sector) {
+				tail->r_merged = req;
+				return;
+			}
+			/* Front merge: the run at *PP continues REQ */
+			if (req->r_sector + req->r_nsect == (*pp)->r_sector) {
+				req->r_merged = *pp;
+				req->r_next = (*pp)->r_next;
+				(*pp)->r_next = NULL;
+				*pp = req;
+				return;
+			}
+		}
+		if ((*pp)->r_sector > req->r_sector) {
+			break;
+		}
+	}
+
+	/*
+	 * No merge; insert in sorted order. (We may have stopped
+	 * early and missed a back merge with a run that started lower
+	 * and continued past *PP; that's harmless.)
+	 */
+	req->r_next = *pp;
+	*pp = req;
+}
+
+/*
+ * Tell the disk to transfer the next sector of the current request.
+ */
+static
+void
+lhd_startsector(struct lhd_softc *lh)
+{
+	struct lhd_request *req = lh->lh_cur;
+	uint32_t statval = LHD_WORKING;
+
+	KASSERT(spinlock_do_i_hold(&lh->lh_lock));
+	KASSERT(req != NULL && req->r_nsect > 0);
+
+	if (req->r_iswrite) {
+		memcpy(lh->lh_buf, req->r_data, LHD_SECTSIZE);
+		membar_store_store();
+		statval |= LHD_ISWRITE;
+	}
+
+	/* Tell it what sector we want... */
+	lhd_wreg(lh, LHD_REG_SECT, req->r_sector);
+
+	/* and start the operation. */
+	lhd_wreg(lh, LHD_REG_STAT, statval);
+}
+
+/*
+ * If the disk is idle, pick the next run to send it: the first one
+ * at or above the head, or, if there isn't one, the lowest one.
+ */
+static
+void
+lhd_schedule(struct lhd_softc *lh)
+{
+	struct lhd_request **pp;
+
+	KASSERT(spinlock_do_i_hold(&lh->lh_lock));
+
+	if (lh->lh_cur != NULL || lh->lh_queue == NULL) {
+		return;
+	}
+
+	for (pp = &lh->lh_queue; *pp != NULL; pp = &(*pp)->r_next) {
+		if ((*pp)->r_sector >= lh->lh_headpos) {
+			break;
+		}
+	}
+	if (*pp == NULL) {
+		/* Nothing further up; wrap around */
+		pp = &lh->lh_queue;
+	}
+
+	lh->lh_cur = *pp;
+	*pp = lh->lh_cur->r_next;
+	lh->lh_cur->r_next = NULL;
+
+	lhd_startsector(lh);
+}
+
+/*
+ * A sector transfer has completed: save the result, move on to the
+ * next sector, request, or run, and start it.
  */
 static
 void
 lhd_iodone(struct lhd_softc *lh, int err)
 {
-	lh->lh_result = err;
-	V(lh->lh_done);
+	struct lhd_request *req;
+
+	spinlock_acquire(&lh->lh_lock);
+
+	req = lh->lh_cur;
+	KASSERT(req != NULL);
+
+	if (err == 0 && !req->r_iswrite) {
+		membar_load_load();
+		memcpy(req->r_data, lh->lh_buf, LHD_SECTSIZE);
+	}
+	lh->lh_headpos = req->r_sector;
+
+	if (err == 0) {
+		req->r_sector++;
+		req->r_nsect--;
+		req->r_data += LHD_SECTSIZE;
+	}
+
+	if (err != 0 || req->r_nsect == 0) {
+		req->r_result = err;
+		req->r_done = true;
+		lh->lh_cur = req->r_merged;
+		wchan_wakeall(lh->lh_wchan, &lh->lh_lock);
+	}
+
+	if (lh->lh_cur != NULL) {
+		lhd_startsector(lh);
+	}
+	else {
+		lhd_schedule(lh);
+	}
+
+	spinlock_release(&lh->lh_lock);
 }
 
 /*
  * Interrupt handler for lhd.
  * Read the status register; if an operation finished, clear the status
- * register and report completion.
+ * register and report completion, which starts the next transfer.
  */
 void
 lhd_irq(void *vlh)
@@ -133,6 +328,37 @@ lhd_irq(void *vlh)
 	}
 }
 
+/*
+ * Queue a request and wait for it to finish.
+ */
+static
+int
+lhd_transfer(struct lhd_softc *lh, uint32_t sector, uint32_t nsect,
+	     void *data, bool iswrite)
+{
+	struct lhd_request req;
+
+	req.r_sector = sector;
+	req.r_nsect = nsect;
+	req.r_data = data;
+	req.r_iswrite = iswrite;
+	req.r_done = false;
+	req.r_result = 0;
+
+	spinlock_acquire(&lh->lh_lock);
+	lhd_enqueue(lh, &req);
+	lhd_schedule(lh);
+	while (!req.r_done) {
+		wchan_sleep(lh->lh_wchan, &lh->lh_lock);
+	}
+	spinlock_release(&lh->lh_lock);
+
+	return req.r_result;
+}
+
+////////////////////////////////////////////////////////////
+// Device interface
+
 /*
  * Function called when we are open()'d.
  */
@@ -179,8 +405,18 @@ lhd_reset(struct lhd_softc *lh)
 }
 #endif
 
+/*
+ * Bounce buffer size for I/O to or from anything but a single kernel
+ * buffer (user memory can't be touched from the interrupt handler).
+ */
+#define LHD_BOUNCESIZE	4096
+
 /*
  * I/O function (for both reads and writes)
+ *
+ * The common case, a single kernel buffer (which is what the file
+ * system always passes), goes straight to the request queue. Other
+ * transfers go through a bounce buffer a chunk at a time.
  */
 static
 int
@@ -192,8 +428,10 @@ lhd_io(struct device *d, struct uio *uio)
 	uint32_t sectoff = uio->uio_offset % LHD_SECTSIZE;
 	uint32_t len = uio->uio_resid / LHD_SECTSIZE;
 	uint32_t lenoff = uio->uio_resid % LHD_SECTSIZE;
-	uint32_t i;
-	uint32_t statval = LHD_WORKING;
+	bool iswrite = (uio->uio_rw == UIO_WRITE);
+	struct iovec *iov;
+	char *bounce;
+	uint32_t n;
 	int result;
 
 	/* Don't allow I/O that isn't sector-aligned. */
@@ -202,66 +440,62 @@ lhd_io(struct device *d, struct uio *uio)
 	}
 
 	/* Don't allow I/O past the end of the disk. */
-	/* XXX this check can overflow */
-	if (sector+len > lh->lh_dev.d_blocks) {
+	if (uio->uio_offset < 0 || len > lh->lh_dev.d_blocks ||
+	    sector > lh->lh_dev.d_blocks - len) {
 		return EINVAL;
 	}
 
-	/* Set up the value to write into the status register. */
-	if (uio->uio_rw==UIO_WRITE) {
-		statval |= LHD_ISWRITE;
+	if (len == 0) {
+		return 0;
 	}
 
-	/* Loop over all the sectors we were asked to do. */
-	for (i=0; i<len; i++) {
-
-		/* Wait until nobody else is using the device. */
-		P(lh->lh_clear);
+	iov = uio->uio_iov;
+	if (uio->uio_segflg == UIO_SYSSPACE && uio->uio_iovcnt == 1 &&
+	    iov->iov_len == uio->uio_resid) {
+		result = lhd_transfer(lh, sector, len, iov->iov_kbase,
+				      iswrite);
+		if (result) {
+			return result;
+		}
+		/* Consume the uio as uiomove would have. */
+		iov->iov_kbase = (char *)iov->iov_kbase + uio->uio_resid;
+		iov->iov_len = 0;
+		uio->uio_offset += uio->uio_resid;
+		uio->uio_resid = 0;
+		return 0;
+	}
 
-		/*
-		 * Are we writing? If so, transfer the data to the
-		 * on-card buffer.
-		 */
-		if (uio->uio_rw == UIO_WRITE) {
-			result = uiomove(lh->lh_buf, LHD_SECTSIZE, uio);
-			membar_store_store();
+	bounce = kmalloc(LHD_BOUNCESIZE);
+	if (bounce == NULL) {
+		return ENOMEM;
+	}
+	result = 0;
+	while (len > 0) {
+		n = LHD_BOUNCESIZE / LHD_SECTSIZE;
+		if (n > len) {
+			n = len;
+		}
+		if (iswrite) {
+			result = uiomove(bounce, n * LHD_SECTSIZE, uio);
 			if (result) {
-				V(lh->lh_clear);
-				return result;
+				break;
 			}
 		}
-
-		/* Tell it what sector we want... */
-		lhd_wreg(lh, LHD_REG_SECT, sector+i);
-
-		/* and start the operation. */
-		lhd_wreg(lh, LHD_REG_STAT, statval);
-
-		/* Now wait until the interrupt handler tells us we're done. */
-		P(lh->lh_done);
-
-		/* Get the result value saved by the interrupt handler. */
-		result = lh->lh_result;
-
-		/*
-		 * Are we reading? If so, and if we succeeded,
-		 * transfer the data out of the on-card buffer.
-		 */
-		if (result==0 && uio->uio_rw==UIO_READ) {
-			membar_load_load();
-			result = uiomove(lh->lh_buf, LHD_SECTSIZE, uio);
-		}
-
-		/* Tell another thread it's cleared to go ahead. */
-		V(lh->lh_clear);
-
-		/* If we failed, return the error. */
+		result = lhd_transfer(lh, sector, n, bounce, iswrite);
 		if (result) {
-			return result;
+			break;
 		}
+		if (!iswrite) {
+			result = uiomove(bounce, n * LHD_SECTSIZE, uio);
+			if (result) {
+				break;
+			}
+		}
+		sector += n;
+		len -= n;
 	}
-
-	return 0;
+	kfree(bounce);
+	return result;
 }
 
 static const struct device_ops lhd_devops = {
@@ -284,17 +518,16 @@ config_lhd(struct lhd_softc *lh, int lhdno)
 	/* Get a pointer to the on-chip buffer. */
 	lh->lh_buf = bus_map_area(lh->lh_busdata, lh->lh_buspos, LHD_BUFFER);
 
-	/* Create the semaphores. */
-	lh->lh_clear = sem_create("lhd-clear", 1);
-	if (lh->lh_clear == NULL) {
-		return ENOMEM;
-	}
-	lh->lh_done = sem_create("lhd-done", 0);
-	if (lh->lh_done == NULL) {
-		sem_destroy(lh->lh_clear);
-		lh->lh_clear = NULL;
+	/* Set up the request queue. */
+	spinlock_init(&lh->lh_lock);
+	lh->lh_wchan = wchan_create("lhd");
+	if (lh->lh_wchan == NULL) {
+		spinlock_cleanup(&lh->lh_lock);
 		return ENOMEM;
 	}
+	lh->lh_queue = NULL;
+	lh->lh_cur = NULL;
+	lh->lh_headpos = 0;
 
 	/* Set up the VFS device structure. */
 	lh->lh_dev.d_ops = &lhd_devops;
@@ -30,6 +30,7 @@
 #ifndef _LAMEBUS_LHD_H_
 #define _LAMEBUS_LHD_H_
 
+#include <spinlock.h>
 #include <device.h>
 
 /*
@@ -37,6 +38,8 @@
  */
 #define LHD_SECTSIZE  512
 
+struct lhd_request;	/* Private to lhd.c */
+
 /*
  * Hardware device data associated with lhd (LAMEbus hard disk)
  */
@@ -51,9 +54,11 @@ struct lhd_softc {
 	 */
 
 	void *lh_buf;			/* Pointer to on-card I/O buffer */
-	int lh_result;			/* Result from I/O operation */
-	struct semaphore *lh_clear;	/* Synchronization */
-	struct semaphore *lh_done;
+	struct spinlock lh_lock;	/* Protects the rest, and the regs */
+	struct wchan *lh_wchan;		/* Requests wait here to finish */
+	struct lhd_request *lh_queue;	/* Pending requests, by sector */
+	struct lhd_request *lh_cur;	/* Request on the disk now */
+	uint32_t lh_headpos;		/* Last sector transferred */
 
 	struct device lh_dev;		/* VFS device structure */
 };
@@ -31,65 +31,272 @@
  * SFS filesystem
  *
  * Block allocation.
+ *
+ * The caller names a goal block, normally the one after the block
+ * that precedes the new one in the file, and we take the first free
+ * block at or after it (wrapping around at the end of the volume).
+ * A file written sequentially thus ends up contiguous on disk, as
+ * long as nobody else allocates in its way.
+ *
+ * To keep files being written at the same time from taking turns
+ * with each other's blocks, a file that allocates a block also gets
+ * a reservation window: up to SFS_RSVBLOCKS blocks following it that
+ * other allocations skip. The file's next allocations come out of
+ * the window. Windows are not marked in the freemap, so they cost
+ * nothing on disk and vanish in a crash. A window is given up when
+ * the file allocates somewhere else, when it fills, or when the
+ * vnode is reclaimed. If the disk is so full that everything free is
+ * in someone's window, windows are ignored.
+ *
+ * A new block normally comes back zeroed (in the buffer cache, not
+ * on disk). Inodes and indirect blocks need that; so does a data
+ * block that's only going to be partly written, since the rest of it
+ * has to read as zeros. A data block that's about to be written in
+ * full doesn't, and zeroing it would cost a cache buffer and, if the
+ * buffer got written out first, a disk write. So sfs_balloc can be
+ * told not to clear the block; the caller then has to write the
+ * whole block (or clear it) before it can be read. Either way nothing
+ * forces the zeros to disk before the block is linked into a file,
+ * so after a crash a data block may hold whatever was there before.
+ * sfsck doesn't look inside data blocks, and the indirect blocks and
+ * inodes it does check are always cleared as before.
  */
 #include <types.h>
+#include <kern/errno.h>
 #include <lib.h>
 #include <bitmap.h>
+#include <synch.h>
 #include <sfs.h>
 #include "sfsprivate.h"
 
 /*
- * Zero out a disk block.
+ * Zero out a disk block. This is done in the buffer cache, so the
+ * block doesn't need to be read first.
  */
-static
 int
 sfs_clearblock(struct sfs_fs *sfs, daddr_t block)
 {
-	/* static -> automatically initialized to zero */
-	static char zeros[SFS_BLOCKSIZE];
+	struct sfs_buf *buf;
+	int result;
+
+	result = sfs_buf_get(sfs, block, &buf);
+	if (result) {
+		return result;
+	}
+	bzero(sfs_buf_map(buf), SFS_BLOCKSIZE);
+	sfs_buf_markdirty(buf);
+	return sfs_buf_release(sfs, buf);
+}
+
+/* Size of a reservation window, in blocks */
+#define SFS_RSVBLOCKS	64
+
+/*
+ * Take RSV's window, if any, off the list.
+ */
+static
+void
+sfs_rsv_drop(struct sfs_fs *sfs, struct sfs_rsv *rsv)
+{
+	struct sfs_rsv **pp;
+
+	KASSERT(lock_do_i_hold(sfs->sfs_freemaplock));
+
+	if (rsv->r_start == rsv->r_end) {
+		return;
+	}
+	for (pp = &sfs->sfs_rsvlist; *pp != NULL; pp = &(*pp)->r_next) {
+		if (*pp == rsv) {
+			*pp = rsv->r_next;
+			break;
+		}
+	}
+	rsv->r_next = NULL;
+	rsv->r_start = rsv->r_end = 0;
+}
+
+/*
+ * Open a window for RSV starting at START, cut short where another
+ * window begins.
+ */
+static
+void
+sfs_rsv_open(struct sfs_fs *sfs, struct sfs_rsv *rsv, daddr_t start)
+{
+	struct sfs_rsv *r;
+	daddr_t end;
+
+	KASSERT(rsv->r_start == rsv->r_end);
+
+	end = start + SFS_RSVBLOCKS;
+	if (end > sfs->sfs_sb.sb_nblocks) {
+		end = sfs->sfs_sb.sb_nblocks;
+	}
+	for (r = sfs->sfs_rsvlist; r != NULL; r = r->r_next) {
+		if (r->r_start <= start && start < r->r_end) {
+			return;
+		}
+		if (start < r->r_start && r->r_start < end) {
+			end = r->r_start;
+		}
+	}
+	if (start >= end) {
+		return;
+	}
+	rsv->r_start = start;
+	rsv->r_end = end;
+	rsv->r_next = sfs->sfs_rsvlist;
+	sfs->sfs_rsvlist = rsv;
+}
+
+/*
+ * Find a free block in [START, END). Unless IGNORERSV is set, skip
+ * blocks in windows other than MINE (which may be NULL).
+ */
+static
+int
+sfs_bfind(struct sfs_fs *sfs, struct sfs_rsv *mine, daddr_t start,
+	  daddr_t end, bool ignorersv, daddr_t *ret)
+{
+	struct sfs_rsv *r;
+	unsigned block;
 
-	return sfs_writeblock(sfs, block, zeros, SFS_BLOCKSIZE);
+	while (start < end) {
+		if (bitmap_nextclear(sfs->sfs_freemap, start, &block)) {
+			return ENOSPC;
+		}
+		if (block >= end) {
+			return ENOSPC;
+		}
+		start = block + 1;
+		if (!ignorersv) {
+			for (r = sfs->sfs_rsvlist; r != NULL; r = r->r_next) {
+				if (r != mine &&
+				    r->r_start <= block && block < r->r_end) {
+					start = r->r_end;
+					break;
+				}
+			}
+			if (r != NULL) {
+				continue;
+			}
+		}
+		*ret = block;
+		return 0;
+	}
+	return ENOSPC;
 }
 
 /*
- * Allocate a block.
+ * Allocate a block, starting the search at GOAL. RSV is the window of
+ * the file the block is for, or NULL if it isn't for a file's blocks
+ * (that is, it's an inode). The caller must hold that file's lock.
+ * If CLEAR is false the block is handed back with unknown contents.
  */
 int
-sfs_balloc(struct sfs_fs *sfs, daddr_t *diskblock)
+sfs_balloc(struct sfs_fs *sfs, struct sfs_rsv *rsv, daddr_t goal,
+	   bool clear, daddr_t *diskblock)
 {
+	daddr_t nblocks = sfs->sfs_sb.sb_nblocks;
+	daddr_t block;
+	bool ignorersv;
 	int result;
 
-	result = bitmap_alloc(sfs->sfs_freemap, diskblock);
-	if (result) {
-		return result;
+	if (goal >= nblocks) {
+		goal = 0;
+	}
+
+	lock_acquire(sfs->sfs_freemaplock);
+
+	/* Use the window if the goal is in it; otherwise give it up */
+	result = ENOSPC;
+	if (rsv != NULL && rsv->r_start <= goal && goal < rsv->r_end) {
+		result = sfs_bfind(sfs, rsv, goal, rsv->r_end, true, &block);
+	}
+	if (result && rsv != NULL) {
+		sfs_rsv_drop(sfs, rsv);
 	}
+
+	/* Search from the goal to the end, then from the beginning */
+	for (ignorersv = false; result; ignorersv = true) {
+		result = sfs_bfind(sfs, rsv, goal, nblocks, ignorersv, &block);
+		if (result) {
+			result = sfs_bfind(sfs, rsv, 0, goal, ignorersv,
+					   &block);
+		}
+		if (result && ignorersv) {
+			lock_release(sfs->sfs_freemaplock);
+			return result;
+		}
+	}
+
+	bitmap_mark(sfs->sfs_freemap, block);
 	sfs->sfs_freemapdirty = true;
 
+	if (rsv != NULL) {
+		rsv->r_last = block;
+		if (rsv->r_start == rsv->r_end) {
+			sfs_rsv_open(sfs, rsv, block + 1);
+		}
+		else if (block + 1 < rsv->r_end) {
+			rsv->r_start = block + 1;
+		}
+		else {
+			sfs_rsv_drop(sfs, rsv);
+		}
+	}
+	lock_release(sfs->sfs_freemaplock);
+	*diskblock = block;
+
 	if (*diskblock >= sfs->sfs_sb.sb_nblocks) {
 		panic("sfs: %s: balloc: invalid block %u\n",
 		      sfs->sfs_sb.sb_volname, *diskblock);
 	}
 
+	if (!clear) {
+		return 0;
+	}
+
 	/* Clear block before returning it */
 	result = sfs_clearblock(sfs, *diskblock);
 	if (result) {
-		bitmap_unmark(sfs->sfs_freemap, *diskblock);
+		sfs_bfree(sfs, *diskblock);
 	}
 	return result;
 }
 
+/*
+ * Give up RSV's window, if it has one.
+ */
+void
+sfs_rsv_release(struct sfs_fs *sfs, struct sfs_rsv *rsv)
+{
+	lock_acquire(sfs->sfs_freemaplock);
+	sfs_rsv_drop(sfs, rsv);
+	lock_release(sfs->sfs_freemaplock);
+}
+
 /*
  * Free a block.
  */
 void
 sfs_bfree(struct sfs_fs *sfs, daddr_t diskblock)
 {
+	/* Any cached contents are now meaningless */
+	sfs_buf_invalidate(sfs, diskblock);
+
+	lock_acquire(sfs->sfs_freemaplock);
 	bitmap_unmark(sfs->sfs_freemap, diskblock);
 	sfs->sfs_freemapdirty = true;
+	lock_release(sfs->sfs_freemaplock);
 }
 
 /*
  * Check if a block is in use.
+ *
+ * This is only used for consistency checks on blocks the caller
+ * already has a claim on, whose bits can't change underneath it, so
+ * it doesn't bother with the freemap lock.
  */
 int
 sfs_bused(struct sfs_fs *sfs, daddr_t diskblock)
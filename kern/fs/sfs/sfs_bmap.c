@@ -35,39 +35,127 @@
 #include <types.h>
 #include <kern/errno.h>
 #include <lib.h>
-#include <vfs.h>
+#include <synch.h>
 #include <sfs.h>
 #include "sfsprivate.h"
 
 /*
- * Look up the disk block number (from 0 up to the number of blocks on
- * the disk) given a file and the logical block number within that
- * file. If DOALLOC is set, and no such block exists, one will be
- * allocated.
+ * Whether new regular files are mapped by extents. Settable from the
+ * kernel menu.
+ */
+bool sfs_extents = true;
+
+/*
+ * Number of file blocks mapped by one entry of an indirect block at
+ * each level of indirection: a single indirect block's entries map
+ * one block each, a double indirect block's map SFS_DBPERIDB each,
+ * and so on.
+ */
+static const uint32_t sfs_ibrange[4] = {
+	0,
+	1,
+	SFS_DBPERIDB,
+	SFS_DBPERIDB * SFS_DBPERIDB,
+};
+
+static void sfs_extent_lookup(struct sfs_vnode *sv, uint32_t fileblock,
+			      daddr_t *diskblock, uint32_t *runlen);
+
+/*
+ * Allocate a block for SV that will hold file block FILEBLOCK, or an
+ * indirect block on the way to it. We'd like it to follow the block
+ * before it in the file. For a file mapped by extents, or a direct
+ * block, we can see where that is. Otherwise we'd have to read
+ * indirect blocks, which we may be in the middle of using, so go by
+ * the block most recently allocated to the file instead; for a file
+ * being written sequentially that's the same thing. A file with no
+ * blocks yet starts after its inode. CLEAR is passed to sfs_balloc.
  */
+static
 int
-sfs_bmap(struct sfs_vnode *sv, uint32_t fileblock, bool doalloc,
-	 daddr_t *diskblock)
+sfs_bmap_balloc(struct sfs_vnode *sv, uint32_t fileblock, bool clear,
+		daddr_t *diskblock)
 {
-	/*
-	 * I/O buffer for handling indirect blocks.
-	 *
-	 * Note: in real life (and when you've done the fs assignment)
-	 * you would get space from the disk buffer cache for this,
-	 * not use a static area.
-	 */
-	static uint32_t idbuf[SFS_DBPERIDB];
+	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	daddr_t prev = 0;
+	uint32_t runlen;
 
+	if (fileblock > 0 && (sv->sv_i.sfi_flags & SFS_IFLAG_EXTENTS)) {
+		sfs_extent_lookup(sv, fileblock - 1, &prev, &runlen);
+	}
+	else if (fileblock > 0 && fileblock <= SFS_NDIRECT) {
+		prev = sv->sv_i.sfi_direct[fileblock - 1];
+	}
+	if (prev == 0) {
+		prev = sv->sv_rsv.r_last;
+	}
+	if (prev == 0) {
+		prev = sv->sv_ino;
+	}
+	return sfs_balloc(sfs, &sv->sv_rsv, prev + 1, clear, diskblock);
+}
+
+/*
+ * Find the inode field holding the top of the indirect block tree
+ * that maps FILEBLOCK, and the tree's depth. On return *FILEBLOCKP
+ * is the block number relative to the start of that tree. Returns
+ * EFBIG if the block is past the end of the largest tree.
+ */
+static
+int
+sfs_bmap_tree(struct sfs_vnode *sv, uint32_t *fileblockp,
+	      uint32_t **rootp, unsigned *levelsp)
+{
+	uint32_t fileblock = *fileblockp - SFS_NDIRECT;
+
+	if (fileblock < SFS_DBPERIDB) {
+		*rootp = &sv->sv_i.sfi_indirect;
+		*levelsp = 1;
+	}
+	else if ((fileblock -= SFS_DBPERIDB) < SFS_DBPERIDB * SFS_DBPERIDB) {
+		*rootp = &sv->sv_i.sfi_dindirect;
+		*levelsp = 2;
+	}
+	else if ((fileblock -= SFS_DBPERIDB * SFS_DBPERIDB) <
+		 SFS_DBPERIDB * SFS_DBPERIDB * SFS_DBPERIDB) {
+		*rootp = &sv->sv_i.sfi_tindirect;
+		*levelsp = 3;
+	}
+	else {
+		return EFBIG;
+	}
+	*fileblockp = fileblock;
+	return 0;
+}
+
+/*
+ * Block mapping for files that use the block pointers. This is
+ * sfs_bmap, except that if NEWBLOCK is not 0 and a data block needs
+ * to be allocated, NEWBLOCK is used instead. (Indirect blocks are
+ * still allocated as usual.)
+ *
+ * Blocks past the direct blocks are found by walking down from the
+ * single, double, or triple indirect block. If we're not allocating,
+ * a missing block at any level means the whole range it would map is
+ * a hole, so we stop there and return 0; nothing is allocated to
+ * read a sparse file.
+ */
+static
+int
+sfs_bmap_blocks(struct sfs_vnode *sv, uint32_t fileblock, bool doalloc,
+		daddr_t newblock, daddr_t *diskblock)
+{
 	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	struct sfs_buf *idbuf;
+	uint32_t *iddata;
+	uint32_t *root;
 	daddr_t block;
 	daddr_t idblock;
-	uint32_t idnum, idoff;
+	uint32_t idoff, origblock;
+	unsigned levels, level;
 	int result;
 
-	KASSERT(sizeof(idbuf)==SFS_BLOCKSIZE);
-
-	/* Since we're using a static buffer, we'd better be locked. */
-	KASSERT(vfs_biglock_do_i_hold());
+	COMPILE_ASSERT(SFS_DBPERIDB * sizeof(uint32_t) == SFS_BLOCKSIZE);
 
 	/*
 	 * If the block we want is one of the direct blocks...
@@ -82,9 +170,15 @@ sfs_bmap(struct sfs_vnode *sv, uint32_t fileblock, bool doalloc,
 		 * Do we need to allocate?
 		 */
 		if (block==0 && doalloc) {
-			result = sfs_balloc(sfs, &block);
-			if (result) {
-				return result;
+			if (newblock != 0) {
+				block = newblock;
+			}
+			else {
+				result = sfs_bmap_balloc(sv, fileblock, true,
+							 &block);
+				if (result) {
+					return result;
+				}
 			}
 
 			/* Remember what we allocated; mark inode dirty */
@@ -105,27 +199,17 @@ sfs_bmap(struct sfs_vnode *sv, uint32_t fileblock, bool doalloc,
 	}
 
 	/*
-	 * It's not a direct block; it must be in the indirect block.
-	 * Subtract off the number of direct blocks, so FILEBLOCK is
-	 * now the offset into the indirect block space.
-	 */
-
-	fileblock -= SFS_NDIRECT;
-
-	/* Get the indirect block number and offset w/i that indirect block */
-	idnum = fileblock / SFS_DBPERIDB;
-	idoff = fileblock % SFS_DBPERIDB;
-
-	/*
-	 * We only have one indirect block. If the offset we were asked for
-	 * is too large, we can't handle it, so fail.
+	 * It's not a direct block; figure out which indirect block
+	 * tree it's in, and its offset within that tree.
 	 */
-	if (idnum >= SFS_NINDIRECT) {
-		return EFBIG;
+	origblock = fileblock;
+	result = sfs_bmap_tree(sv, &fileblock, &root, &levels);
+	if (result) {
+		return result;
 	}
 
-	/* Get the disk block number of the indirect block. */
-	idblock = sv->sv_i.sfi_indirect;
+	/* Get the disk block number of the top indirect block. */
+	idblock = *root;
 
 	if (idblock==0 && !doalloc) {
 		/*
@@ -143,89 +227,600 @@ sfs_bmap(struct sfs_vnode *sv, uint32_t fileblock, bool doalloc,
 		 * the indirect block. Thus, we need to allocate an
 		 * indirect block.
 		 */
-		result = sfs_balloc(sfs, &idblock);
+		result = sfs_bmap_balloc(sv, origblock, true, &idblock);
 		if (result) {
 			return result;
 		}
 
 		/* Remember the block we just allocated */
-		sv->sv_i.sfi_indirect = idblock;
+		*root = idblock;
 
 		/* Mark the inode dirty */
 		sv->sv_dirty = true;
-
-		/* Clear the indirect block buffer */
-		bzero(idbuf, sizeof(idbuf));
 	}
-	else {
+
+	/*
+	 * Walk down the tree. At each level, IDBLOCK is an indirect
+	 * block and FILEBLOCK is the offset within the range it maps.
+	 */
+	for (level = levels; level > 0; level--) {
+		idoff = fileblock / sfs_ibrange[level];
+		fileblock = fileblock % sfs_ibrange[level];
+
 		/*
-		 * We already have an indirect block allocated; load it.
+		 * Load the indirect block. (sfs_balloc zeroed it if
+		 * we just allocated it, and it's still in the buffer
+		 * cache.)
 		 */
-		result = sfs_readblock(sfs, idblock, idbuf, sizeof(idbuf));
+		result = sfs_buf_read(sfs, idblock, &idbuf);
 		if (result) {
 			return result;
 		}
-	}
+		iddata = sfs_buf_map(idbuf);
 
-	/* Get the block out of the indirect block buffer */
-	block = idbuf[idoff];
+		/* Get the next block down out of the buffer */
+		block = iddata[idoff];
 
-	/* If there's no block there, allocate one */
-	if (block==0 && doalloc) {
-		result = sfs_balloc(sfs, &block);
-		if (result) {
-			return result;
+		/* If there's no block there, allocate one */
+		if (block==0 && doalloc && level == 1 && newblock != 0) {
+			block = newblock;
+			iddata[idoff] = block;
+			sfs_buf_markdirty(idbuf);
 		}
+		else if (block==0 && doalloc) {
+			result = sfs_bmap_balloc(sv, origblock, true, &block);
+			if (result) {
+				sfs_buf_release(sfs, idbuf);
+				return result;
+			}
 
-		/* Remember the block we allocated */
-		idbuf[idoff] = block;
+			/* Remember the block we allocated */
+			iddata[idoff] = block;
+
+			/* The indirect block is now dirty */
+			sfs_buf_markdirty(idbuf);
+		}
 
-		/* The indirect block is now dirty; write it back */
-		result = sfs_writeblock(sfs, idblock, idbuf, sizeof(idbuf));
+		result = sfs_buf_release(sfs, idbuf);
 		if (result) {
 			return result;
 		}
+
+		if (block == 0) {
+			/* A hole; everything below here is zeros. */
+			break;
+		}
+		idblock = block;
 	}
 
 	/* Hand back the result and return. */
 	if (block != 0 && !sfs_bused(sfs, block)) {
 		panic("sfs: %s: Data block %u (block %u of file %u) "
 		      "marked free\n", sfs->sfs_sb.sb_volname,
-		      block, fileblock, sv->sv_ino);
+		      block, origblock, sv->sv_ino);
 	}
 	*diskblock = block;
 	return 0;
 }
 
 /*
- * Called for ftruncate() and from sfs_reclaim.
+ * Discard the blocks mapped by the indirect block *IDBLOCKP (at
+ * indirection level LEVEL, mapping file blocks starting at BASEBLOCK)
+ * that are at or past BLOCKLEN. If that leaves it empty, free it too
+ * and set *IDBLOCKP to 0. Subtrees wholly before BLOCKLEN, and holes,
+ * are not looked at, so truncating a sparse file only reads the
+ * indirect blocks that actually exist past the new EOF.
+ *
+ * If FREEDATA is false, only the indirect blocks are freed; the data
+ * blocks are just dropped from the map.
  */
+static
 int
-sfs_itrunc(struct sfs_vnode *sv, off_t len)
+sfs_itrunc_ib(struct sfs_fs *sfs, uint32_t *idblockp, unsigned level,
+	      uint32_t baseblock, uint32_t blocklen, bool freedata)
+{
+	struct sfs_buf *idbuf;
+	uint32_t *iddata;
+	uint32_t range, entrybase, j;
+	daddr_t idblock;
+	bool hasnonzero;
+	int result;
+
+	idblock = *idblockp;
+	range = sfs_ibrange[level];
+
+	if (idblock == 0 || baseblock + range * SFS_DBPERIDB <= blocklen) {
+		/* Nothing here, or nothing past the proposed EOF */
+		return 0;
+	}
+
+	/* Read the indirect block */
+	result = sfs_buf_read(sfs, idblock, &idbuf);
+	if (result) {
+		return result;
+	}
+	iddata = sfs_buf_map(idbuf);
+
+	hasnonzero = false;
+	for (j=0; j<SFS_DBPERIDB; j++) {
+		entrybase = baseblock + j * range;
+
+		/* Discard anything that's past the new EOF */
+		if (iddata[j] != 0 && entrybase + range > blocklen) {
+			if (level == 1) {
+				if (freedata) {
+					sfs_bfree(sfs, iddata[j]);
+				}
+				iddata[j] = 0;
+				sfs_buf_markdirty(idbuf);
+			}
+			else {
+				result = sfs_itrunc_ib(sfs, &iddata[j],
+						       level - 1, entrybase,
+						       blocklen, freedata);
+				if (iddata[j] == 0) {
+					sfs_buf_markdirty(idbuf);
+				}
+				if (result) {
+					sfs_buf_release(sfs, idbuf);
+					return result;
+				}
+			}
+		}
+		/* Remember if we see any nonzero blocks in here */
+		if (iddata[j] != 0) {
+			hasnonzero = true;
+		}
+	}
+
+	/* Write back any changes */
+	result = sfs_buf_release(sfs, idbuf);
+	if (result) {
+		return result;
+	}
+
+	if (!hasnonzero) {
+		/* The whole indirect block is empty now; free it */
+		sfs_bfree(sfs, idblock);
+		*idblockp = 0;
+	}
+	return 0;
+}
+
+////////////////////////////////////////////////////////////
+//
+// Extents
+
+/*
+ * Find the extent of SV that maps FILEBLOCK, or if FILEBLOCK is in a
+ * hole, the first extent after it. Returns SFS_NEXTENTS, or the index
+ * of the first unused entry, if there is none.
+ */
+static
+unsigned
+sfs_extent_find(struct sfs_vnode *sv, uint32_t fileblock)
 {
+	struct sfs_extent *se;
+	unsigned i;
+
+	for (i=0; i<SFS_NEXTENTS; i++) {
+		se = &sv->sv_i.sfi_extents[i];
+		if (se->se_len == 0 ||
+		    fileblock < se->se_fileblock + se->se_len) {
+			break;
+		}
+	}
+	return i;
+}
+
+/*
+ * Look up FILEBLOCK in SV's extents. Hands back the disk block (0 for
+ * a hole) and the number of blocks from there on that are mapped the
+ * same way: the rest of the extent, or the rest of the hole.
+ */
+static
+void
+sfs_extent_lookup(struct sfs_vnode *sv, uint32_t fileblock,
+		  daddr_t *diskblock, uint32_t *runlen)
+{
+	struct sfs_extent *se;
+	unsigned i;
+
+	KASSERT(fileblock < SFS_MAXFILEBLOCKS);
+
+	i = sfs_extent_find(sv, fileblock);
+	if (i == SFS_NEXTENTS || sv->sv_i.sfi_extents[i].se_len == 0) {
+		/* Past the last extent */
+		*diskblock = 0;
+		*runlen = SFS_MAXFILEBLOCKS - fileblock;
+		return;
+	}
+
+	se = &sv->sv_i.sfi_extents[i];
+	if (fileblock < se->se_fileblock) {
+		/* In the hole before extent I */
+		*diskblock = 0;
+		*runlen = se->se_fileblock - fileblock;
+		return;
+	}
+
+	*diskblock = se->se_diskblock + (fileblock - se->se_fileblock);
+	*runlen = se->se_len - (fileblock - se->se_fileblock);
+}
+
+/*
+ * Map FILEBLOCK, which is in a hole, to disk block BLOCK. If that
+ * continues the extent before it, or leads into the one after it,
+ * they grow; otherwise a new extent is added. Returns ENOSPC if that
+ * would take more extents than the inode has room for.
+ */
+static
+int
+sfs_extent_add(struct sfs_vnode *sv, uint32_t fileblock, daddr_t block)
+{
+	struct sfs_extent *ext = sv->sv_i.sfi_extents;
+	unsigned i, n;
+	bool joinprev, joinnext;
+
+	i = sfs_extent_find(sv, fileblock);
+	for (n = i; n < SFS_NEXTENTS && ext[n].se_len > 0; n++) {
+		/* nothing */
+	}
+	KASSERT(i == n || fileblock < ext[i].se_fileblock);
+
+	joinprev = i > 0 &&
+		ext[i-1].se_fileblock + ext[i-1].se_len == fileblock &&
+		ext[i-1].se_diskblock + ext[i-1].se_len == block;
+	joinnext = i < n &&
+		ext[i].se_fileblock == fileblock + 1 &&
+		ext[i].se_diskblock == block + 1;
+
+	if (joinprev && joinnext) {
+		/* Filled the gap between two extents; merge them */
+		ext[i-1].se_len += 1 + ext[i].se_len;
+		memmove(&ext[i], &ext[i+1], (n - i - 1) * sizeof(ext[0]));
+		bzero(&ext[n-1], sizeof(ext[0]));
+	}
+	else if (joinprev) {
+		ext[i-1].se_len++;
+	}
+	else if (joinnext) {
+		ext[i].se_fileblock--;
+		ext[i].se_diskblock--;
+		ext[i].se_len++;
+	}
+	else {
+		if (n == SFS_NEXTENTS) {
+			return ENOSPC;
+		}
+		memmove(&ext[i+1], &ext[i], (n - i) * sizeof(ext[0]));
+		ext[i].se_fileblock = fileblock;
+		ext[i].se_diskblock = block;
+		ext[i].se_len = 1;
+	}
+	sv->sv_dirty = true;
+	return 0;
+}
+
+/*
+ * Drop extents past BLOCKLEN blocks, freeing their blocks.
+ */
+static
+void
+sfs_extent_trunc(struct sfs_vnode *sv, uint32_t blocklen)
+{
+	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	struct sfs_extent *se;
+	uint32_t keep, j;
+	unsigned i;
+
+	for (i=0; i<SFS_NEXTENTS; i++) {
+		se = &sv->sv_i.sfi_extents[i];
+		if (se->se_len == 0) {
+			break;
+		}
+		if (se->se_fileblock + se->se_len <= blocklen) {
+			continue;
+		}
+
+		/* The extents are sorted, so the rest go too */
+		keep = 0;
+		if (se->se_fileblock < blocklen) {
+			keep = blocklen - se->se_fileblock;
+		}
+		for (j=keep; j<se->se_len; j++) {
+			sfs_bfree(sfs, se->se_diskblock + j);
+		}
+		if (keep > 0) {
+			se->se_len = keep;
+		}
+		else {
+			bzero(se, sizeof(*se));
+		}
+		sv->sv_dirty = true;
+	}
+}
+
+/*
+ * Convert SV from extents to block pointers, because it needs more
+ * extents than fit. This has to allocate indirect blocks as it goes;
+ * if it runs out of space, the indirect blocks are given back and
+ * the extents are put back the way they were.
+ */
+static
+int
+sfs_extent_convert(struct sfs_vnode *sv)
+{
+	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	struct sfs_extent ext[SFS_NEXTENTS];
+	uint32_t baseblock, j;
+	uint32_t *root;
+	daddr_t block;
+	unsigned i, level;
+	int result;
+
+	memcpy(ext, sv->sv_i.sfi_extents, sizeof(ext));
+	bzero(sv->sv_i.sfi_extents, sizeof(ext));
+	sv->sv_i.sfi_flags &= ~SFS_IFLAG_EXTENTS;
+	sv->sv_dirty = true;
+
+	for (i=0; i<SFS_NEXTENTS && ext[i].se_len > 0; i++) {
+		for (j=0; j<ext[i].se_len; j++) {
+			result = sfs_bmap_blocks(sv, ext[i].se_fileblock + j,
+						 true, ext[i].se_diskblock + j,
+						 &block);
+			if (result) {
+				goto fail;
+			}
+		}
+	}
+	return 0;
+
+ fail:
 	/*
-	 * I/O buffer for handling the indirect block.
-	 *
-	 * Note: in real life (and when you've done the fs assignment)
-	 * you would get space from the disk buffer cache for this,
-	 * not use a static area.
+	 * Free the indirect blocks but not the data blocks they map.
+	 * If that fails partway the rest are leaked (sfsck will
+	 * find them), but the file itself stays intact.
 	 */
-	static uint32_t idbuf[SFS_DBPERIDB];
+	bzero(sv->sv_i.sfi_direct, sizeof(sv->sv_i.sfi_direct));
+	baseblock = SFS_NDIRECT;
+	for (level = 1; level <= 3; level++) {
+		switch (level) {
+		    case 1: root = &sv->sv_i.sfi_indirect; break;
+		    case 2: root = &sv->sv_i.sfi_dindirect; break;
+		    default: root = &sv->sv_i.sfi_tindirect; break;
+		}
+		sfs_itrunc_ib(sfs, root, level, baseblock, 0, false);
+		*root = 0;
+		baseblock += sfs_ibrange[level] * SFS_DBPERIDB;
+	}
+	memcpy(sv->sv_i.sfi_extents, ext, sizeof(ext));
+	sv->sv_i.sfi_flags |= SFS_IFLAG_EXTENTS;
+	return result;
+}
+
+/*
+ * Map file block FILEBLOCK of SV, which is a hole, to the data block
+ * BLOCK, which the caller has already allocated. On error the caller
+ * still owns BLOCK.
+ */
+static
+int
+sfs_bmap_install(struct sfs_vnode *sv, uint32_t fileblock, daddr_t block)
+{
+	daddr_t mapped;
+	int result;
+
+	if ((sv->sv_i.sfi_flags & SFS_IFLAG_EXTENTS) == 0) {
+		return sfs_bmap_blocks(sv, fileblock, true, block, &mapped);
+	}
+
+	result = sfs_extent_add(sv, fileblock, block);
+	if (result == ENOSPC) {
+		/* Too fragmented; switch to block pointers */
+		result = sfs_extent_convert(sv);
+		if (result == 0) {
+			result = sfs_bmap_blocks(sv, fileblock, true,
+						 block, &mapped);
+		}
+	}
+	return result;
+}
+
+/*
+ * sfs_bmap for files mapped by extents.
+ */
+static
+int
+sfs_bmap_extents(struct sfs_vnode *sv, uint32_t fileblock, bool doalloc,
+		 daddr_t *diskblock)
+{
+	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	daddr_t block;
+	uint32_t runlen;
+	int result;
+
+	if (fileblock >= SFS_MAXFILEBLOCKS) {
+		return EFBIG;
+	}
+
+	sfs_extent_lookup(sv, fileblock, &block, &runlen);
+	if (block == 0 && doalloc) {
+		result = sfs_bmap_balloc(sv, fileblock, true, &block);
+		if (result) {
+			return result;
+		}
+		result = sfs_bmap_install(sv, fileblock, block);
+		if (result) {
+			sfs_bfree(sfs, block);
+			return result;
+		}
+	}
+
+	if (block != 0 && !sfs_bused(sfs, block)) {
+		panic("sfs: %s: Data block %u (block %u of file %u) "
+		      "marked free\n", sfs->sfs_sb.sb_volname,
+		      block, fileblock, sv->sv_ino);
+	}
+	*diskblock = block;
+	return 0;
+}
+
+////////////////////////////////////////////////////////////
+//
+// Interface
+
+/*
+ * Look up the disk block number (from 0 up to the number of blocks on
+ * the disk) given a file and the logical block number within that
+ * file. If DOALLOC is set, and no such block exists, one will be
+ * allocated. The caller must hold the vnode's lock.
+ */
+int
+sfs_bmap(struct sfs_vnode *sv, uint32_t fileblock, bool doalloc,
+	 daddr_t *diskblock)
+{
+	KASSERT(lock_do_i_hold(sv->sv_lock));
+
+	if (sv->sv_i.sfi_flags & SFS_IFLAG_EXTENTS) {
+		return sfs_bmap_extents(sv, fileblock, doalloc, diskblock);
+	}
+	return sfs_bmap_blocks(sv, fileblock, doalloc, 0, diskblock);
+}
+
+/*
+ * Like sfs_bmap, but also hand back in *RUNLEN how many file blocks,
+ * starting with FILEBLOCK and not more than MAXRUN, lie in
+ * consecutive disk blocks starting with *DISKBLOCK; or if *DISKBLOCK
+ * is 0, how many are holes. This lets sfs_io move a whole run with
+ * one disk request.
+ *
+ * For a file mapped by extents, existing blocks come straight out of
+ * the extent. Otherwise we go block by block; an error after the
+ * first block ends the run, and the next call will run into it
+ * again.
+ *
+ * If DOALLOC is set and FILEBLOCK is in a hole, the hole is filled
+ * for as long as the blocks we get keep the run going, and *NEWRUN
+ * is set. These blocks are not cleared: the caller is about to write
+ * all of them, and must clear whatever it doesn't write. A block
+ * that doesn't continue the run ends it; it stays mapped for the
+ * next call, so it is cleared as usual.
+ */
+int
+sfs_bmaprun(struct sfs_vnode *sv, uint32_t fileblock, uint32_t maxrun,
+	    bool doalloc, daddr_t *diskblock, uint32_t *runlen,
+	    bool *newrun)
+{
+	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	daddr_t first, block;
+	uint32_t n, holelen;
+	bool runends;
+	int result;
+
+	KASSERT(maxrun > 0);
+
+	*newrun = false;
 
+	if (sv->sv_i.sfi_flags & SFS_IFLAG_EXTENTS) {
+		if (fileblock >= SFS_MAXFILEBLOCKS) {
+			return EFBIG;
+		}
+		sfs_extent_lookup(sv, fileblock, &first, &n);
+		if (n > maxrun) {
+			n = maxrun;
+		}
+	}
+	else {
+		result = sfs_bmap(sv, fileblock, false, &first);
+		if (result) {
+			return result;
+		}
+		for (n = 1; n < maxrun; n++) {
+			result = sfs_bmap(sv, fileblock + n, false, &block);
+			if (result) {
+				break;
+			}
+			if (first == 0 ? block != 0 : block != first + n) {
+				break;
+			}
+		}
+	}
+
+	if (first != 0 || !doalloc) {
+		*diskblock = first;
+		*runlen = n;
+		return 0;
+	}
+
+	/* Fill the hole */
+	holelen = n;
+	for (n = 0; n < holelen; n++) {
+		result = sfs_bmap_balloc(sv, fileblock + n, false, &block);
+		if (result) {
+			break;
+		}
+		runends = n > 0 && block != first + n;
+		if (runends) {
+			result = sfs_clearblock(sfs, block);
+		}
+		if (result == 0) {
+			result = sfs_bmap_install(sv, fileblock + n, block);
+		}
+		if (result) {
+			sfs_bfree(sfs, block);
+			break;
+		}
+		if (runends) {
+			break;
+		}
+		if (n == 0) {
+			first = block;
+		}
+	}
+	if (n == 0) {
+		return result;
+	}
+
+	*diskblock = first;
+	*runlen = n;
+	*newrun = true;
+	return 0;
+}
+
+/*
+ * Called for ftruncate() and from sfs_reclaim. The caller must hold
+ * the vnode's lock.
+ */
+int
+sfs_itrunc(struct sfs_vnode *sv, off_t len)
+{
 	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
 
 	/* Length in blocks (divide rounding up) */
 	uint32_t blocklen = DIVROUNDUP(len, SFS_BLOCKSIZE);
 
-	uint32_t i, j;
-	daddr_t block, idblock;
-	uint32_t baseblock, highblock;
+	uint32_t i;
+	daddr_t block;
+	uint32_t baseblock;
+	uint32_t *root;
+	daddr_t oldroot;
+	unsigned level;
 	int result;
-	int hasnonzero, iddirty;
 
-	KASSERT(sizeof(idbuf)==SFS_BLOCKSIZE);
+	KASSERT(lock_do_i_hold(sv->sv_lock));
+
+	if (len < 0) {
+		return EINVAL;
+	}
+	if (len > SFS_MAXFILESIZE) {
+		return EFBIG;
+	}
 
-	vfs_biglock_acquire();
+	if (sv->sv_i.sfi_flags & SFS_IFLAG_EXTENTS) {
+		sfs_extent_trunc(sv, blocklen);
+		goto done;
+	}
 
 	/*
 	 * Go through the direct blocks. Discard any that are
@@ -240,64 +835,44 @@ sfs_itrunc(struct sfs_vnode *sv, off_t len)
 		}
 	}
 
-	/* Indirect block number */
-	idblock = sv->sv_i.sfi_indirect;
-
-	/* The lowest block in the indirect block */
+	/*
+	 * Now the single, double, and triple indirect trees, which
+	 * map consecutive ranges of the file after the direct blocks.
+	 */
 	baseblock = SFS_NDIRECT;
-
-	/* The highest block in the indirect block */
-	highblock = baseblock + SFS_DBPERIDB - 1;
-
-	if (blocklen < highblock && idblock != 0) {
-		/* We're past the proposed EOF; may need to free stuff */
-
-		/* Read the indirect block */
-		result = sfs_readblock(sfs, idblock, idbuf, sizeof(idbuf));
-		if (result) {
-			vfs_biglock_release();
-			return result;
+	for (level = 1; level <= 3; level++) {
+		switch (level) {
+		    case 1: root = &sv->sv_i.sfi_indirect; break;
+		    case 2: root = &sv->sv_i.sfi_dindirect; break;
+		    default: root = &sv->sv_i.sfi_tindirect; break;
 		}
-
-		hasnonzero = 0;
-		iddirty = 0;
-		for (j=0; j<SFS_DBPERIDB; j++) {
-			/* Discard any blocks that are past the new EOF */
-			if (blocklen < baseblock+j && idbuf[j] != 0) {
-				sfs_bfree(sfs, idbuf[j]);
-				idbuf[j] = 0;
-				iddirty = 1;
-			}
-			/* Remember if we see any nonzero blocks in here */
-			if (idbuf[j]!=0) {
-				hasnonzero=1;
-			}
-		}
-
-		if (!hasnonzero) {
-			/* The whole indirect block is empty now; free it */
-			sfs_bfree(sfs, idblock);
-			sv->sv_i.sfi_indirect = 0;
+		oldroot = *root;
+		result = sfs_itrunc_ib(sfs, root, level, baseblock, blocklen,
+				       true);
+		if (*root != oldroot) {
 			sv->sv_dirty = true;
 		}
-		else if (iddirty) {
-			/* The indirect block is dirty; write it back */
-			result = sfs_writeblock(sfs, idblock, idbuf,
-						sizeof(idbuf));
-			if (result) {
-				vfs_biglock_release();
-				return result;
-			}
+		if (result) {
+			return result;
 		}
+		baseblock += sfs_ibrange[level] * SFS_DBPERIDB;
 	}
 
+	/*
+	 * A file truncated to nothing has no blocks left, so if it was
+	 * converted off extents it can start over with them.
+	 */
+	if (blocklen == 0 && sv->sv_i.sfi_type == SFS_TYPE_FILE &&
+	    sfs_extents) {
+		sv->sv_i.sfi_flags |= SFS_IFLAG_EXTENTS;
+	}
+
+ done:
 	/* Set the file size */
 	sv->sv_i.sfi_size = len;
 
 	/* Mark the inode dirty */
 	sv->sv_dirty = true;
 
-	vfs_biglock_release();
 	return 0;
 }
-
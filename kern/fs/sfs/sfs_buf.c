@@ -0,0 +1,806 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009, 2014
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+/*
+ * SFS filesystem
+ *
+ * Block buffer cache.
+ *
+ * Each mounted volume has a fixed pool of SFS_NBUFS block-sized
+ * buffers. Buffers that hold a disk block are found through a hash
+ * table keyed on the block number; buffers that nobody is currently
+ * using sit on an LRU list, and the least recently used one is
+ * recycled when a block that isn't cached is needed.
+ *
+ * All block I/O for a volume except the raw transfers done here goes
+ * through the cache, with one exception: sfs_io moves long runs of
+ * file data straight between the disk and the caller. It uses
+ * sfs_buf_writeback and sfs_buf_invalidate to keep the cache out of
+ * its way, and otherwise the cache never has to worry about the disk
+ * having been changed behind its back.
+ *
+ * Writes are delayed: a modified buffer stays in the cache, marked
+ * dirty, until it is evicted or until sfs_buf_flush is called (by
+ * sync, fsync, or the volume's syncer thread). Repeated writes to the
+ * same block in between cost only one disk write.
+ *
+ * Blocks can also be read in ahead of time (sfs_buf_prefetch, from
+ * the readahead thread). Such buffers are flagged until somebody
+ * actually asks for them, so we can count how much readahead pays
+ * off and how much is thrown away unused.
+ *
+ * Locking: the hash table, the LRU list, and the bookkeeping fields
+ * of every buffer are protected by bc_lock. A buffer is handed out to
+ * one thread at a time (b_busy); that thread may look at and change
+ * b_data, b_valid, and b_dirty without holding bc_lock, and does disk
+ * I/O on the buffer with bc_lock released. Threads that want a busy
+ * buffer, or any buffer at all when every buffer is busy, wait on
+ * bc_cv.
+ *
+ * Buffers come after all the other SFS locks in the lock order. A
+ * thread may own more than one buffer only when the outer one is a
+ * file's indirect block (sfs_bmap, sfs_itrunc); nobody else can be
+ * after that block, because it's covered by the file's vnode lock.
+ */
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <synch.h>
+#include <uio.h>
+#include <sfs.h>
+#include "sfsprivate.h"
+
+/* Number of buffers per volume */
+#define SFS_NBUFS	128
+
+/* Number of hash buckets; must be a power of 2 */
+#define SFS_BUFHASH	64
+
+/*
+ * A buffer.
+ *
+ * b_valid is true if b_data holds the contents of b_block (or newer
+ * contents, if b_dirty is also set). A buffer is on its hash chain
+ * whenever it is attached to a block. b_refcount counts the thread
+ * that has the buffer busy plus any threads waiting for it; the
+ * buffer is on the LRU list exactly when b_refcount is 0.
+ */
+struct sfs_buf {
+	struct sfs_buf *b_hashnext;	/* next buffer in hash chain */
+	struct sfs_buf *b_lruprev;	/* previous buffer in LRU list */
+	struct sfs_buf *b_lrunext;	/* next buffer in LRU list */
+	daddr_t b_block;		/* disk block held */
+	unsigned b_refcount;		/* owner plus waiters */
+	bool b_busy;			/* true if handed out */
+	bool b_attached;		/* true if b_block is meaningful */
+	bool b_valid;			/* true if b_data is meaningful */
+	bool b_dirty;			/* true if b_data must be written */
+	bool b_prefetched;		/* read ahead and not yet used */
+	void *b_data;			/* the block itself */
+};
+
+/*
+ * The cache for one volume.
+ *
+ * The LRU list runs from least recently used (head) to most recently
+ * used (tail).
+ */
+struct sfs_bufcache {
+	struct lock *bc_lock;		/* protects everything but b_data */
+	struct cv *bc_cv;		/* a buffer was released */
+	struct sfs_buf bc_bufs[SFS_NBUFS];
+	struct sfs_buf *bc_hash[SFS_BUFHASH];
+	struct sfs_buf *bc_lruhead;
+	struct sfs_buf *bc_lrutail;
+	char *bc_space;			/* storage for all the b_data */
+};
+
+/*
+ * Statistics, across all volumes.
+ */
+static struct spinlock sfs_bufstats_lock = SPINLOCK_INITIALIZER;
+static struct {
+	unsigned hits;
+	unsigned misses;
+	unsigned evictions;
+	unsigned reads;
+	unsigned writes;
+	unsigned waits;
+	unsigned prefetches;
+	unsigned rahits;
+	unsigned rawaste;
+} sfs_bufstats_data;
+
+#define SFS_BUFSTAT(field) do { \
+		spinlock_acquire(&sfs_bufstats_lock); \
+		sfs_bufstats_data.field++; \
+		spinlock_release(&sfs_bufstats_lock); \
+	} while (0)
+
+////////////////////////////////////////////////////////////
+// List and hash management
+
+static
+unsigned
+sfs_buf_hashslot(daddr_t block)
+{
+	return (block ^ (block >> 6)) & (SFS_BUFHASH - 1);
+}
+
+static
+void
+sfs_buf_lruremove(struct sfs_bufcache *bc, struct sfs_buf *b)
+{
+	if (b->b_lruprev != NULL) {
+		b->b_lruprev->b_lrunext = b->b_lrunext;
+	}
+	else {
+		KASSERT(bc->bc_lruhead == b);
+		bc->bc_lruhead = b->b_lrunext;
+	}
+	if (b->b_lrunext != NULL) {
+		b->b_lrunext->b_lruprev = b->b_lruprev;
+	}
+	else {
+		KASSERT(bc->bc_lrutail == b);
+		bc->bc_lrutail = b->b_lruprev;
+	}
+	b->b_lruprev = b->b_lrunext = NULL;
+}
+
+static
+void
+sfs_buf_lruappend(struct sfs_bufcache *bc, struct sfs_buf *b)
+{
+	KASSERT(b->b_lruprev == NULL && b->b_lrunext == NULL);
+	b->b_lruprev = bc->bc_lrutail;
+	if (bc->bc_lrutail != NULL) {
+		bc->bc_lrutail->b_lrunext = b;
+	}
+	else {
+		bc->bc_lruhead = b;
+	}
+	bc->bc_lrutail = b;
+}
+
+static
+void
+sfs_buf_lruprepend(struct sfs_bufcache *bc, struct sfs_buf *b)
+{
+	KASSERT(b->b_lruprev == NULL && b->b_lrunext == NULL);
+	b->b_lrunext = bc->bc_lruhead;
+	if (bc->bc_lruhead != NULL) {
+		bc->bc_lruhead->b_lruprev = b;
+	}
+	else {
+		bc->bc_lrutail = b;
+	}
+	bc->bc_lruhead = b;
+}
+
+static
+struct sfs_buf *
+sfs_buf_lookup(struct sfs_bufcache *bc, daddr_t block)
+{
+	struct sfs_buf *b;
+
+	for (b = bc->bc_hash[sfs_buf_hashslot(block)];
+	     b != NULL; b = b->b_hashnext) {
+		if (b->b_block == block) {
+			KASSERT(b->b_attached);
+			return b;
+		}
+	}
+	return NULL;
+}
+
+static
+void
+sfs_buf_attach(struct sfs_bufcache *bc, struct sfs_buf *b, daddr_t block)
+{
+	unsigned slot;
+
+	KASSERT(!b->b_attached);
+	slot = sfs_buf_hashslot(block);
+	b->b_block = block;
+	b->b_attached = true;
+	b->b_valid = false;
+	b->b_dirty = false;
+	b->b_prefetched = false;
+	b->b_hashnext = bc->bc_hash[slot];
+	bc->bc_hash[slot] = b;
+}
+
+static
+void
+sfs_buf_detach(struct sfs_bufcache *bc, struct sfs_buf *b)
+{
+	struct sfs_buf **pp;
+
+	KASSERT(b->b_attached);
+	KASSERT(!b->b_dirty);
+	if (b->b_prefetched) {
+		/* Read ahead for nothing */
+		SFS_BUFSTAT(rawaste);
+		b->b_prefetched = false;
+	}
+	for (pp = &bc->bc_hash[sfs_buf_hashslot(b->b_block)];
+	     *pp != NULL; pp = &(*pp)->b_hashnext) {
+		if (*pp == b) {
+			*pp = b->b_hashnext;
+			b->b_hashnext = NULL;
+			b->b_attached = false;
+			b->b_valid = false;
+			return;
+		}
+	}
+	panic("sfs: buffer for block %u not on its hash chain\n", b->b_block);
+}
+
+////////////////////////////////////////////////////////////
+// Ownership
+
+/*
+ * Take ownership of a buffer, waiting for whoever has it now. The
+ * buffer may have been recycled for another block by the time we
+ * get it; returns false (without taking it) if it is no longer
+ * attached to BLOCK.
+ */
+static
+bool
+sfs_buf_take(struct sfs_bufcache *bc, struct sfs_buf *b, daddr_t block)
+{
+	KASSERT(lock_do_i_hold(bc->bc_lock));
+
+	if (b->b_refcount == 0) {
+		sfs_buf_lruremove(bc, b);
+	}
+	b->b_refcount++;
+	if (b->b_busy) {
+		SFS_BUFSTAT(waits);
+		while (b->b_busy) {
+			cv_wait(bc->bc_cv, bc->bc_lock);
+		}
+	}
+	if (!b->b_attached || b->b_block != block) {
+		b->b_refcount--;
+		if (b->b_refcount == 0) {
+			sfs_buf_lruappend(bc, b);
+		}
+		return false;
+	}
+	b->b_busy = true;
+	return true;
+}
+
+/*
+ * Give up ownership of a buffer. Buffers that don't hold anything
+ * useful are detached and put where they'll be reused first.
+ */
+static
+void
+sfs_buf_drop(struct sfs_bufcache *bc, struct sfs_buf *b)
+{
+	KASSERT(lock_do_i_hold(bc->bc_lock));
+	KASSERT(b->b_busy);
+	KASSERT(b->b_refcount > 0);
+
+	b->b_busy = false;
+	if (b->b_attached && !b->b_valid) {
+		sfs_buf_detach(bc, b);
+	}
+	b->b_refcount--;
+	if (b->b_refcount == 0) {
+		if (b->b_attached) {
+			sfs_buf_lruappend(bc, b);
+		}
+		else {
+			sfs_buf_lruprepend(bc, b);
+		}
+	}
+	cv_broadcast(bc->bc_cv, bc->bc_lock);
+}
+
+////////////////////////////////////////////////////////////
+// I/O
+
+/*
+ * Write a dirty buffer to disk. The caller owns the buffer and must
+ * not hold bc_lock.
+ */
+static
+int
+sfs_buf_writeout(struct sfs_fs *sfs, struct sfs_buf *b)
+{
+	int result;
+
+	KASSERT(b->b_busy);
+	KASSERT(b->b_attached && b->b_valid && b->b_dirty);
+
+	result = sfs_rawio(sfs, b->b_block, b->b_data, UIO_WRITE);
+	if (result) {
+		return result;
+	}
+	SFS_BUFSTAT(writes);
+	b->b_dirty = false;
+	return 0;
+}
+
+/*
+ * Common code for sfs_buf_get, sfs_buf_read, and sfs_buf_prefetch.
+ * Hands back an owned buffer attached to BLOCK, which may or may not
+ * have valid contents. PREFETCH is true for the readahead thread,
+ * whose lookups don't count as hits.
+ *
+ * If the block isn't cached, take the least recently used buffer
+ * nobody is using, writing it out first if necessary. The cache lock
+ * is dropped for the write, so someone else may bring BLOCK in
+ * meanwhile; in that case give the victim back and start over.
+ */
+static
+int
+sfs_buf_find(struct sfs_fs *sfs, daddr_t block, bool prefetch,
+	     struct sfs_buf **ret)
+{
+	struct sfs_bufcache *bc = sfs->sfs_cache;
+	struct sfs_buf *b;
+	int result;
+
+	lock_acquire(bc->bc_lock);
+	while (1) {
+		b = sfs_buf_lookup(bc, block);
+		if (b != NULL) {
+			if (!sfs_buf_take(bc, b, block)) {
+				continue;
+			}
+			if (b->b_valid && !prefetch) {
+				SFS_BUFSTAT(hits);
+				if (b->b_prefetched) {
+					SFS_BUFSTAT(rahits);
+					b->b_prefetched = false;
+				}
+			}
+			break;
+		}
+
+		b = bc->bc_lruhead;
+		if (b == NULL) {
+			SFS_BUFSTAT(waits);
+			cv_wait(bc->bc_cv, bc->bc_lock);
+			continue;
+		}
+		KASSERT(b->b_refcount == 0 && !b->b_busy);
+		sfs_buf_lruremove(bc, b);
+		b->b_refcount = 1;
+		b->b_busy = true;
+
+		if (b->b_attached && b->b_dirty) {
+			lock_release(bc->bc_lock);
+			result = sfs_buf_writeout(sfs, b);
+			lock_acquire(bc->bc_lock);
+			if (result) {
+				sfs_buf_drop(bc, b);
+				lock_release(bc->bc_lock);
+				return result;
+			}
+			if (sfs_buf_lookup(bc, block) != NULL) {
+				/* Lost the race; the victim stays cached */
+				sfs_buf_drop(bc, b);
+				continue;
+			}
+		}
+		if (b->b_attached) {
+			sfs_buf_detach(bc, b);
+			SFS_BUFSTAT(evictions);
+		}
+		sfs_buf_attach(bc, b, block);
+		break;
+	}
+	lock_release(bc->bc_lock);
+
+	*ret = b;
+	return 0;
+}
+
+/*
+ * Get the buffer for BLOCK without reading it from disk. The caller
+ * is expected to overwrite the entire block and then call
+ * sfs_buf_markdirty.
+ */
+int
+sfs_buf_get(struct sfs_fs *sfs, daddr_t block, struct sfs_buf **ret)
+{
+	return sfs_buf_find(sfs, block, false, ret);
+}
+
+/*
+ * Get the buffer for BLOCK, reading it from disk if it isn't cached.
+ */
+int
+sfs_buf_read(struct sfs_fs *sfs, daddr_t block, struct sfs_buf **ret)
+{
+	struct sfs_buf *b;
+	int result;
+
+	result = sfs_buf_find(sfs, block, false, &b);
+	if (result) {
+		return result;
+	}
+
+	if (!b->b_valid) {
+		SFS_BUFSTAT(misses);
+		result = sfs_rawio(sfs, block, b->b_data, UIO_READ);
+		if (result) {
+			sfs_buf_release(sfs, b);
+			return result;
+		}
+		SFS_BUFSTAT(reads);
+		b->b_valid = true;
+	}
+
+	*ret = b;
+	return 0;
+}
+
+/*
+ * Read BLOCK into the cache, if it isn't there already, in the
+ * expectation that somebody will want it soon.
+ */
+int
+sfs_buf_prefetch(struct sfs_fs *sfs, daddr_t block)
+{
+	struct sfs_buf *b;
+	int result;
+
+	result = sfs_buf_find(sfs, block, true, &b);
+	if (result) {
+		return result;
+	}
+
+	if (!b->b_valid) {
+		result = sfs_rawio(sfs, block, b->b_data, UIO_READ);
+		if (result == 0) {
+			SFS_BUFSTAT(reads);
+			SFS_BUFSTAT(prefetches);
+			b->b_valid = true;
+			b->b_prefetched = true;
+		}
+	}
+
+	sfs_buf_release(sfs, b);
+	return result;
+}
+
+/*
+ * A write into a buffer from sfs_buf_get, which was supposed to fill
+ * the whole block, stopped after LEN bytes. If the buffer was already
+ * holding the block, the rest of it is still good; otherwise read the
+ * rest in from disk, so it isn't left holding whatever block the
+ * buffer had before. If this fails, the caller must release the
+ * buffer without marking it dirty, which throws it away.
+ */
+int
+sfs_buf_fill(struct sfs_fs *sfs, struct sfs_buf *b, size_t len)
+{
+	char *tmp;
+	int result;
+
+	KASSERT(b->b_busy);
+	KASSERT(len <= SFS_BLOCKSIZE);
+
+	if (b->b_valid) {
+		return 0;
+	}
+
+	tmp = kmalloc(SFS_BLOCKSIZE);
+	if (tmp == NULL) {
+		return ENOMEM;
+	}
+	SFS_BUFSTAT(misses);
+	result = sfs_rawio(sfs, b->b_block, tmp, UIO_READ);
+	if (result == 0) {
+		SFS_BUFSTAT(reads);
+		memcpy((char *)b->b_data + len, tmp + len, SFS_BLOCKSIZE - len);
+	}
+	kfree(tmp);
+	return result;
+}
+
+/*
+ * Get a pointer to a buffer's data.
+ */
+void *
+sfs_buf_map(struct sfs_buf *b)
+{
+	KASSERT(b->b_busy);
+	return b->b_data;
+}
+
+/*
+ * Note that a buffer's contents have been changed.
+ */
+void
+sfs_buf_markdirty(struct sfs_buf *b)
+{
+	KASSERT(b->b_busy);
+	b->b_valid = true;
+	b->b_dirty = true;
+}
+
+/*
+ * Release a buffer. If it was modified, it stays in the cache until
+ * it is flushed or evicted.
+ *
+ * A buffer fetched with sfs_buf_get and released without having been
+ * filled in is thrown away.
+ */
+int
+sfs_buf_release(struct sfs_fs *sfs, struct sfs_buf *b)
+{
+	struct sfs_bufcache *bc = sfs->sfs_cache;
+
+	lock_acquire(bc->bc_lock);
+	sfs_buf_drop(bc, b);
+	lock_release(bc->bc_lock);
+	return 0;
+}
+
+/*
+ * Write out all dirty buffers, in ascending block order so the disk
+ * head makes one pass. Returns the first error encountered, but
+ * keeps going.
+ *
+ * Blocks dirtied behind the scan (at lower block numbers) after it
+ * starts are left for next time.
+ */
+int
+sfs_buf_flush(struct sfs_fs *sfs)
+{
+	struct sfs_bufcache *bc = sfs->sfs_cache;
+	struct sfs_buf *b, *next;
+	daddr_t last;
+	bool started;
+	unsigned i;
+	int result, ret = 0;
+
+	started = false;
+	last = 0;
+	lock_acquire(bc->bc_lock);
+	while (1) {
+		/* Find the lowest-numbered dirty block past the last one */
+		next = NULL;
+		for (i=0; i<SFS_NBUFS; i++) {
+			b = &bc->bc_bufs[i];
+			if (!b->b_attached || !b->b_dirty) {
+				continue;
+			}
+			if (started && b->b_block <= last) {
+				continue;
+			}
+			if (next == NULL || b->b_block < next->b_block) {
+				next = b;
+			}
+		}
+		if (next == NULL) {
+			break;
+		}
+		started = true;
+		last = next->b_block;
+
+		if (!sfs_buf_take(bc, next, last)) {
+			continue;
+		}
+		if (next->b_dirty) {
+			lock_release(bc->bc_lock);
+			result = sfs_buf_writeout(sfs, next);
+			lock_acquire(bc->bc_lock);
+			if (result && ret == 0) {
+				ret = result;
+			}
+		}
+		sfs_buf_drop(bc, next);
+	}
+	lock_release(bc->bc_lock);
+	return ret;
+}
+
+/*
+ * Throw away any cached copy of BLOCK. Used when a block is freed,
+ * and around direct writes in sfs_io, which replace what's on disk.
+ * The block's owner has no further use for it, but a flush or an
+ * eviction may be writing it out; if so, wait for that to finish.
+ */
+void
+sfs_buf_invalidate(struct sfs_fs *sfs, daddr_t block)
+{
+	struct sfs_bufcache *bc = sfs->sfs_cache;
+	struct sfs_buf *b;
+
+	lock_acquire(bc->bc_lock);
+	while (1) {
+		b = sfs_buf_lookup(bc, block);
+		if (b == NULL) {
+			break;
+		}
+		if (sfs_buf_take(bc, b, block)) {
+			b->b_dirty = false;
+			b->b_valid = false;
+			sfs_buf_drop(bc, b);
+			break;
+		}
+	}
+	lock_release(bc->bc_lock);
+}
+
+/*
+ * Write out any dirty cached copies of the NBLOCKS blocks starting at
+ * BLOCK, leaving them cached. Used before reading the blocks from
+ * disk without going through the cache.
+ */
+int
+sfs_buf_writeback(struct sfs_fs *sfs, daddr_t block, uint32_t nblocks)
+{
+	struct sfs_bufcache *bc = sfs->sfs_cache;
+	struct sfs_buf *b;
+	uint32_t i;
+	int result = 0;
+
+	lock_acquire(bc->bc_lock);
+	i = 0;
+	while (i < nblocks && result == 0) {
+		b = sfs_buf_lookup(bc, block + i);
+		if (b == NULL || !b->b_dirty) {
+			i++;
+			continue;
+		}
+		if (!sfs_buf_take(bc, b, block + i)) {
+			/* Recycled while we waited; look again */
+			continue;
+		}
+		if (b->b_dirty) {
+			lock_release(bc->bc_lock);
+			result = sfs_buf_writeout(sfs, b);
+			lock_acquire(bc->bc_lock);
+		}
+		sfs_buf_drop(bc, b);
+		i++;
+	}
+	lock_release(bc->bc_lock);
+	return result;
+}
+
+////////////////////////////////////////////////////////////
+// Setup and teardown
+
+/*
+ * Create the buffer cache for a volume.
+ */
+struct sfs_bufcache *
+sfs_bufcache_create(void)
+{
+	struct sfs_bufcache *bc;
+	unsigned i;
+
+	bc = kmalloc(sizeof(*bc));
+	if (bc == NULL) {
+		return NULL;
+	}
+	bc->bc_space = kmalloc(SFS_NBUFS * SFS_BLOCKSIZE);
+	if (bc->bc_space == NULL) {
+		kfree(bc);
+		return NULL;
+	}
+	bc->bc_lock = lock_create("sfs bufcache");
+	if (bc->bc_lock == NULL) {
+		kfree(bc->bc_space);
+		kfree(bc);
+		return NULL;
+	}
+	bc->bc_cv = cv_create("sfs bufcache");
+	if (bc->bc_cv == NULL) {
+		lock_destroy(bc->bc_lock);
+		kfree(bc->bc_space);
+		kfree(bc);
+		return NULL;
+	}
+
+	for (i=0; i<SFS_BUFHASH; i++) {
+		bc->bc_hash[i] = NULL;
+	}
+	bc->bc_lruhead = bc->bc_lrutail = NULL;
+
+	for (i=0; i<SFS_NBUFS; i++) {
+		struct sfs_buf *b = &bc->bc_bufs[i];
+
+		b->b_hashnext = NULL;
+		b->b_lruprev = b->b_lrunext = NULL;
+		b->b_block = 0;
+		b->b_refcount = 0;
+		b->b_busy = false;
+		b->b_attached = false;
+		b->b_valid = false;
+		b->b_dirty = false;
+		b->b_prefetched = false;
+		b->b_data = bc->bc_space + i*SFS_BLOCKSIZE;
+		sfs_buf_lruappend(bc, b);
+	}
+
+	return bc;
+}
+
+/*
+ * Destroy the buffer cache for a volume. Nothing may be in use or
+ * dirty.
+ */
+void
+sfs_bufcache_destroy(struct sfs_bufcache *bc)
+{
+	unsigned i;
+
+	for (i=0; i<SFS_NBUFS; i++) {
+		KASSERT(bc->bc_bufs[i].b_refcount == 0);
+		KASSERT(!bc->bc_bufs[i].b_dirty);
+	}
+	cv_destroy(bc->bc_cv);
+	lock_destroy(bc->bc_lock);
+	kfree(bc->bc_space);
+	kfree(bc);
+}
+
+/*
+ * Print the statistics.
+ */
+void
+sfs_bufstats(void)
+{
+	unsigned hits, misses, evictions, reads, writes, waits;
+	unsigned prefetches, rahits, rawaste;
+
+	spinlock_acquire(&sfs_bufstats_lock);
+	hits = sfs_bufstats_data.hits;
+	misses = sfs_bufstats_data.misses;
+	evictions = sfs_bufstats_data.evictions;
+	reads = sfs_bufstats_data.reads;
+	writes = sfs_bufstats_data.writes;
+	waits = sfs_bufstats_data.waits;
+	prefetches = sfs_bufstats_data.prefetches;
+	rahits = sfs_bufstats_data.rahits;
+	rawaste = sfs_bufstats_data.rawaste;
+	spinlock_release(&sfs_bufstats_lock);
+
+	kprintf("sfs buffer cache: %u buffers per volume\n", SFS_NBUFS);
+	kprintf("    %u hits, %u misses, %u evictions\n",
+		hits, misses, evictions);
+	kprintf("    %u blocks read, %u blocks written\n", reads, writes);
+	kprintf("    %u waits for busy buffers\n", waits);
+	kprintf("    %u blocks read ahead: %u used, %u wasted\n",
+		prefetches, rahits, rawaste);
+}
@@ -35,26 +35,11 @@
 #include <types.h>
 #include <kern/errno.h>
 #include <lib.h>
+#include <synch.h>
 #include <vfs.h>
 #include <sfs.h>
 #include "sfsprivate.h"
 
-/*
- * Read the directory entry out of slot SLOT of a directory vnode.
- * The "slot" is the index of the directory entry, starting at 0.
- */
-static
-int
-sfs_readdir(struct sfs_vnode *sv, int slot, struct sfs_direntry *sd)
-{
-	off_t actualpos;
-
-	/* Compute the actual position in the directory to read. */
-	actualpos = slot * sizeof(struct sfs_direntry);
-
-	return sfs_metaio(sv, actualpos, sd, sizeof(*sd), UIO_READ);
-}
-
 /*
  * Write (overwrite) the directory entry in slot SLOT of a directory
  * vnode.
@@ -95,65 +80,513 @@ sfs_dir_nentries(struct sfs_vnode *sv)
 	return size / sizeof(struct sfs_direntry);
 }
 
+/*
+ * Check if the name in directory entry SD is NAME. Don't write to SD
+ * to null-terminate it; it's in the buffer cache.
+ */
+static
+bool
+sfs_dir_namematch(const struct sfs_direntry *sd, const char *name)
+{
+	unsigned i;
+
+	for (i=0; i<sizeof(sd->sfd_name)-1; i++) {
+		if (sd->sfd_name[i] != name[i]) {
+			return false;
+		}
+		if (name[i] == 0) {
+			return true;
+		}
+	}
+	/* Treat the last byte as a null, just in case */
+	return name[i] == 0;
+}
+
+/*
+ * Directories with more than this many entries (8 blocks) get
+ * turned into hash tables when they need to grow.
+ */
+#define SFS_DIRHASH_THRESHOLD	64
+
+/*
+ * How many buckets an insertion into a hashed directory looks at
+ * before deciding the table is too full and growing it.
+ */
+#define SFS_DIRHASH_MAXPROBE	4
+
+/* Directory entries per block, and usable ones per hash bucket */
+#define SFS_DIRPERBLOCK	((int)(SFS_BLOCKSIZE / sizeof(struct sfs_direntry)))
+#define SFS_DIRPERBUCKET	(SFS_DIRPERBLOCK - 1)
+
+/*
+ * Hash function for hashed directories. (See <kern/sfs.h>.)
+ */
+static
+uint32_t
+sfs_dirhash(const char *name)
+{
+	uint32_t h = SFS_DIRHASH_FNVBASIS;
+
+	while (*name) {
+		h ^= (unsigned char)*name++;
+		h *= SFS_DIRHASH_FNVPRIME;
+	}
+	return h;
+}
+
+static
+bool
+sfs_dir_ishashed(struct sfs_vnode *sv)
+{
+	return (sv->sv_i.sfi_flags & SFS_IFLAG_DIRHASH) != 0;
+}
+
+/*
+ * Scan block FILEBLOCK of a directory, which holds N entries, for
+ * NAME. If the entry is found, hand back its slot in *FOUNDSLOT and
+ * its inode number in *FOUNDINO; otherwise set *FOUNDSLOT to -1. Also
+ * hand back the last free slot in the block (or -1) in *FREESLOT and,
+ * for hashed directories, the bucket header's flags in *HDRFLAGS.
+ *
+ * Scans the entries in place in the buffer cache, rather than copying
+ * them out one by one.
+ */
+static
+int
+sfs_dir_scanblock(struct sfs_vnode *sv, uint32_t fileblock, int n,
+		  const char *name, int *foundslot, uint32_t *foundino,
+		  int *freeslot, uint32_t *hdrflags)
+{
+	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	int base = fileblock * SFS_DIRPERBLOCK;
+	struct sfs_direntry *sds;
+	struct sfs_dirhashhdr *hdr;
+	struct sfs_buf *buf;
+	daddr_t diskblock;
+	int i, first, result;
+
+	*foundslot = -1;
+	*freeslot = -1;
+	*hdrflags = 0;
+
+	result = sfs_bmap(sv, fileblock, false, &diskblock);
+	if (result) {
+		return result;
+	}
+	if (diskblock == 0) {
+		if (sfs_dir_ishashed(sv)) {
+			panic("sfs: %s: hashed directory %u: block %u "
+			      "missing\n", sfs->sfs_sb.sb_volname,
+			      sv->sv_ino, fileblock);
+		}
+		/* Sparse block - all slots free */
+		*freeslot = base + n - 1;
+		return 0;
+	}
+
+	result = sfs_buf_read(sfs, diskblock, &buf);
+	if (result) {
+		return result;
+	}
+	sds = sfs_buf_map(buf);
+
+	first = 0;
+	if (sfs_dir_ishashed(sv)) {
+		hdr = (struct sfs_dirhashhdr *)&sds[0];
+		if (hdr->sdh_ino != SFS_NOINO ||
+		    hdr->sdh_magic != SFS_DIRHASH_MAGIC) {
+			panic("sfs: %s: hashed directory %u: bad bucket "
+			      "header in block %u\n", sfs->sfs_sb.sb_volname,
+			      sv->sv_ino, fileblock);
+		}
+		*hdrflags = hdr->sdh_flags;
+		first = 1;
+	}
+
+	/* For each slot in the block... */
+	for (i=first; i<n; i++) {
+		if (sds[i].sfd_ino == SFS_NOINO) {
+			*freeslot = base + i;
+		}
+		else if (sfs_dir_namematch(&sds[i], name)) {
+
+			/* Each name may legally appear only once... */
+			KASSERT(*foundslot < 0);
+
+			*foundslot = base + i;
+			*foundino = sds[i].sfd_ino;
+		}
+	}
+
+	return sfs_buf_release(sfs, buf);
+}
+
 /*
  * Search a directory for a particular filename in a directory, and
  * return its inode number, its slot, and/or the slot number of an
  * empty directory slot if one is found.
+ *
+ * For ordinary directories we look at every block. For hashed ones
+ * we start at the name's home bucket and keep going only as long as
+ * the buckets say entries have overflowed past them; the empty slot
+ * handed back is then the first one on that path.
  */
 int
 sfs_dir_findname(struct sfs_vnode *sv, const char *name,
 		uint32_t *ino, int *slot, int *emptyslot)
 {
-	struct sfs_direntry tsd;
-	int found, nentries, i, result;
+	int foundslot, freeslot, firstfree, nentries, nblocks, base, n, i;
+	uint32_t foundino, hdrflags, block;
+	int found, result;
 
-	nentries = sfs_dir_nentries(sv);
+	KASSERT(lock_do_i_hold(sv->sv_lock));
 
-	/* For each slot... */
+	nentries = sfs_dir_nentries(sv);
 	found = 0;
-	for (i=0; i<nentries; i++) {
 
-		/* Read the entry from that slot */
-		result = sfs_readdir(sv, i, &tsd);
-		if (result) {
-			return result;
-		}
-		if (tsd.sfd_ino == SFS_NOINO) {
-			/* Free slot - report it back if one was requested */
-			if (emptyslot != NULL) {
-				*emptyslot = i;
+	if (sfs_dir_ishashed(sv)) {
+		nblocks = nentries / SFS_DIRPERBLOCK;
+		block = sfs_dirhash(name) % nblocks;
+		firstfree = -1;
+		for (i=0; i<nblocks; i++) {
+			result = sfs_dir_scanblock(sv, block, SFS_DIRPERBLOCK,
+						   name, &foundslot, &foundino,
+						   &freeslot, &hdrflags);
+			if (result) {
+				return result;
+			}
+			if (firstfree < 0) {
+				firstfree = freeslot;
+			}
+			if (foundslot >= 0) {
+				found = 1;
+				break;
+			}
+			if ((hdrflags & SFS_DIRHASH_OVERFLOW) == 0) {
+				break;
 			}
+			block = (block + 1) % nblocks;
 		}
-		else {
-			/* Ensure null termination, just in case */
-			tsd.sfd_name[sizeof(tsd.sfd_name)-1] = 0;
-			if (!strcmp(tsd.sfd_name, name)) {
-
+		if (emptyslot != NULL && firstfree >= 0) {
+			*emptyslot = firstfree;
+		}
+	}
+	else {
+		/* For each block... */
+		for (base=0; base<nentries; base += SFS_DIRPERBLOCK) {
+			n = nentries - base;
+			if (n > SFS_DIRPERBLOCK) {
+				n = SFS_DIRPERBLOCK;
+			}
+			result = sfs_dir_scanblock(sv, base / SFS_DIRPERBLOCK,
+						   n, name, &foundslot,
+						   &foundino, &freeslot,
+						   &hdrflags);
+			if (result) {
+				return result;
+			}
+			if (freeslot >= 0 && emptyslot != NULL) {
+				/* Free slot - report it back */
+				*emptyslot = freeslot;
+			}
+			if (foundslot >= 0) {
 				/* Each name may legally appear only once... */
 				KASSERT(found==0);
-
 				found = 1;
-				if (slot != NULL) {
-					*slot = i;
+				if (emptyslot == NULL) {
+					break;
 				}
-				if (ino != NULL) {
-					*ino = tsd.sfd_ino;
+			}
+		}
+	}
+
+	if (!found) {
+		return ENOENT;
+	}
+	if (slot != NULL) {
+		*slot = foundslot;
+	}
+	if (ino != NULL) {
+		*ino = foundino;
+	}
+	return 0;
+}
+
+/*
+ * Put NAME/INO into a hashed directory, looking at no more than
+ * MAXPROBE buckets. Marks the full buckets it passes as overflowed.
+ * Returns ENOSPC if it didn't find room. The caller has checked that
+ * the name isn't there already.
+ */
+static
+int
+sfs_dirhash_insert(struct sfs_vnode *sv, const char *name, uint32_t ino,
+		   int maxprobe, int *slot)
+{
+	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	struct sfs_direntry *sds;
+	struct sfs_dirhashhdr *hdr;
+	struct sfs_buf *buf;
+	daddr_t diskblock;
+	uint32_t block, nblocks;
+	int probe, i, result;
+
+	KASSERT(sfs_dir_ishashed(sv));
+
+	nblocks = sv->sv_i.sfi_size / SFS_BLOCKSIZE;
+	block = sfs_dirhash(name) % nblocks;
+
+	for (probe=0; probe<maxprobe && probe<(int)nblocks; probe++) {
+		result = sfs_bmap(sv, block, false, &diskblock);
+		if (result) {
+			return result;
+		}
+		KASSERT(diskblock != 0);
+		result = sfs_buf_read(sfs, diskblock, &buf);
+		if (result) {
+			return result;
+		}
+		sds = sfs_buf_map(buf);
+		hdr = (struct sfs_dirhashhdr *)&sds[0];
+
+		for (i=1; i<SFS_DIRPERBLOCK; i++) {
+			if (sds[i].sfd_ino == SFS_NOINO) {
+				bzero(&sds[i], sizeof(sds[i]));
+				sds[i].sfd_ino = ino;
+				strcpy(sds[i].sfd_name, name);
+				sfs_buf_markdirty(buf);
+				if (slot != NULL) {
+					*slot = block * SFS_DIRPERBLOCK + i;
 				}
+				return sfs_buf_release(sfs, buf);
+			}
+		}
+
+		/* Full; anything further along has to be looked for */
+		if ((hdr->sdh_flags & SFS_DIRHASH_OVERFLOW) == 0) {
+			hdr->sdh_flags |= SFS_DIRHASH_OVERFLOW;
+			sfs_buf_markdirty(buf);
+		}
+		result = sfs_buf_release(sfs, buf);
+		if (result) {
+			return result;
+		}
+		block = (block + 1) % nblocks;
+	}
+	return ENOSPC;
+}
+
+/*
+ * Make an empty hash table with NBUCKETS buckets in directory SV,
+ * which must be empty.
+ */
+static
+int
+sfs_dirhash_init(struct sfs_vnode *sv, uint32_t nbuckets)
+{
+	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	struct sfs_dirhashhdr *hdr;
+	struct sfs_buf *buf;
+	daddr_t diskblock;
+	uint32_t i;
+	int result;
+
+	KASSERT(sv->sv_i.sfi_size == 0);
+
+	for (i=0; i<nbuckets; i++) {
+		result = sfs_bmap(sv, i, true, &diskblock);
+		if (result) {
+			return result;
+		}
+		result = sfs_buf_get(sfs, diskblock, &buf);
+		if (result) {
+			return result;
+		}
+		hdr = sfs_buf_map(buf);
+		bzero(hdr, SFS_BLOCKSIZE);
+		hdr->sdh_ino = SFS_NOINO;
+		hdr->sdh_magic = SFS_DIRHASH_MAGIC;
+		hdr->sdh_flags = 0;
+		sfs_buf_markdirty(buf);
+		result = sfs_buf_release(sfs, buf);
+		if (result) {
+			return result;
+		}
+	}
+
+	sv->sv_i.sfi_size = nbuckets * SFS_BLOCKSIZE;
+	sv->sv_i.sfi_flags |= SFS_IFLAG_DIRHASH;
+	sv->sv_dirty = true;
+	return 0;
+}
+
+/*
+ * Exchange the contents (block maps, sizes, and formats) of two
+ * directories.
+ */
+static
+void
+sfs_dir_swapcontents(struct sfs_vnode *a, struct sfs_vnode *b)
+{
+	struct sfs_dinode tmp;
+	unsigned i;
+
+	tmp = a->sv_i;
+
+	a->sv_i.sfi_size = b->sv_i.sfi_size;
+	for (i=0; i<SFS_NDIRECT; i++) {
+		a->sv_i.sfi_direct[i] = b->sv_i.sfi_direct[i];
+	}
+	a->sv_i.sfi_indirect = b->sv_i.sfi_indirect;
+	a->sv_i.sfi_dindirect = b->sv_i.sfi_dindirect;
+	a->sv_i.sfi_tindirect = b->sv_i.sfi_tindirect;
+	a->sv_i.sfi_flags = b->sv_i.sfi_flags;
+	memcpy(a->sv_i.sfi_extents, b->sv_i.sfi_extents,
+	       sizeof(a->sv_i.sfi_extents));
+
+	b->sv_i.sfi_size = tmp.sfi_size;
+	for (i=0; i<SFS_NDIRECT; i++) {
+		b->sv_i.sfi_direct[i] = tmp.sfi_direct[i];
+	}
+	b->sv_i.sfi_indirect = tmp.sfi_indirect;
+	b->sv_i.sfi_dindirect = tmp.sfi_dindirect;
+	b->sv_i.sfi_tindirect = tmp.sfi_tindirect;
+	b->sv_i.sfi_flags = tmp.sfi_flags;
+	memcpy(b->sv_i.sfi_extents, tmp.sfi_extents,
+	       sizeof(b->sv_i.sfi_extents));
+
+	a->sv_dirty = true;
+	b->sv_dirty = true;
+}
+
+/*
+ * Rebuild directory SV as a hash table with NBUCKETS buckets.
+ *
+ * The new table is built in a scratch directory inode with no links;
+ * then the two inodes' contents are swapped and the scratch inode is
+ * dropped, which frees the old blocks. If anything goes wrong along
+ * the way SV is left as it was.
+ */
+static
+int
+sfs_dir_rehash(struct sfs_vnode *sv, uint32_t nbuckets)
+{
+	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	struct sfs_vnode *newsv;
+	struct sfs_direntry *sds;
+	int nentries, base, n, i, result;
+	bool hashed;
+
+	KASSERT(lock_do_i_hold(sv->sv_lock));
+
+	sds = kmalloc(SFS_BLOCKSIZE);
+	if (sds == NULL) {
+		return ENOMEM;
+	}
+
+	result = sfs_makeobj(sfs, SFS_TYPE_DIR, sv, &newsv);
+	if (result) {
+		kfree(sds);
+		return result;
+	}
+	lock_acquire(newsv->sv_lock);
+
+	result = sfs_dirhash_init(newsv, nbuckets);
+	if (result) {
+		goto out;
+	}
+
+	/* Copy the entries over a block at a time */
+	hashed = sfs_dir_ishashed(sv);
+	nentries = sfs_dir_nentries(sv);
+	for (base=0; base<nentries; base += SFS_DIRPERBLOCK) {
+		n = nentries - base;
+		if (n > SFS_DIRPERBLOCK) {
+			n = SFS_DIRPERBLOCK;
+		}
+		result = sfs_metaio(sv, base * sizeof(sds[0]), sds,
+				    n * sizeof(sds[0]), UIO_READ);
+		if (result) {
+			goto out;
+		}
+		/* (skip the bucket header if there is one) */
+		for (i = hashed ? 1 : 0; i<n; i++) {
+			if (sds[i].sfd_ino == SFS_NOINO) {
+				continue;
+			}
+			sds[i].sfd_name[sizeof(sds[i].sfd_name)-1] = 0;
+			result = sfs_dirhash_insert(newsv, sds[i].sfd_name,
+						    sds[i].sfd_ino, nbuckets,
+						    NULL);
+			if (result) {
+				goto out;
 			}
 		}
 	}
 
-	return found ? 0 : ENOENT;
+	sfs_dir_swapcontents(sv, newsv);
+
+ out:
+	/* Dropping the scratch inode frees whichever blocks it has now */
+	lock_release(newsv->sv_lock);
+	VOP_DECREF(&newsv->sv_absvn);
+	kfree(sds);
+	return result;
+}
+
+/*
+ * Number of buckets to use when turning an ordinary directory with
+ * NENTRIES slots into a hashed one: about half full.
+ */
+static
+uint32_t
+sfs_dirhash_nbuckets(int nentries)
+{
+	return (2 * nentries) / SFS_DIRPERBUCKET + 1;
+}
+
+/*
+ * Create a link in a hashed directory. If the name's neighborhood of
+ * the table is full, double the size of the table and try again. If
+ * the table can't grow any more, settle for probing the whole thing.
+ */
+static
+int
+sfs_dirhash_link(struct sfs_vnode *sv, const char *name, uint32_t ino,
+		 int *slot)
+{
+	uint32_t nbuckets;
+	int result;
+
+	while (1) {
+		result = sfs_dirhash_insert(sv, name, ino,
+					    SFS_DIRHASH_MAXPROBE, slot);
+		if (result != ENOSPC) {
+			return result;
+		}
+		nbuckets = sv->sv_i.sfi_size / SFS_BLOCKSIZE;
+		result = sfs_dir_rehash(sv, nbuckets * 2);
+		if (result) {
+			break;
+		}
+	}
+
+	nbuckets = sv->sv_i.sfi_size / SFS_BLOCKSIZE;
+	return sfs_dirhash_insert(sv, name, ino, nbuckets, slot);
 }
 
 /*
  * Create a link in a directory to the specified inode by number, with
  * the specified name, and optionally hand back the slot.
+ *
+ * Note that this may reorganize the directory, changing the slots of
+ * other entries.
  */
 int
 sfs_dir_link(struct sfs_vnode *sv, const char *name, uint32_t ino, int *slot)
 {
 	int emptyslot = -1;
+	int nentries;
 	int result;
 	struct sfs_direntry sd;
 
@@ -170,9 +603,25 @@ sfs_dir_link(struct sfs_vnode *sv, const char *name, uint32_t ino, int *slot)
 		return ENAMETOOLONG;
 	}
 
-	/* If we didn't get an empty slot, add the entry at the end. */
+	if (sfs_dir_ishashed(sv)) {
+		return sfs_dirhash_link(sv, name, ino, slot);
+	}
+
+	/*
+	 * If we didn't get an empty slot, add the entry at the end;
+	 * or, if the directory has gotten big, turn it into a hash
+	 * table first. (If that fails, just carry on as before.)
+	 */
 	if (emptyslot < 0) {
-		emptyslot = sfs_dir_nentries(sv);
+		nentries = sfs_dir_nentries(sv);
+		if (nentries >= SFS_DIRHASH_THRESHOLD) {
+			result = sfs_dir_rehash(sv,
+						sfs_dirhash_nbuckets(nentries));
+			if (result == 0) {
+				return sfs_dirhash_link(sv, name, ino, slot);
+			}
+		}
+		emptyslot = nentries;
 	}
 
 	/* Set up the entry. */
@@ -197,6 +646,9 @@ sfs_dir_unlink(struct sfs_vnode *sv, int slot)
 {
 	struct sfs_direntry sd;
 
+	/* Never clobber a bucket header */
+	KASSERT(!sfs_dir_ishashed(sv) || slot % SFS_DIRPERBLOCK != 0);
+
 	/* Initialize a suitable directory entry... */
 	bzero(&sd, sizeof(sd));
 	sd.sfd_ino = SFS_NOINO;
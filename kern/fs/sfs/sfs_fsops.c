@@ -39,6 +39,9 @@
 #include <array.h>
 #include <bitmap.h>
 #include <uio.h>
+#include <clock.h>
+#include <synch.h>
+#include <thread.h>
 #include <vfs.h>
 #include <device.h>
 #include <sfs.h>
@@ -50,6 +53,26 @@
 #define SFS_FS_FREEMAPBITS(sfs)    SFS_FREEMAPBITS(SFS_FS_NBLOCKS(sfs))
 #define SFS_FS_FREEMAPBLOCKS(sfs)  SFS_FREEMAPBLOCKS(SFS_FS_NBLOCKS(sfs))
 
+/*
+ * Seconds between background syncs of each volume. 0 turns the
+ * syncer off, leaving only explicit syncs and buffer evictions to
+ * write dirty blocks.
+ */
+unsigned sfs_syncinterval = 5;
+
+/*
+ * Control block for a volume's syncer thread. This is allocated
+ * separately from the struct sfs_fs so the thread can discover that
+ * the volume has been unmounted: sfs_unmount clears ss_fs, and the
+ * thread frees the control block when it sees that. Both sides only
+ * look at ss_fs while holding ss_lock, which the thread also holds
+ * while it syncs, so unmount can't pull the volume out from under it.
+ */
+struct sfs_syncer {
+	struct lock *ss_lock;
+	struct sfs_fs *ss_fs;
+};
+
 /*
  * Routine for doing I/O (reads or writes) on the free block bitmap.
  * We always do the whole bitmap at once; writing individual sectors
@@ -106,19 +129,65 @@ sfs_freemapio(struct sfs_fs *sfs, enum uio_rw rw)
 }
 
 /*
- * Sync routine for the vnode table.
+ * Sync routine for the vnode table. This only moves the inodes into
+ * the buffer cache; sfs_sync flushes the cache afterwards. (So we
+ * don't use VOP_FSYNC, which would flush the cache once per vnode.)
+ *
+ * We can't hold the vnode table lock while taking vnode locks (that
+ * would be backwards for directories), so take a reference to each
+ * loaded vnode, then let go of the table and sync them one at a time.
+ * The exception is vnodes sitting unreferenced in the table's LRU
+ * list: nobody else can have those locked, so sync them on the spot
+ * rather than disturbing the LRU order.
  */
 static
 int
 sfs_sync_vnodes(struct sfs_fs *sfs)
 {
-	unsigned i, num;
+	struct vnode **vns;
+	struct sfs_vnode *sv;
+	unsigned i, slot, num;
+
+	lock_acquire(sfs->sfs_vnlock);
+	num = sfs->sfs_nvnodes - sfs->sfs_nvncached;
+	vns = NULL;
+	if (num > 0) {
+		vns = kmalloc(num * sizeof(vns[0]));
+		if (vns == NULL) {
+			lock_release(sfs->sfs_vnlock);
+			return ENOMEM;
+		}
+	}
+	i = 0;
+	for (slot=0; slot<SFS_VNHASH; slot++) {
+		for (sv = sfs->sfs_vnhash[slot]; sv != NULL;
+		     sv = sv->sv_hashnext) {
+			if (sv->sv_cached) {
+				lock_acquire(sv->sv_lock);
+				sfs_sync_inode(sv);
+				lock_release(sv->sv_lock);
+				continue;
+			}
+			KASSERT(i < num);
+			vns[i] = &sv->sv_absvn;
+			VOP_INCREF(vns[i]);
+			i++;
+		}
+	}
+	KASSERT(i == num);
+	lock_release(sfs->sfs_vnlock);
 
-	/* Go over the array of loaded vnodes, syncing as we go. */
-	num = vnodearray_num(sfs->sfs_vnodes);
+	/* Go over the loaded vnodes, syncing as we go. */
 	for (i=0; i<num; i++) {
-		struct vnode *v = vnodearray_get(sfs->sfs_vnodes, i);
-		VOP_FSYNC(v);
+		sv = vns[i]->vn_data;
+
+		lock_acquire(sv->sv_lock);
+		sfs_sync_inode(sv);
+		lock_release(sv->sv_lock);
+		VOP_DECREF(vns[i]);
+	}
+	if (vns != NULL) {
+		kfree(vns);
 	}
 	return 0;
 }
@@ -132,13 +201,16 @@ sfs_sync_freemap(struct sfs_fs *sfs)
 {
 	int result;
 
+	lock_acquire(sfs->sfs_freemaplock);
 	if (sfs->sfs_freemapdirty) {
 		result = sfs_freemapio(sfs, UIO_WRITE);
 		if (result) {
+			lock_release(sfs->sfs_freemaplock);
 			return result;
 		}
 		sfs->sfs_freemapdirty = false;
 	}
+	lock_release(sfs->sfs_freemaplock);
 
 	return 0;
 }
@@ -152,14 +224,17 @@ sfs_sync_superblock(struct sfs_fs *sfs)
 {
 	int result;
 
+	lock_acquire(sfs->sfs_freemaplock);
 	if (sfs->sfs_superdirty) {
 		result = sfs_writeblock(sfs, SFS_SUPER_BLOCK, &sfs->sfs_sb,
 					sizeof(sfs->sfs_sb));
 		if (result) {
+			lock_release(sfs->sfs_freemaplock);
 			return result;
 		}
 		sfs->sfs_superdirty = false;
 	}
+	lock_release(sfs->sfs_freemaplock);
 	return 0;
 }
 
@@ -174,8 +249,6 @@ sfs_sync(struct fs *fs)
 	struct sfs_fs *sfs;
 	int result;
 
-	vfs_biglock_acquire();
-
 	/*
 	 * Get the sfs_fs from the generic abstract fs.
 	 *
@@ -211,45 +284,91 @@ sfs_sync(struct fs *fs)
 	/* If any vnodes need to be written, write them. */
 	result = sfs_sync_vnodes(sfs);
 	if (result) {
-		vfs_biglock_release();
 		return result;
 	}
 
 	/* If the free block map needs to be written, write it. */
 	result = sfs_sync_freemap(sfs);
 	if (result) {
-		vfs_biglock_release();
 		return result;
 	}
 
 	/* If the superblock needs to be written, write it. */
 	result = sfs_sync_superblock(sfs);
 	if (result) {
-		vfs_biglock_release();
 		return result;
 	}
 
-	vfs_biglock_release();
+	/* Now push everything in the buffer cache out to disk. */
+	result = sfs_buf_flush(sfs);
+	if (result) {
+		return result;
+	}
+
 	return 0;
 }
 
+/*
+ * Syncer thread. Wakes up once a second and syncs the volume every
+ * sfs_syncinterval seconds, so that delayed writes reach the disk
+ * in batches without anyone having to wait for them. It checks for
+ * the volume having been unmounted on every wakeup, whether or not
+ * it's time to sync (or syncing is turned off), so it never outlives
+ * the unmount by more than a second.
+ */
+static
+void
+sfs_syncer(void *data, unsigned long junk)
+{
+	struct sfs_syncer *ss = data;
+	unsigned elapsed = 0;
+	int result;
+
+	(void)junk;
+
+	while (1) {
+		clocksleep(1);
+		elapsed++;
+
+		lock_acquire(ss->ss_lock);
+		if (ss->ss_fs == NULL) {
+			/* Unmounted */
+			lock_release(ss->ss_lock);
+			break;
+		}
+		if (sfs_syncinterval == 0 || elapsed < sfs_syncinterval) {
+			lock_release(ss->ss_lock);
+			continue;
+		}
+		elapsed = 0;
+
+		result = sfs_sync(&ss->ss_fs->sfs_absfs);
+		if (result) {
+			kprintf("sfs: %s: syncer: %s\n",
+				ss->ss_fs->sfs_sb.sb_volname,
+				strerror(result));
+		}
+		lock_release(ss->ss_lock);
+	}
+
+	lock_destroy(ss->ss_lock);
+	kfree(ss);
+}
+
 /*
  * Routine to retrieve the volume name. Filesystems can be referred
  * to by their volume name followed by a colon as well as the name
  * of the device they're mounted on.
+ *
+ * The name is set at mount time and never changes, so no locking.
  */
 static
 const char *
 sfs_getvolname(struct fs *fs)
 {
 	struct sfs_fs *sfs = fs->fs_data;
-	const char *ret;
-
-	vfs_biglock_acquire();
-	ret = sfs->sfs_sb.sb_volname;
-	vfs_biglock_release();
 
-	return ret;
+	return sfs->sfs_sb.sb_volname;
 }
 
 /*
@@ -262,7 +381,10 @@ sfs_fs_destroy(struct sfs_fs *sfs)
 	if (sfs->sfs_freemap != NULL) {
 		bitmap_destroy(sfs->sfs_freemap);
 	}
-	vnodearray_destroy(sfs->sfs_vnodes);
+	KASSERT(sfs->sfs_nvnodes == 0);
+	sfs_bufcache_destroy(sfs->sfs_cache);
+	lock_destroy(sfs->sfs_freemaplock);
+	lock_destroy(sfs->sfs_vnlock);
 	KASSERT(sfs->sfs_device == NULL);
 	kfree(sfs);
 }
@@ -277,19 +399,37 @@ int
 sfs_unmount(struct fs *fs)
 {
 	struct sfs_fs *sfs = fs->fs_data;
+	struct sfs_syncer *ss = sfs->sfs_syncer;
+	int result;
 
-	vfs_biglock_acquire();
+	/*
+	 * Lock out the syncer first, so it isn't holding references
+	 * to our vnodes or writing blocks while we look.
+	 */
+	lock_acquire(ss->ss_lock);
 
-	/* Do we have any files open? If so, can't unmount. */
-	if (vnodearray_num(sfs->sfs_vnodes) > 0) {
-		vfs_biglock_release();
-		return EBUSY;
+	/*
+	 * Do we have any files open? If so, can't unmount. Otherwise
+	 * throw out the vnodes we were keeping around just in case.
+	 */
+	result = sfs_vnode_purge(sfs);
+	if (result) {
+		lock_release(ss->ss_lock);
+		return result;
 	}
 
 	/* We should have just had sfs_sync called. */
 	KASSERT(sfs->sfs_superdirty == false);
 	KASSERT(sfs->sfs_freemapdirty == false);
 
+	/* Tell the syncer to go away; it frees its own control block. */
+	ss->ss_fs = NULL;
+	sfs->sfs_syncer = NULL;
+	lock_release(ss->ss_lock);
+
+	/* Likewise the readahead thread. */
+	sfs_rahead_stop(sfs);
+
 	/* The vfs layer takes care of the device for us */
 	sfs->sfs_device = NULL;
 
@@ -297,7 +437,6 @@ sfs_unmount(struct fs *fs)
 	sfs_fs_destroy(sfs);
 
 	/* nothing else to do */
-	vfs_biglock_release();
 	return 0;
 }
 
@@ -321,6 +460,7 @@ struct sfs_fs *
 sfs_fs_create(void)
 {
 	struct sfs_fs *sfs;
+	unsigned i;
 
 	/*
 	 * Make sure our on-disk structures aren't messed up
@@ -351,17 +491,42 @@ sfs_fs_create(void)
 	sfs->sfs_device = NULL;
 
 	/* vnode table */
-	sfs->sfs_vnodes = vnodearray_create();
-	if (sfs->sfs_vnodes == NULL) {
+	for (i=0; i<SFS_VNHASH; i++) {
+		sfs->sfs_vnhash[i] = NULL;
+	}
+	sfs->sfs_nvnodes = 0;
+	sfs->sfs_vnlruhead = sfs->sfs_vnlrutail = NULL;
+	sfs->sfs_nvncached = 0;
+	sfs->sfs_vnlock = lock_create("sfs vnodes");
+	if (sfs->sfs_vnlock == NULL) {
 		goto cleanup_object;
 	}
 
 	/* freemap */
 	sfs->sfs_freemap = NULL;
 	sfs->sfs_freemapdirty = false;
+	sfs->sfs_rsvlist = NULL;
+	sfs->sfs_freemaplock = lock_create("sfs freemap");
+	if (sfs->sfs_freemaplock == NULL) {
+		goto cleanup_vnlock;
+	}
+
+	/* syncer and readahead threads (started at the end of mount) */
+	sfs->sfs_syncer = NULL;
+	sfs->sfs_rahead = NULL;
+
+	/* buffer cache */
+	sfs->sfs_cache = sfs_bufcache_create();
+	if (sfs->sfs_cache == NULL) {
+		goto cleanup_freemaplock;
+	}
 
 	return sfs;
 
+cleanup_freemaplock:
+	lock_destroy(sfs->sfs_freemaplock);
+cleanup_vnlock:
+	lock_destroy(sfs->sfs_vnlock);
 cleanup_object:
 	kfree(sfs);
 fail:
@@ -388,8 +553,6 @@ sfs_domount(void *options, struct device *dev, struct fs **ret)
 	int result;
 	struct sfs_fs *sfs;
 
-	vfs_biglock_acquire();
-
 	/* We don't pass any options through mount */
 	(void)options;
 
@@ -402,7 +565,6 @@ sfs_domount(void *options, struct device *dev, struct fs **ret)
 	 * don't do that in sfs.)
 	 */
 	if (dev->d_blocksize != SFS_BLOCKSIZE) {
-		vfs_biglock_release();
 		kprintf("sfs: Cannot mount on device with blocksize %zu\n",
 			dev->d_blocksize);
 		return ENXIO;
@@ -410,7 +572,6 @@ sfs_domount(void *options, struct device *dev, struct fs **ret)
 
 	sfs = sfs_fs_create();
 	if (sfs == NULL) {
-		vfs_biglock_release();
 		return ENOMEM;
 	}
 
@@ -423,7 +584,6 @@ sfs_domount(void *options, struct device *dev, struct fs **ret)
 	if (result) {
 		sfs->sfs_device = NULL;
 		sfs_fs_destroy(sfs);
-		vfs_biglock_release();
 		return result;
 	}
 
@@ -436,7 +596,6 @@ sfs_domount(void *options, struct device *dev, struct fs **ret)
 			SFS_MAGIC);
 		sfs->sfs_device = NULL;
 		sfs_fs_destroy(sfs);
-		vfs_biglock_release();
 		return EINVAL;
 	}
 
@@ -453,21 +612,56 @@ sfs_domount(void *options, struct device *dev, struct fs **ret)
 	if (sfs->sfs_freemap == NULL) {
 		sfs->sfs_device = NULL;
 		sfs_fs_destroy(sfs);
-		vfs_biglock_release();
 		return ENOMEM;
 	}
 	result = sfs_freemapio(sfs, UIO_READ);
 	if (result) {
 		sfs->sfs_device = NULL;
 		sfs_fs_destroy(sfs);
-		vfs_biglock_release();
+		return result;
+	}
+
+	/* Start the readahead thread */
+	result = sfs_rahead_start(sfs);
+	if (result) {
+		sfs->sfs_device = NULL;
+		sfs_fs_destroy(sfs);
+		return result;
+	}
+
+	/* Start the syncer */
+	sfs->sfs_syncer = kmalloc(sizeof(struct sfs_syncer));
+	if (sfs->sfs_syncer == NULL) {
+		sfs_rahead_stop(sfs);
+		sfs->sfs_device = NULL;
+		sfs_fs_destroy(sfs);
+		return ENOMEM;
+	}
+	sfs->sfs_syncer->ss_lock = lock_create("sfs syncer");
+	if (sfs->sfs_syncer->ss_lock == NULL) {
+		kfree(sfs->sfs_syncer);
+		sfs->sfs_syncer = NULL;
+		sfs_rahead_stop(sfs);
+		sfs->sfs_device = NULL;
+		sfs_fs_destroy(sfs);
+		return ENOMEM;
+	}
+	sfs->sfs_syncer->ss_fs = sfs;
+	result = thread_fork("sfs syncer", NULL, sfs_syncer,
+			     sfs->sfs_syncer, 0);
+	if (result) {
+		lock_destroy(sfs->sfs_syncer->ss_lock);
+		kfree(sfs->sfs_syncer);
+		sfs->sfs_syncer = NULL;
+		sfs_rahead_stop(sfs);
+		sfs->sfs_device = NULL;
+		sfs_fs_destroy(sfs);
 		return result;
 	}
 
 	/* Hand back the abstract fs */
 	*ret = &sfs->sfs_absfs;
 
-	vfs_biglock_release();
 	return 0;
 }
 
@@ -35,13 +35,15 @@
 #include <types.h>
 #include <kern/errno.h>
 #include <lib.h>
+#include <synch.h>
 #include <vfs.h>
 #include <sfs.h>
 #include "sfsprivate.h"
 
 
 /*
- * Write an on-disk inode structure back out to disk.
+ * Write an on-disk inode structure back out to disk. The caller must
+ * hold the vnode's lock.
  */
 int
 sfs_sync_inode(struct sfs_vnode *sv)
@@ -49,6 +51,8 @@ sfs_sync_inode(struct sfs_vnode *sv)
 	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
 	int result;
 
+	KASSERT(lock_do_i_hold(sv->sv_lock));
+
 	if (sv->sv_dirty) {
 		result = sfs_writeblock(sfs, sv->sv_ino, &sv->sv_i,
 					sizeof(sv->sv_i));
@@ -60,44 +64,147 @@ sfs_sync_inode(struct sfs_vnode *sv)
 	return 0;
 }
 
+////////////////////////////////////////////////////////////
+// Vnode table
+
 /*
- * Called when the vnode refcount (in-memory usage count) hits zero.
- *
- * This function should try to avoid returning errors other than EBUSY.
+ * Loaded vnodes are kept in a hash table keyed on inode number. When
+ * the last reference to a vnode whose file still exists goes away,
+ * the vnode isn't destroyed right away: it goes on an LRU list (with
+ * a refcount of 0), so that reopening a recently used file doesn't
+ * have to read its inode again. When there are more than SFS_VNCACHE
+ * such vnodes, the least recently used one is thrown out. All of
+ * this is protected by sfs_vnlock.
  */
+
+/* Maximum number of unreferenced vnodes to keep */
+#define SFS_VNCACHE	32
+
+static
+unsigned
+sfs_vnhashslot(uint32_t ino)
+{
+	return (ino ^ (ino >> 7)) & (SFS_VNHASH - 1);
+}
+
+static
+struct sfs_vnode *
+sfs_vnlookup(struct sfs_fs *sfs, uint32_t ino)
+{
+	struct sfs_vnode *sv;
+
+	KASSERT(lock_do_i_hold(sfs->sfs_vnlock));
+
+	for (sv = sfs->sfs_vnhash[sfs_vnhashslot(ino)];
+	     sv != NULL; sv = sv->sv_hashnext) {
+		if (sv->sv_ino == ino) {
+			return sv;
+		}
+	}
+	return NULL;
+}
+
+static
+void
+sfs_vnhash_add(struct sfs_fs *sfs, struct sfs_vnode *sv)
+{
+	unsigned slot;
+
+	KASSERT(lock_do_i_hold(sfs->sfs_vnlock));
+
+	slot = sfs_vnhashslot(sv->sv_ino);
+	sv->sv_hashnext = sfs->sfs_vnhash[slot];
+	sfs->sfs_vnhash[slot] = sv;
+	sfs->sfs_nvnodes++;
+}
+
+static
+void
+sfs_vnhash_remove(struct sfs_fs *sfs, struct sfs_vnode *sv)
+{
+	struct sfs_vnode **pp;
+
+	KASSERT(lock_do_i_hold(sfs->sfs_vnlock));
+
+	for (pp = &sfs->sfs_vnhash[sfs_vnhashslot(sv->sv_ino)];
+	     *pp != NULL; pp = &(*pp)->sv_hashnext) {
+		if (*pp == sv) {
+			*pp = sv->sv_hashnext;
+			sv->sv_hashnext = NULL;
+			sfs->sfs_nvnodes--;
+			return;
+		}
+	}
+	panic("sfs: %s: reclaim vnode %u not in vnode pool\n",
+	      sfs->sfs_sb.sb_volname, sv->sv_ino);
+}
+
+static
+void
+sfs_vnlru_append(struct sfs_fs *sfs, struct sfs_vnode *sv)
+{
+	KASSERT(!sv->sv_cached);
+	sv->sv_lrunext = NULL;
+	sv->sv_lruprev = sfs->sfs_vnlrutail;
+	if (sfs->sfs_vnlrutail != NULL) {
+		sfs->sfs_vnlrutail->sv_lrunext = sv;
+	}
+	else {
+		sfs->sfs_vnlruhead = sv;
+	}
+	sfs->sfs_vnlrutail = sv;
+	sv->sv_cached = true;
+	sfs->sfs_nvncached++;
+}
+
+static
+void
+sfs_vnlru_remove(struct sfs_fs *sfs, struct sfs_vnode *sv)
+{
+	KASSERT(sv->sv_cached);
+	if (sv->sv_lruprev != NULL) {
+		sv->sv_lruprev->sv_lrunext = sv->sv_lrunext;
+	}
+	else {
+		sfs->sfs_vnlruhead = sv->sv_lrunext;
+	}
+	if (sv->sv_lrunext != NULL) {
+		sv->sv_lrunext->sv_lruprev = sv->sv_lruprev;
+	}
+	else {
+		sfs->sfs_vnlrutail = sv->sv_lruprev;
+	}
+	sv->sv_lruprev = sv->sv_lrunext = NULL;
+	sv->sv_cached = false;
+	sfs->sfs_nvncached--;
+}
+
+/*
+ * Get rid of a vnode nobody is using: erase the file if it has no
+ * links left, write back the inode, and free the vnode. The caller
+ * holds the vnode table lock and has taken the vnode off the LRU
+ * list if it was there.
+ */
+static
 int
-sfs_reclaim(struct vnode *v)
+sfs_vnode_drop(struct sfs_fs *sfs, struct sfs_vnode *sv)
 {
-	struct sfs_vnode *sv = v->vn_data;
-	struct sfs_fs *sfs = v->vn_fs->fs_data;
-	unsigned ix, i, num;
 	int result;
 
-	vfs_biglock_acquire();
+	KASSERT(lock_do_i_hold(sfs->sfs_vnlock));
+	KASSERT(!sv->sv_cached);
 
 	/*
-	 * Make sure someone else hasn't picked up the vnode since the
-	 * decision was made to reclaim it. (You must also synchronize
-	 * this with sfs_loadvnode.)
+	 * Nobody else has the vnode, so this can't block; but the
+	 * routines below insist on the vnode lock being held.
 	 */
-	spinlock_acquire(&v->vn_countlock);
-	if (v->vn_refcount != 1) {
-
-		/* consume the reference VOP_DECREF gave us */
-		KASSERT(v->vn_refcount>1);
-		v->vn_refcount--;
-
-		spinlock_release(&v->vn_countlock);
-		vfs_biglock_release();
-		return EBUSY;
-	}
-	spinlock_release(&v->vn_countlock);
+	lock_acquire(sv->sv_lock);
 
 	/* If there are no on-disk references to the file either, erase it. */
 	if (sv->sv_i.sfi_linkcount == 0) {
 		result = sfs_itrunc(sv, 0);
 		if (result) {
-			vfs_biglock_release();
+			lock_release(sv->sv_lock);
 			return result;
 		}
 	}
@@ -105,40 +212,126 @@ sfs_reclaim(struct vnode *v)
 	/* Sync the inode to disk */
 	result = sfs_sync_inode(sv);
 	if (result) {
-		vfs_biglock_release();
+		lock_release(sv->sv_lock);
 		return result;
 	}
 
+	/* Give up any blocks set aside for it */
+	sfs_rsv_release(sfs, &sv->sv_rsv);
+
 	/* If there are no on-disk references, discard the inode */
 	if (sv->sv_i.sfi_linkcount==0) {
 		sfs_bfree(sfs, sv->sv_ino);
 	}
 
+	lock_release(sv->sv_lock);
+
 	/* Remove the vnode structure from the table in the struct sfs_fs. */
-	num = vnodearray_num(sfs->sfs_vnodes);
-	ix = num;
-	for (i=0; i<num; i++) {
-		struct vnode *v2 = vnodearray_get(sfs->sfs_vnodes, i);
-		struct sfs_vnode *sv2 = v2->vn_data;
-		if (sv2 == sv) {
-			ix = i;
-			break;
-		}
-	}
-	if (ix == num) {
-		panic("sfs: %s: reclaim vnode %u not in vnode pool\n",
-		      sfs->sfs_sb.sb_volname, sv->sv_ino);
-	}
-	vnodearray_remove(sfs->sfs_vnodes, ix);
+	sfs_vnhash_remove(sfs, sv);
 
+	/* vnode_cleanup expects the last reference; cached vnodes have 0 */
+	sv->sv_absvn.vn_refcount = 1;
 	vnode_cleanup(&sv->sv_absvn);
-
-	vfs_biglock_release();
+	lock_destroy(sv->sv_lock);
 
 	/* Release the storage for the vnode structure itself. */
 	kfree(sv);
 
-	/* Done */
+	return 0;
+}
+
+/*
+ * Called when the vnode refcount (in-memory usage count) hits zero.
+ *
+ * This function should try to avoid returning errors other than EBUSY.
+ */
+int
+sfs_reclaim(struct vnode *v)
+{
+	struct sfs_vnode *sv = v->vn_data;
+	struct sfs_fs *sfs = v->vn_fs->fs_data;
+	int result;
+
+	lock_acquire(sfs->sfs_vnlock);
+
+	/*
+	 * Make sure someone else hasn't picked up the vnode since the
+	 * decision was made to reclaim it. New references can only
+	 * come from sfs_loadvnode, which we're locking out by holding
+	 * the vnode table lock.
+	 */
+	spinlock_acquire(&v->vn_countlock);
+	if (v->vn_refcount != 1) {
+
+		/* consume the reference VOP_DECREF gave us */
+		KASSERT(v->vn_refcount>1);
+		v->vn_refcount--;
+
+		spinlock_release(&v->vn_countlock);
+		lock_release(sfs->sfs_vnlock);
+		return EBUSY;
+	}
+
+	/*
+	 * If the file still exists, keep the vnode around unreferenced
+	 * in case it's wanted again, and make room by getting rid of
+	 * the least recently used one instead if there are too many.
+	 * (Nobody else has the vnode, so we can look at the link count
+	 * without its lock.)
+	 */
+	if (sv->sv_i.sfi_linkcount > 0) {
+		v->vn_refcount = 0;
+		spinlock_release(&v->vn_countlock);
+
+		sfs_vnlru_append(sfs, sv);
+		if (sfs->sfs_nvncached <= SFS_VNCACHE) {
+			lock_release(sfs->sfs_vnlock);
+			return 0;
+		}
+		sv = sfs->sfs_vnlruhead;
+		sfs_vnlru_remove(sfs, sv);
+		result = sfs_vnode_drop(sfs, sv);
+		if (result) {
+			/* Put it back; we'll try again later */
+			sfs_vnlru_append(sfs, sv);
+		}
+		lock_release(sfs->sfs_vnlock);
+		return result;
+	}
+	spinlock_release(&v->vn_countlock);
+
+	result = sfs_vnode_drop(sfs, sv);
+	lock_release(sfs->sfs_vnlock);
+	return result;
+}
+
+/*
+ * Throw out all the unreferenced vnodes, in preparation for
+ * unmounting. Fails with EBUSY if any vnodes are in use.
+ */
+int
+sfs_vnode_purge(struct sfs_fs *sfs)
+{
+	struct sfs_vnode *sv;
+	int result;
+
+	lock_acquire(sfs->sfs_vnlock);
+	if (sfs->sfs_nvnodes > sfs->sfs_nvncached) {
+		lock_release(sfs->sfs_vnlock);
+		return EBUSY;
+	}
+	while (sfs->sfs_vnlruhead != NULL) {
+		sv = sfs->sfs_vnlruhead;
+		sfs_vnlru_remove(sfs, sv);
+		result = sfs_vnode_drop(sfs, sv);
+		if (result) {
+			sfs_vnlru_append(sfs, sv);
+			lock_release(sfs->sfs_vnlock);
+			return result;
+		}
+	}
+	KASSERT(sfs->sfs_nvnodes == 0);
+	lock_release(sfs->sfs_vnlock);
 	return 0;
 }
 
@@ -150,42 +343,44 @@ int
 sfs_loadvnode(struct sfs_fs *sfs, uint32_t ino, int forcetype,
 		 struct sfs_vnode **ret)
 {
-	struct vnode *v;
 	struct sfs_vnode *sv;
 	const struct vnode_ops *ops;
-	unsigned i, num;
 	int result;
 
-	/* Look in the vnodes table */
-	num = vnodearray_num(sfs->sfs_vnodes);
-
-	/* Linear search. Is this too slow? You decide. */
-	for (i=0; i<num; i++) {
-		v = vnodearray_get(sfs->sfs_vnodes, i);
-		sv = v->vn_data;
+	/*
+	 * Hold the table lock until the new vnode (if any) is in the
+	 * table, so two threads can't both load the same inode.
+	 */
+	lock_acquire(sfs->sfs_vnlock);
 
+	/* Look in the vnodes table */
+	sv = sfs_vnlookup(sfs, ino);
+	if (sv != NULL) {
 		/* Every inode in memory must be in an allocated block */
 		if (!sfs_bused(sfs, sv->sv_ino)) {
 			panic("sfs: %s: Found inode %u in unallocated block\n",
 			      sfs->sfs_sb.sb_volname, sv->sv_ino);
 		}
 
-		if (sv->sv_ino==ino) {
-			/* Found */
-
-			/* forcetype is only allowed when creating objects */
-			KASSERT(forcetype==SFS_TYPE_INVAL);
+		/* forcetype is only allowed when creating objects */
+		KASSERT(forcetype==SFS_TYPE_INVAL);
 
-			VOP_INCREF(&sv->sv_absvn);
-			*ret = sv;
-			return 0;
+		/* Take it off the LRU list if nobody was using it */
+		if (sv->sv_cached) {
+			sfs_vnlru_remove(sfs, sv);
 		}
+
+		VOP_INCREF(&sv->sv_absvn);
+		lock_release(sfs->sfs_vnlock);
+		*ret = sv;
+		return 0;
 	}
 
 	/* Didn't have it loaded; load it */
 
 	sv = kmalloc(sizeof(struct sfs_vnode));
 	if (sv==NULL) {
+		lock_release(sfs->sfs_vnlock);
 		return ENOMEM;
 	}
 
@@ -199,6 +394,7 @@ sfs_loadvnode(struct sfs_fs *sfs, uint32_t ino, int forcetype,
 	result = sfs_readblock(sfs, ino, &sv->sv_i, sizeof(sv->sv_i));
 	if (result) {
 		kfree(sv);
+		lock_release(sfs->sfs_vnlock);
 		return result;
 	}
 
@@ -213,6 +409,9 @@ sfs_loadvnode(struct sfs_fs *sfs, uint32_t ino, int forcetype,
 	if (forcetype != SFS_TYPE_INVAL) {
 		KASSERT(sv->sv_i.sfi_type == SFS_TYPE_INVAL);
 		sv->sv_i.sfi_type = forcetype;
+		if (forcetype == SFS_TYPE_FILE && sfs_extents) {
+			sv->sv_i.sfi_flags |= SFS_IFLAG_EXTENTS;
+		}
 		sv->sv_dirty = true;
 	}
 
@@ -236,20 +435,33 @@ sfs_loadvnode(struct sfs_fs *sfs, uint32_t ino, int forcetype,
 	result = vnode_init(&sv->sv_absvn, ops, &sfs->sfs_absfs, sv);
 	if (result) {
 		kfree(sv);
+		lock_release(sfs->sfs_vnlock);
 		return result;
 	}
 
 	/* Set the other fields in our vnode structure */
 	sv->sv_ino = ino;
-
-	/* Add it to our table */
-	result = vnodearray_add(sfs->sfs_vnodes, &sv->sv_absvn, NULL);
-	if (result) {
+	sv->sv_hashnext = NULL;
+	sv->sv_lruprev = sv->sv_lrunext = NULL;
+	sv->sv_cached = false;
+	sv->sv_ranext = 0;
+	sv->sv_rawindow = 0;
+	sv->sv_raend = 0;
+	sv->sv_rsv.r_start = sv->sv_rsv.r_end = 0;
+	sv->sv_rsv.r_last = 0;
+	sv->sv_rsv.r_next = NULL;
+	sv->sv_lock = lock_create("sfs vnode");
+	if (sv->sv_lock == NULL) {
 		vnode_cleanup(&sv->sv_absvn);
 		kfree(sv);
-		return result;
+		lock_release(sfs->sfs_vnlock);
+		return ENOMEM;
 	}
 
+	/* Add it to our table */
+	sfs_vnhash_add(sfs, sv);
+	lock_release(sfs->sfs_vnlock);
+
 	/* Hand it back */
 	*ret = sv;
 	return 0;
@@ -259,17 +471,19 @@ sfs_loadvnode(struct sfs_fs *sfs, uint32_t ino, int forcetype,
  * Create a new filesystem object and hand back its vnode.
  */
 int
-sfs_makeobj(struct sfs_fs *sfs, int type, struct sfs_vnode **ret)
+sfs_makeobj(struct sfs_fs *sfs, int type, struct sfs_vnode *dir,
+	    struct sfs_vnode **ret)
 {
 	uint32_t ino;
 	int result;
 
 	/*
 	 * First, get an inode. (Each inode is a block, and the inode
-	 * number is the block number, so just get a block.)
+	 * number is the block number, so just get a block.) Try to
+	 * put it near the directory it's going in.
 	 */
 
-	result = sfs_balloc(sfs, &ino);
+	result = sfs_balloc(sfs, NULL, dir->sv_ino + 1, true, &ino);
 	if (result) {
 		return result;
 	}
@@ -296,25 +510,20 @@ sfs_getroot(struct fs *fs, struct vnode **ret)
 	struct sfs_vnode *sv;
 	int result;
 
-	vfs_biglock_acquire();
-
 	result = sfs_loadvnode(sfs, SFS_ROOTDIR_INO, SFS_TYPE_INVAL, &sv);
 	if (result) {
 		kprintf("sfs: %s: getroot: Cannot load root vnode\n",
 			sfs->sfs_sb.sb_volname);
-		vfs_biglock_release();
 		return result;
 	}
 
 	if (sv->sv_i.sfi_type != SFS_TYPE_DIR) {
 		kprintf("sfs: %s: getroot: not directory (type %u)\n",
 			sfs->sfs_sb.sb_volname, sv->sv_i.sfi_type);
-		vfs_biglock_release();
+		VOP_DECREF(&sv->sv_absvn);
 		return EINVAL;
 	}
 
-	vfs_biglock_release();
-
 	*ret = &sv->sv_absvn;
 	return 0;
 }
@@ -36,6 +36,7 @@
 #include <kern/errno.h>
 #include <lib.h>
 #include <uio.h>
+#include <synch.h>
 #include <vfs.h>
 #include <device.h>
 #include <sfs.h>
@@ -45,13 +46,6 @@
 //
 // Basic block-level I/O routines
 
-/*
- * Note: sfs_readblock is used to read the superblock
- * early in mount, before sfs is fully (or even mostly)
- * initialized, and so may not use anything from sfs
- * except sfs_device.
- */
-
 /*
  * Read or write a block, retrying I/O errors.
  */
@@ -62,8 +56,6 @@ sfs_rwblock(struct sfs_fs *sfs, struct uio *uio)
 	int result;
 	int tries=0;
 
-	KASSERT(vfs_biglock_do_i_hold());
-
 	DEBUG(DB_SFS, "sfs: %s %llu\n",
 	      uio->uio_rw == UIO_READ ? "read" : "write",
 	      uio->uio_offset / SFS_BLOCKSIZE);
@@ -102,44 +94,81 @@ sfs_rwblock(struct sfs_fs *sfs, struct uio *uio)
 }
 
 /*
- * Read a block.
+ * Transfer a block directly between memory and the disk. This is
+ * used only by the buffer cache; everything else should go through
+ * the cache (or, for long runs of file data, sfs_directio).
  */
 int
-sfs_readblock(struct sfs_fs *sfs, daddr_t block, void *data, size_t len)
+sfs_rawio(struct sfs_fs *sfs, daddr_t block, void *data, enum uio_rw rw)
 {
 	struct iovec iov;
 	struct uio ku;
 
+	SFSUIO(&iov, &ku, data, block, rw);
+	return sfs_rwblock(sfs, &ku);
+}
+
+/*
+ * Note: sfs_readblock is used to read the superblock
+ * early in mount, before sfs is fully (or even mostly)
+ * initialized, and so may not use anything from sfs
+ * except sfs_device and sfs_cache.
+ */
+
+/*
+ * Read a block (via the buffer cache).
+ */
+int
+sfs_readblock(struct sfs_fs *sfs, daddr_t block, void *data, size_t len)
+{
+	struct sfs_buf *buf;
+	int result;
+
 	KASSERT(len == SFS_BLOCKSIZE);
 
-	SFSUIO(&iov, &ku, data, block, UIO_READ);
-	return sfs_rwblock(sfs, &ku);
+	result = sfs_buf_read(sfs, block, &buf);
+	if (result) {
+		return result;
+	}
+	memcpy(data, sfs_buf_map(buf), len);
+	return sfs_buf_release(sfs, buf);
 }
 
 /*
- * Write a block.
+ * Write a block (via the buffer cache).
  */
 int
 sfs_writeblock(struct sfs_fs *sfs, daddr_t block, void *data, size_t len)
 {
-	struct iovec iov;
-	struct uio ku;
+	struct sfs_buf *buf;
+	int result;
 
 	KASSERT(len == SFS_BLOCKSIZE);
 
-	SFSUIO(&iov, &ku, data, block, UIO_WRITE);
-	return sfs_rwblock(sfs, &ku);
+	result = sfs_buf_get(sfs, block, &buf);
+	if (result) {
+		return result;
+	}
+	memcpy(sfs_buf_map(buf), data, len);
+	sfs_buf_markdirty(buf);
+	return sfs_buf_release(sfs, buf);
 }
 
 ////////////////////////////////////////////////////////////
 //
 // File-level I/O
 
+/*
+ * Shortest run of blocks that sfs_io transfers directly rather than
+ * through the buffer cache.
+ */
+#define SFS_DIRECTMIN	8
+
 /*
  * Do I/O to a block of a file that doesn't cover the whole block.  We
  * need to read in the original block first, even if we're writing, so
  * we don't clobber the portion of the block we're not intending to
- * write over.
+ * write over. The buffer cache usually already has it.
  *
  * SKIPSTART is the number of bytes to skip past at the beginning of
  * the sector; LEN is the number of bytes to actually read or write.
@@ -150,28 +179,17 @@ int
 sfs_partialio(struct sfs_vnode *sv, struct uio *uio,
 	      uint32_t skipstart, uint32_t len)
 {
-	/*
-	 * I/O buffer for handling partial sectors.
-	 *
-	 * Note: in real life (and when you've done the fs assignment)
-	 * you would get space from the disk buffer cache for this,
-	 * not use a static area.
-	 */
-	static char iobuf[SFS_BLOCKSIZE];
-
 	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	struct sfs_buf *buf;
 	daddr_t diskblock;
 	uint32_t fileblock;
-	int result;
+	int result, result2;
 
 	/* Allocate missing blocks if and only if we're writing */
 	bool doalloc = (uio->uio_rw==UIO_WRITE);
 
 	KASSERT(skipstart + len <= SFS_BLOCKSIZE);
 
-	/* We're using a global static buffer; it had better be locked */
-	KASSERT(vfs_biglock_do_i_hold());
-
 	/* Compute the block offset of this block in the file */
 	fileblock = uio->uio_offset / SFS_BLOCKSIZE;
 
@@ -184,119 +202,266 @@ sfs_partialio(struct sfs_vnode *sv, struct uio *uio,
 	if (diskblock == 0) {
 		/*
 		 * There was no block mapped at this point in the file.
-		 * Zero the buffer.
+		 * Read zeros.
 		 */
 		KASSERT(uio->uio_rw == UIO_READ);
-		bzero(iobuf, sizeof(iobuf));
-	}
-	else {
-		/*
-		 * Read the block.
-		 */
-		result = sfs_readblock(sfs, diskblock, iobuf, sizeof(iobuf));
-		if (result) {
-			return result;
-		}
+		return uiomovezeros(len, uio);
 	}
 
 	/*
-	 * Now perform the requested operation into/out of the buffer.
+	 * Get the block.
 	 */
-	result = uiomove(iobuf+skipstart, len, uio);
+	result = sfs_buf_read(sfs, diskblock, &buf);
 	if (result) {
 		return result;
 	}
 
 	/*
-	 * If it was a write, write back the modified block.
+	 * Now perform the requested operation into/out of the buffer.
+	 */
+	result = uiomove((char *)sfs_buf_map(buf) + skipstart, len, uio);
+
+	/*
+	 * If it was a write, the buffer is now dirty. (Even if the
+	 * uiomove failed partway, some of it may have been changed.)
 	 */
 	if (uio->uio_rw == UIO_WRITE) {
-		result = sfs_writeblock(sfs, diskblock, iobuf, sizeof(iobuf));
+		sfs_buf_markdirty(buf);
+	}
+
+	result2 = sfs_buf_release(sfs, buf);
+	return result ? result : result2;
+}
+
+/*
+ * Do I/O (either read or write) of a single whole block, which is
+ * DISKBLOCK on disk, through the buffer cache. ISNEW is true if the
+ * block was just allocated (uncleared) to be written.
+ *
+ * A write that fails partway (say, on a bad user pointer) has only
+ * filled in part of the buffer, and the rest may be left over from
+ * some other block. For a new block the rest is cleared; otherwise
+ * it's filled in from the block's old contents, or if that can't be
+ * done the buffer is thrown away.
+ */
+static
+int
+sfs_blockio(struct sfs_fs *sfs, struct uio *uio, daddr_t diskblock,
+	    bool isnew)
+{
+	struct sfs_buf *buf;
+	off_t origoffset = uio->uio_offset;
+	size_t done;
+	int result, result2;
+
+	KASSERT(uio->uio_resid >= SFS_BLOCKSIZE);
+
+	/*
+	 * Go through the buffer cache. When writing we're replacing
+	 * the whole block, so there's no need to read it first.
+	 */
+	if (uio->uio_rw == UIO_READ) {
+		result = sfs_buf_read(sfs, diskblock, &buf);
+	}
+	else {
+		result = sfs_buf_get(sfs, diskblock, &buf);
+	}
+	if (result) {
+		return result;
+	}
+
+	result = uiomove(sfs_buf_map(buf), SFS_BLOCKSIZE, uio);
+	if (uio->uio_rw == UIO_WRITE && result == 0) {
+		sfs_buf_markdirty(buf);
+	}
+	else if (uio->uio_rw == UIO_WRITE) {
+		done = uio->uio_offset - origoffset;
+		if (isnew) {
+			bzero((char *)sfs_buf_map(buf) + done,
+			      SFS_BLOCKSIZE - done);
+			sfs_buf_markdirty(buf);
+		}
+		else if (sfs_buf_fill(sfs, buf, done) == 0) {
+			sfs_buf_markdirty(buf);
+		}
+	}
+
+	result2 = sfs_buf_release(sfs, buf);
+	return result ? result : result2;
+}
+
+/*
+ * Drop any cached copies of NBLOCKS blocks starting at BLOCK.
+ */
+static
+void
+sfs_invalrange(struct sfs_fs *sfs, daddr_t block, uint32_t nblocks)
+{
+	uint32_t i;
+
+	for (i=0; i<nblocks; i++) {
+		sfs_buf_invalidate(sfs, block + i);
+	}
+}
+
+/*
+ * Do I/O of NBLOCKS whole blocks that are consecutive on disk
+ * starting at DISKBLOCK, with one device request, straight between
+ * the disk and the uio.
+ *
+ * This goes around the buffer cache, so first the cache has to be
+ * made to agree with the disk. Before reading, any cached blocks in
+ * the run that are dirty get written out. Before writing, cached
+ * copies are thrown away, so a dirty one can't later be written over
+ * the new data; and again after, in case the readahead thread read
+ * one in from under us meanwhile.
+ */
+static
+int
+sfs_directio(struct sfs_fs *sfs, struct uio *uio, daddr_t diskblock,
+	     uint32_t nblocks)
+{
+	size_t len = nblocks * SFS_BLOCKSIZE;
+	size_t origresid = uio->uio_resid;
+	off_t origoffset = uio->uio_offset;
+	size_t done;
+	int result;
+
+	KASSERT(origresid >= len);
+
+	if (uio->uio_rw == UIO_READ) {
+		result = sfs_buf_writeback(sfs, diskblock, nblocks);
 		if (result) {
 			return result;
 		}
 	}
+	else {
+		sfs_invalrange(sfs, diskblock, nblocks);
+	}
+
+	/* Aim the uio at the run on disk, then put it back */
+	uio->uio_offset = (off_t)diskblock * SFS_BLOCKSIZE;
+	uio->uio_resid = len;
+	result = sfs_rwblock(sfs, uio);
+	done = len - uio->uio_resid;
+	uio->uio_offset = origoffset + done;
+	uio->uio_resid = origresid - done;
 
-	return 0;
+	if (uio->uio_rw == UIO_WRITE) {
+		sfs_invalrange(sfs, diskblock, nblocks);
+	}
+	return result;
+}
+
+/*
+ * A write to the NBLOCKS newly allocated blocks starting at DISKBLOCK
+ * failed after DONE bytes. Those blocks weren't cleared when they
+ * were allocated, so clear what wasn't written; otherwise it would
+ * read back as whatever was on the disk before.
+ */
+static
+void
+sfs_runclear(struct sfs_fs *sfs, daddr_t diskblock, uint32_t nblocks,
+	     size_t done)
+{
+	struct sfs_buf *buf;
+	uint32_t i, blkoff;
+
+	i = done / SFS_BLOCKSIZE;
+	blkoff = done % SFS_BLOCKSIZE;
+	if (blkoff != 0 && sfs_buf_read(sfs, diskblock + i, &buf) == 0) {
+		bzero((char *)sfs_buf_map(buf) + blkoff,
+		      SFS_BLOCKSIZE - blkoff);
+		sfs_buf_markdirty(buf);
+		sfs_buf_release(sfs, buf);
+		i++;
+	}
+	for (; i<nblocks; i++) {
+		/* Not much we can do if this fails */
+		sfs_clearblock(sfs, diskblock + i);
+	}
 }
 
 /*
- * Do I/O (either read or write) of a single whole block.
+ * Do I/O of as many of the remaining whole blocks in the uio as are
+ * laid out in one run on disk (or are one run of holes). Runs of at
+ * least SFS_DIRECTMIN blocks are done with sfs_directio; for a file
+ * mapped by extents, that means one disk request per extent. Shorter
+ * ones go through the buffer cache. Sets *DIRECT if it used
+ * sfs_directio.
+ *
+ * Blocks allocated to fill a hole here come from sfs_bmaprun
+ * uncleared, since we're about to overwrite them; so appending to a
+ * file writes each block once, not zeros and then data.
  */
 static
 int
-sfs_blockio(struct sfs_vnode *sv, struct uio *uio)
+sfs_runio(struct sfs_vnode *sv, struct uio *uio, bool *direct)
 {
 	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
 	daddr_t diskblock;
-	uint32_t fileblock;
+	uint32_t fileblock, runlen, i;
+	off_t origoffset = uio->uio_offset;
+	bool newrun;
 	int result;
+
+	/* Allocate missing blocks if and only if we're writing */
 	bool doalloc = (uio->uio_rw==UIO_WRITE);
-	off_t saveoff;
-	off_t diskoff;
-	off_t saveres;
-	off_t diskres;
 
-	/* Get the block number within the file */
+	/* Get the block number within the file, and find the run */
 	fileblock = uio->uio_offset / SFS_BLOCKSIZE;
-
-	/* Look up the disk block number */
-	result = sfs_bmap(sv, fileblock, doalloc, &diskblock);
+	result = sfs_bmaprun(sv, fileblock, uio->uio_resid / SFS_BLOCKSIZE,
+			     doalloc, &diskblock, &runlen, &newrun);
 	if (result) {
 		return result;
 	}
 
 	if (diskblock == 0) {
 		/*
-		 * No block - fill with zeros.
+		 * No blocks - fill with zeros.
 		 *
-		 * We must be reading, or sfs_bmap would have
-		 * allocated a block for us.
+		 * We must be reading, or sfs_bmaprun would have
+		 * allocated blocks for us.
 		 */
 		KASSERT(uio->uio_rw == UIO_READ);
-		return uiomovezeros(SFS_BLOCKSIZE, uio);
+		return uiomovezeros(runlen * SFS_BLOCKSIZE, uio);
 	}
 
-	/*
-	 * Do the I/O directly to the uio region. Save the uio_offset,
-	 * and substitute one that makes sense to the device.
-	 */
-	saveoff = uio->uio_offset;
-	diskoff = diskblock * SFS_BLOCKSIZE;
-	uio->uio_offset = diskoff;
-
-	/*
-	 * Temporarily set the residue to be one block size.
-	 */
-	KASSERT(uio->uio_resid >= SFS_BLOCKSIZE);
-	saveres = uio->uio_resid;
-	diskres = SFS_BLOCKSIZE;
-	uio->uio_resid = diskres;
-
-	result = sfs_rwblock(sfs, uio);
-
-	/*
-	 * Now, restore the original uio_offset and uio_resid and update
-	 * them by the amount of I/O done.
-	 */
-	uio->uio_offset = (uio->uio_offset - diskoff) + saveoff;
-	uio->uio_resid = (uio->uio_resid - diskres) + saveres;
+	if (runlen >= SFS_DIRECTMIN) {
+		*direct = true;
+		result = sfs_directio(sfs, uio, diskblock, runlen);
+	}
+	else {
+		for (i=0; i<runlen && result == 0; i++) {
+			result = sfs_blockio(sfs, uio, diskblock + i,
+					     newrun);
+		}
+	}
 
+	if (result && newrun) {
+		sfs_runclear(sfs, diskblock, runlen,
+			     uio->uio_offset - origoffset);
+	}
 	return result;
 }
 
 /*
  * Do I/O of a whole region of data, whether or not it's block-aligned.
+ * The caller must hold the vnode's lock.
  */
 int
 sfs_io(struct sfs_vnode *sv, struct uio *uio)
 {
 	uint32_t blkoff;
-	uint32_t nblocks, i;
 	int result = 0;
 	uint32_t origresid, extraresid = 0;
+	off_t origoffset;
+	bool direct = false;
+
+	KASSERT(lock_do_i_hold(sv->sv_lock));
 
 	origresid = uio->uio_resid;
+	origoffset = uio->uio_offset;
 
 	/*
 	 * If reading, check for EOF. If we can read a partial area,
@@ -318,6 +483,10 @@ sfs_io(struct sfs_vnode *sv, struct uio *uio)
 			uio->uio_resid -= extraresid;
 		}
 	}
+	else if (uio->uio_offset >= SFS_MAXFILESIZE && uio->uio_resid > 0) {
+		/* Don't let the block number wrap around */
+		return EFBIG;
+	}
 
 	/*
 	 * First, do any leading partial block.
@@ -351,9 +520,8 @@ sfs_io(struct sfs_vnode *sv, struct uio *uio)
 	 * Now we should be block-aligned. Do the remaining whole blocks.
 	 */
 	KASSERT(uio->uio_offset % SFS_BLOCKSIZE == 0);
-	nblocks = uio->uio_resid / SFS_BLOCKSIZE;
-	for (i=0; i<nblocks; i++) {
-		result = sfs_blockio(sv, uio);
+	while (uio->uio_resid >= SFS_BLOCKSIZE) {
+		result = sfs_runio(sv, uio, &direct);
 		if (result) {
 			goto out;
 		}
@@ -381,6 +549,17 @@ sfs_io(struct sfs_vnode *sv, struct uio *uio)
 		sv->sv_dirty = true;
 	}
 
+	/*
+	 * If reading, and this looks sequential, start reading ahead.
+	 * Not if we went around the cache, though; the next read
+	 * probably will too, and the blocks would go to waste.
+	 */
+	if (uio->uio_rw == UIO_READ && result == 0 && !direct &&
+	    uio->uio_offset > origoffset) {
+		sfs_readahead(sv, origoffset / SFS_BLOCKSIZE,
+			      (uio->uio_offset - 1) / SFS_BLOCKSIZE);
+	}
+
 	/* Add in any extra amount we couldn't read because of EOF */
 	uio->uio_resid += extraresid;
 
@@ -401,12 +580,16 @@ sfs_io(struct sfs_vnode *sv, struct uio *uio)
  * such code in this version of SFS, it is often desirable when doing
  * more advanced things to handle metadata and user data I/O
  * differently.
+ *
+ * As with sfs_io, the caller must hold the vnode's lock.
  */
 int
 sfs_metaio(struct sfs_vnode *sv, off_t actualpos, void *data, size_t len,
 	   enum uio_rw rw)
 {
 	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	struct sfs_buf *buf;
+	char *ioptr;
 	off_t endpos;
 	uint32_t vnblock;
 	uint32_t blockoffset;
@@ -414,17 +597,7 @@ sfs_metaio(struct sfs_vnode *sv, off_t actualpos, void *data, size_t len,
 	bool doalloc;
 	int result;
 
-	/*
-	 * I/O buffer for metadata ops.
-	 *
-	 * Note: in real life (and when you've done the fs assignment) you
-	 * would get space from the disk buffer cache for this, not use a
-	 * static area.
-	 */
-	static char metaiobuf[SFS_BLOCKSIZE];
-
-	/* We're using a global static buffer; it had better be locked */
-	KASSERT(vfs_biglock_do_i_hold());
+	KASSERT(lock_do_i_hold(sv->sv_lock));
 
 	/* Figure out which block of the vnode (directory, whatever) this is */
 	vnblock = actualpos / SFS_BLOCKSIZE;
@@ -446,26 +619,21 @@ sfs_metaio(struct sfs_vnode *sv, off_t actualpos, void *data, size_t len,
 		return 0;
 	}
 
-	/* Read the block */
-	result = sfs_readblock(sfs, diskblock, metaiobuf, sizeof(metaiobuf));
+	/* Get the block */
+	result = sfs_buf_read(sfs, diskblock, &buf);
 	if (result) {
 		return result;
 	}
+	ioptr = sfs_buf_map(buf);
 
 	if (rw == UIO_READ) {
 		/* Copy out the selected region */
-		memcpy(data, metaiobuf + blockoffset, len);
+		memcpy(data, ioptr + blockoffset, len);
 	}
 	else {
 		/* Update the selected region */
-		memcpy(metaiobuf + blockoffset, data, len);
-
-		/* Write the block back */
-		result = sfs_writeblock(sfs, diskblock,
-					metaiobuf, sizeof(metaiobuf));
-		if (result) {
-			return result;
-		}
+		memcpy(ioptr + blockoffset, data, len);
+		sfs_buf_markdirty(buf);
 
 		/* Update the vnode size if needed */
 		endpos = actualpos + len;
@@ -476,5 +644,5 @@ sfs_metaio(struct sfs_vnode *sv, off_t actualpos, void *data, size_t len,
 	}
 
 	/* Done */
-	return 0;
+	return sfs_buf_release(sfs, buf);
 }
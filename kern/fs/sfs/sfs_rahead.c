@@ -0,0 +1,262 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009, 2014
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * SFS filesystem
+ *
+ * Sequential readahead.
+ *
+ * Each vnode remembers where its last read ended. A read that starts
+ * there is taken to be part of a sequential scan, and the blocks
+ * following it are queued for a per-volume readahead thread to pull
+ * into the buffer cache while the reader is busy with what it got.
+ * The window starts small and doubles with each sequential read, up
+ * to sfs_ramax blocks; a read anywhere else shuts it off again.
+ *
+ * The state is per vnode rather than per open file, because that's
+ * all VOP_READ gets to see. Two readers scanning the same file at
+ * different places will keep resetting each other's window; that
+ * costs some readahead but nothing else.
+ */
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <synch.h>
+#include <thread.h>
+#include <sfs.h>
+#include "sfsprivate.h"
+
+/* Blocks in the first readahead window */
+#define SFS_RAMIN	2
+
+/* Upper bound for sfs_ramax; also the size of the request queue */
+#define SFS_RAQUEUE	64
+
+/*
+ * Maximum readahead window, in blocks (0 = no readahead). Settable
+ * from the kernel menu.
+ */
+unsigned sfs_ramax = 16;
+
+/*
+ * Control block for a volume's readahead thread. To shut the thread
+ * down, sfs_rahead_stop clears ra_fs and waits for the thread to
+ * finish whatever read it's doing and set ra_exited.
+ */
+struct sfs_rahead {
+	struct lock *ra_lock;		/* protects everything here */
+	struct cv *ra_cv;		/* queue or ra_fs/ra_exited changed */
+	struct sfs_fs *ra_fs;		/* volume, or NULL if unmounting */
+	bool ra_exited;			/* thread is gone */
+	unsigned ra_head;		/* index of oldest request */
+	unsigned ra_count;		/* number of requests */
+	daddr_t ra_queue[SFS_RAQUEUE];	/* disk blocks to read */
+};
+
+/*
+ * Readahead thread: read each queued block into the cache.
+ */
+static
+void
+sfs_rahead_thread(void *data, unsigned long junk)
+{
+	struct sfs_rahead *ra = data;
+	struct sfs_fs *sfs;
+	daddr_t block;
+
+	(void)junk;
+
+	lock_acquire(ra->ra_lock);
+	while (1) {
+		while (ra->ra_fs != NULL && ra->ra_count == 0) {
+			cv_wait(ra->ra_cv, ra->ra_lock);
+		}
+		if (ra->ra_fs == NULL) {
+			/* Unmounted */
+			break;
+		}
+		block = ra->ra_queue[ra->ra_head];
+		ra->ra_head = (ra->ra_head + 1) % SFS_RAQUEUE;
+		ra->ra_count--;
+		sfs = ra->ra_fs;
+		lock_release(ra->ra_lock);
+
+		/* Errors don't matter; the reader will see them itself. */
+		sfs_buf_prefetch(sfs, block);
+
+		lock_acquire(ra->ra_lock);
+	}
+
+	/* Don't touch RA after letting go of the lock. */
+	ra->ra_exited = true;
+	cv_broadcast(ra->ra_cv, ra->ra_lock);
+	lock_release(ra->ra_lock);
+}
+
+/*
+ * Note that SV has just read file blocks FIRST through LAST, and if
+ * that continues a sequential scan, queue the blocks after it for
+ * readahead. The caller holds the vnode lock.
+ */
+void
+sfs_readahead(struct sfs_vnode *sv, uint32_t first, uint32_t last)
+{
+	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	struct sfs_rahead *ra = sfs->sfs_rahead;
+	daddr_t blocks[SFS_RAQUEUE];
+	unsigned window, num, i;
+	uint32_t from, to, fileblocks, b;
+	daddr_t diskblock;
+
+	KASSERT(lock_do_i_hold(sv->sv_lock));
+	KASSERT(first <= last);
+
+	window = sfs_ramax;
+	if (window > SFS_RAQUEUE) {
+		window = SFS_RAQUEUE;
+	}
+	if (window == 0 || first != sv->sv_ranext) {
+		/* Not sequential (or readahead is off); start over */
+		sv->sv_ranext = last + 1;
+		sv->sv_rawindow = 0;
+		sv->sv_raend = 0;
+		return;
+	}
+	sv->sv_ranext = last + 1;
+
+	/* Open the window up */
+	if (sv->sv_rawindow == 0) {
+		sv->sv_rawindow = SFS_RAMIN;
+	}
+	else {
+		sv->sv_rawindow *= 2;
+	}
+	if (sv->sv_rawindow > window) {
+		sv->sv_rawindow = window;
+	}
+
+	/* Skip what we already asked for; stop at EOF */
+	from = last + 1;
+	if (from < sv->sv_raend) {
+		from = sv->sv_raend;
+	}
+	to = last + 1 + sv->sv_rawindow;
+	fileblocks = DIVROUNDUP(sv->sv_i.sfi_size, SFS_BLOCKSIZE);
+	if (to > fileblocks) {
+		to = fileblocks;
+	}
+	if (from >= to) {
+		return;
+	}
+
+	num = 0;
+	for (b = from; b < to; b++) {
+		if (sfs_bmap(sv, b, false, &diskblock)) {
+			break;
+		}
+		if (diskblock != 0) {
+			blocks[num++] = diskblock;
+		}
+	}
+	sv->sv_raend = b;
+
+	lock_acquire(ra->ra_lock);
+	for (i=0; i<num && ra->ra_count < SFS_RAQUEUE; i++) {
+		ra->ra_queue[(ra->ra_head + ra->ra_count) % SFS_RAQUEUE] =
+			blocks[i];
+		ra->ra_count++;
+	}
+	cv_broadcast(ra->ra_cv, ra->ra_lock);
+	lock_release(ra->ra_lock);
+}
+
+/*
+ * Start the readahead thread for a volume.
+ */
+int
+sfs_rahead_start(struct sfs_fs *sfs)
+{
+	struct sfs_rahead *ra;
+	int result;
+
+	ra = kmalloc(sizeof(*ra));
+	if (ra == NULL) {
+		return ENOMEM;
+	}
+	ra->ra_lock = lock_create("sfs readahead");
+	if (ra->ra_lock == NULL) {
+		kfree(ra);
+		return ENOMEM;
+	}
+	ra->ra_cv = cv_create("sfs readahead");
+	if (ra->ra_cv == NULL) {
+		lock_destroy(ra->ra_lock);
+		kfree(ra);
+		return ENOMEM;
+	}
+	ra->ra_fs = sfs;
+	ra->ra_exited = false;
+	ra->ra_head = 0;
+	ra->ra_count = 0;
+
+	result = thread_fork("sfs readahead", NULL, sfs_rahead_thread, ra, 0);
+	if (result) {
+		cv_destroy(ra->ra_cv);
+		lock_destroy(ra->ra_lock);
+		kfree(ra);
+		return result;
+	}
+	sfs->sfs_rahead = ra;
+	return 0;
+}
+
+/*
+ * Stop the readahead thread for a volume. Anything still queued is
+ * dropped; a read in progress is waited for, so that afterwards
+ * nothing is using the buffer cache.
+ */
+void
+sfs_rahead_stop(struct sfs_fs *sfs)
+{
+	struct sfs_rahead *ra = sfs->sfs_rahead;
+
+	lock_acquire(ra->ra_lock);
+	ra->ra_fs = NULL;
+	ra->ra_count = 0;
+	cv_broadcast(ra->ra_cv, ra->ra_lock);
+	while (!ra->ra_exited) {
+		cv_wait(ra->ra_cv, ra->ra_lock);
+	}
+	lock_release(ra->ra_lock);
+
+	cv_destroy(ra->ra_cv);
+	lock_destroy(ra->ra_lock);
+	kfree(ra);
+	sfs->sfs_rahead = NULL;
+}
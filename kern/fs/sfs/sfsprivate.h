@@ -43,13 +43,42 @@ extern const struct vnode_ops sfs_dirops;
 
 
 /* Functions in sfs_balloc.c */
-int sfs_balloc(struct sfs_fs *sfs, daddr_t *diskblock);
+int sfs_balloc(struct sfs_fs *sfs, struct sfs_rsv *rsv, daddr_t goal,
+		bool clear, daddr_t *diskblock);
+int sfs_clearblock(struct sfs_fs *sfs, daddr_t block);
+void sfs_rsv_release(struct sfs_fs *sfs, struct sfs_rsv *rsv);
 void sfs_bfree(struct sfs_fs *sfs, daddr_t diskblock);
 int sfs_bused(struct sfs_fs *sfs, daddr_t diskblock);
 
+/* Functions in sfs_buf.c */
+struct sfs_buf;		/* Opaque. */
+struct sfs_bufcache *sfs_bufcache_create(void);
+void sfs_bufcache_destroy(struct sfs_bufcache *bc);
+int sfs_buf_get(struct sfs_fs *sfs, daddr_t block, struct sfs_buf **ret);
+int sfs_buf_read(struct sfs_fs *sfs, daddr_t block, struct sfs_buf **ret);
+int sfs_buf_prefetch(struct sfs_fs *sfs, daddr_t block);
+int sfs_buf_fill(struct sfs_fs *sfs, struct sfs_buf *buf, size_t len);
+void *sfs_buf_map(struct sfs_buf *buf);
+void sfs_buf_markdirty(struct sfs_buf *buf);
+int sfs_buf_release(struct sfs_fs *sfs, struct sfs_buf *buf);
+int sfs_buf_flush(struct sfs_fs *sfs);
+void sfs_buf_invalidate(struct sfs_fs *sfs, daddr_t block);
+int sfs_buf_writeback(struct sfs_fs *sfs, daddr_t block, uint32_t nblocks);
+
 /* Functions in sfs_bmap.c */
+
+/* Largest file: the direct blocks plus the single, double, and triple
+   indirect trees */
+#define SFS_MAXFILEBLOCKS	(SFS_NDIRECT + SFS_DBPERIDB + \
+				 SFS_DBPERIDB * SFS_DBPERIDB + \
+				 SFS_DBPERIDB * SFS_DBPERIDB * SFS_DBPERIDB)
+#define SFS_MAXFILESIZE		((off_t)SFS_MAXFILEBLOCKS * SFS_BLOCKSIZE)
+
 int sfs_bmap(struct sfs_vnode *sv, uint32_t fileblock, bool doalloc,
 		daddr_t *diskblock);
+int sfs_bmaprun(struct sfs_vnode *sv, uint32_t fileblock, uint32_t maxrun,
+		bool doalloc, daddr_t *diskblock, uint32_t *runlen,
+		bool *newrun);
 int sfs_itrunc(struct sfs_vnode *sv, off_t len);
 
 /* Functions in sfs_dir.c */
@@ -65,12 +94,20 @@ int sfs_lookonce(struct sfs_vnode *sv, const char *name,
 /* Functions in sfs_inode.c */
 int sfs_sync_inode(struct sfs_vnode *sv);
 int sfs_reclaim(struct vnode *v);
+int sfs_vnode_purge(struct sfs_fs *sfs);
 int sfs_loadvnode(struct sfs_fs *sfs, uint32_t ino, int forcetype,
 		struct sfs_vnode **ret);
-int sfs_makeobj(struct sfs_fs *sfs, int type, struct sfs_vnode **ret);
+int sfs_makeobj(struct sfs_fs *sfs, int type, struct sfs_vnode *dir,
+		struct sfs_vnode **ret);
 int sfs_getroot(struct fs *fs, struct vnode **ret);
 
+/* Functions in sfs_rahead.c */
+void sfs_readahead(struct sfs_vnode *sv, uint32_t first, uint32_t last);
+int sfs_rahead_start(struct sfs_fs *sfs);
+void sfs_rahead_stop(struct sfs_fs *sfs);
+
 /* Functions in sfs_io.c */
+int sfs_rawio(struct sfs_fs *sfs, daddr_t block, void *data, enum uio_rw rw);
 int sfs_readblock(struct sfs_fs *sfs, daddr_t block, void *data, size_t len);
 int sfs_writeblock(struct sfs_fs *sfs, daddr_t block, void *data, size_t len);
 int sfs_io(struct sfs_vnode *sv, struct uio *uio);
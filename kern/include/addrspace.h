@@ -39,15 +39,36 @@
 #include "opt-dumbvm.h"
 
 struct vnode;
+struct pagetable;
 
 
 /*
  * Address space - data structure associated with the virtual memory
  * space of a process.
  *
- * You write this.
+ * The address space is a list of regions (the segments from the
+ * executable, plus the stack), each a page-aligned range of virtual
+ * addresses with its permissions, and a page table that maps the
+ * pages of those regions that have been touched. Addresses outside
+ * every region are invalid.
+ *
+ * The page table is protected by the VM paging lock (see vm.h).
+ * as_loading is set between as_prepare_load and as_complete_load so
+ * that read-only segments can be written while the executable is
+ * being loaded.
  */
 
+#if !OPT_DUMBVM
+struct vm_region {
+	vaddr_t vr_base;		/* first address */
+	size_t vr_npages;		/* length in pages */
+	bool vr_readable;		/* permissions */
+	bool vr_writeable;
+	bool vr_executable;
+	struct vm_region *vr_next;	/* next region in address space */
+};
+#endif
+
 struct addrspace {
 #if OPT_DUMBVM
         vaddr_t as_vbase1;
@@ -58,7 +79,9 @@ struct addrspace {
         size_t as_npages2;
         paddr_t as_stackpbase;
 #else
-        /* Put stuff here for your VM system */
+	struct vm_region *as_regions;	/* valid ranges of addresses */
+	struct pagetable *as_pt;	/* virtual to physical mappings */
+	bool as_loading;		/* executable being loaded */
 #endif
 };
 
@@ -118,6 +141,11 @@ int               as_prepare_load(struct addrspace *as);
 int               as_complete_load(struct addrspace *as);
 int               as_define_stack(struct addrspace *as, vaddr_t *initstackptr);
 
+#if !OPT_DUMBVM
+/* Find the region containing VADDR, or NULL if there isn't one. */
+struct vm_region *as_findregion(struct addrspace *as, vaddr_t vaddr);
+#endif
+
 
 /*
  * Functions in loadelf.c
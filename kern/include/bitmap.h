@@ -38,10 +38,26 @@
  *                      Returns NULL on error.
  *     bitmap_getdata - return pointer to raw bit data (for I/O).
  *     bitmap_alloc   - locate a cleared bit, set it, and return its index.
+ *     bitmap_alloc_hint - same, but look first at or after a given
+ *                      index, then from the beginning.
  *     bitmap_mark    - set a clear bit by its index.
  *     bitmap_unmark  - clear a set bit by its index.
  *     bitmap_isset   - return whether a particular bit is set or not.
+ *     bitmap_nextset - locate the first set bit at or after a given
+ *                      index. Returns ENOENT if there is none.
+ *     bitmap_nextclear - locate the first cleared bit at or after a
+ *                      given index, without setting it. Returns
+ *                      ENOSPC if there is none.
+ *     bitmap_findrun - locate the first run of a given number of
+ *                      cleared bits at or after a given index, without
+ *                      setting them. Returns ENOSPC if there is none.
+ *     bitmap_count   - return the number of bits set in [start, end).
  *     bitmap_destroy - destroy bitmap.
+ *
+ * Also:
+ *     bitmap_ctz32   - return the index of the lowest set bit in a
+ *                      nonzero 32-bit word, for code keeping its own
+ *                      bit arrays.
  */
 
 
@@ -50,10 +66,21 @@ struct bitmap;  /* Opaque. */
 struct bitmap *bitmap_create(unsigned nbits);
 void          *bitmap_getdata(struct bitmap *);
 int            bitmap_alloc(struct bitmap *, unsigned *index);
+int            bitmap_alloc_hint(struct bitmap *, unsigned hint,
+                                 unsigned *index);
 void           bitmap_mark(struct bitmap *, unsigned index);
 void           bitmap_unmark(struct bitmap *, unsigned index);
 int            bitmap_isset(struct bitmap *, unsigned index);
+int            bitmap_nextset(struct bitmap *, unsigned start,
+                              unsigned *index);
+int            bitmap_nextclear(struct bitmap *, unsigned start,
+                                unsigned *index);
+int            bitmap_findrun(struct bitmap *, unsigned start, unsigned n,
+                              unsigned *index);
+unsigned       bitmap_count(struct bitmap *, unsigned start, unsigned end);
 void           bitmap_destroy(struct bitmap *);
 
+unsigned       bitmap_ctz32(uint32_t x);
+
 
 #endif /* _BITMAP_H_ */
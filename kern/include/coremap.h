@@ -0,0 +1,88 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _COREMAP_H_
+#define _COREMAP_H_
+
+/*
+ * Physical page frame management.
+ *
+ * The coremap has one entry for every page of physical memory. Pages
+ * are either free, in use by the kernel (via alloc_kpages, which is
+ * implemented here), or holding a page of some user address space,
+ * in which case the coremap records which address space and virtual
+ * page it belongs to. After fork a user page may be shared
+ * copy-on-write by several address spaces; user pages are reference
+ * counted so it's freed only when the last of them lets go.
+ *
+ * Functions:
+ *     coremap_bootstrap  - take over physical memory from ram.c.
+ *     coremap_alloc_upage - allocate a zeroed frame for the user page
+ *                          VADDR of address space AS. Returns 0 if
+ *                          there's no memory.
+ *     coremap_copy_upage - same, but fill it with a copy of the page
+ *                          at SRCPA instead of zeros.
+ *     coremap_swapin_upage - allocate a frame for the user page VADDR
+ *                          of AS and read swap slot SLOT into it. The
+ *                          caller's reference to the slot passes to
+ *                          the frame, which keeps it as long as the
+ *                          page is clean.
+ *     coremap_touch_upage - note that a user frame is being mapped,
+ *                          for writing if WRITE is set. Returns true
+ *                          if it may be mapped writable, or false if
+ *                          it's clean and should be mapped read-only
+ *                          to catch the first write.
+ *     coremap_share_upage - add a copy-on-write reference to a frame.
+ *     coremap_reown_upage - if a frame is no longer shared, make it
+ *                          belong to user page VADDR of AS and return
+ *                          true; otherwise return false.
+ *     coremap_free_upage - drop a reference to a user frame, freeing
+ *                          it when the last one goes.
+ *     coremap_stats      - print page counts.
+ *
+ * The functions for user pages must be called with the VM paging
+ * lock held. When memory is full they evict a page to make room (as
+ * does alloc_kpages, if it's allowed to sleep).
+ */
+
+struct addrspace;
+
+void coremap_bootstrap(void);
+paddr_t coremap_alloc_upage(struct addrspace *as, vaddr_t vaddr);
+paddr_t coremap_copy_upage(struct addrspace *as, vaddr_t vaddr,
+			   paddr_t srcpa);
+int coremap_swapin_upage(struct addrspace *as, vaddr_t vaddr, unsigned slot,
+			 paddr_t *ret);
+bool coremap_touch_upage(paddr_t pa, bool write);
+void coremap_share_upage(paddr_t pa);
+bool coremap_reown_upage(paddr_t pa, struct addrspace *as, vaddr_t vaddr);
+void coremap_free_upage(paddr_t pa);
+void coremap_stats(void);
+
+#endif /* _COREMAP_H_ */
@@ -35,6 +35,8 @@
 #include <threadlist.h>
 #include <machine/vm.h>  /* for TLBSHOOTDOWN_MAX */
 
+struct addrspace;
+
 
 /*
  * Per-cpu structure
@@ -62,6 +64,16 @@ struct cpu {
 	unsigned c_hardclocks;		/* Counter of hardclock() calls */
 	unsigned c_spinlocks;		/* Counter of spinlocks held */
 
+	/*
+	 * Written only by this cpu; read without locking by others.
+	 *
+	 * c_vmas is the address space most recently activated on this
+	 * cpu, which is the only one whose mappings can be in its MMU.
+	 * Other cpus compare against it (but never dereference it) to
+	 * decide whether this cpu needs a TLB shootdown.
+	 */
+	struct addrspace *c_vmas;	/* Address space loaded in MMU */
+
 	/*
 	 * Accessed by other cpus.
 	 * Protected by the runqueue lock.
@@ -155,6 +167,10 @@ void cpu_halt(void);
  * ipi_send sends an IPI to one CPU.
  * ipi_broadcast sends an IPI to all CPUs except the current one.
  * ipi_tlbshootdown is like ipi_send but carries TLB shootdown data.
+ * ipi_tlbshootdown_as sends TLB shootdown data to every CPU except
+ * the current one that has address space AS (or, if AS is NULL, any
+ * user address space) loaded in its MMU, and returns how many CPUs
+ * it sent to.
  *
  * interprocessor_interrupt is called on the target CPU when an IPI is
  * received.
@@ -169,6 +185,8 @@ void cpu_halt(void);
 void ipi_send(struct cpu *target, int code);
 void ipi_broadcast(int code);
 void ipi_tlbshootdown(struct cpu *target, const struct tlbshootdown *mapping);
+unsigned ipi_tlbshootdown_as(struct addrspace *as,
+			     const struct tlbshootdown *mapping);
 
 void interprocessor_interrupt(void);
 
@@ -1,75 +1,137 @@
 /*
- * Declarations for file handle and file table management.
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
  */
 
 #ifndef _FILE_H_
 #define _FILE_H_
 
-#define FREE 0
-#define OCCUPIED 1
 /*
- * Contains some file-related maximum length constants
+ * Declarations for file handle and file table management.
  */
+
 #include <limits.h>
-#include <vnode.h>
-#include <synch.h>
+#include <spinlock.h>
+
+struct vnode;
+struct wchan;
 
 
 /*
- * Put your function declarations and data types here ...
+ * Open file object.
+ *
+ * One of these exists for each successful open(); descriptors that
+ * share it (via dup2, or fork) share the seek position. Open files
+ * are reference counted: each descriptor slot pointing at one holds
+ * a reference, and so does each system call that is using it, so a
+ * close() racing with a read() in another thread cannot pull the
+ * vnode out from under the read.
+ *
+ * Operations that use the seek position (read, write, lseek) are
+ * serialized by of_busy, which is a hand-rolled sleep lock: the
+ * owner sets it under of_spinlock and then has of_offset to itself.
+ * The wait channel needed to sleep on it is only created the first
+ * time two operations actually collide, so opening a file and using
+ * it from one thread costs no lock or wait channel creation at all.
+ * Once made, the wait channel stays with the object (also across
+ * reuse from the pool).
+ *
+ * The first group of fields is fixed at open time; the access mode
+ * and seekability are looked up once then so the I/O paths don't
+ * have to ask again.
  */
-
+struct openfile {
+	struct vnode *of_vnode;		/* the file */
+	int of_flags;			/* flags passed to open() */
+	int of_accmode;			/* of_flags & O_ACCMODE */
+	bool of_seekable;		/* VOP_ISSEEKABLE(of_vnode) */
+
+	struct spinlock of_spinlock;	/* protects the fields below */
+	unsigned of_refcount;		/* number of references */
+	bool of_busy;			/* of_offset is in use */
+	struct wchan *of_wchan;		/* waiters for of_busy, or NULL */
+	off_t of_offset;		/* seek position; owned by of_busy */
+
+	struct openfile *of_next;	/* pool free list linkage */
+};
 
 /*
- * struct used to store opened vnode and corresponding file pointers
-*/
+ * Per-process file descriptor table.
+ *
+ * ft_files is an array of ft_size slots that starts small and is
+ * doubled on demand, up to OPEN_MAX; a NULL slot is a free
+ * descriptor. ft_inuse has one bit per slot, set when the descriptor
+ * is taken, so that the lowest free descriptor (as POSIX requires)
+ * can be found a word at a time. Every word of ft_inuse below
+ * ft_freehint is known to be full. ft_size is always a multiple of
+ * the bitmap word size.
+ *
+ * All of this is protected by ft_lock; the arrays are always
+ * reallocated outside the lock and swapped in under it.
+ */
 struct fd_table {
-    int *of_ptr; /* map to the index in of_table */
-    int *free_slots; /* queue of free ofptr */
-    int8_t *availability; /* FREE or OCCUPIED: check if ofptr[i] is free or not */
-    int size; /* number of free slots */
-    int front; /* front of free slot queue */
-    int end; /* end of free slot queue */
-};
-
-
-struct of_table{
-    struct vnode **v_ptr;
-    off_t *fp; /* file pointer. I don't know how this works */
-    int8_t *availability; /* FREE or OCCUPIED: check if v_ptr[i] and fp[i] is free or not */
-    mode_t *flags; 
-    int *free_slots; /* queue of free v_ptr */
-    int size; /* size of current file_des_table */
-    int front; /* front of free slot queue */
-    int end; /* end of free slot queue */
-    int *refcount; /* used for dup2 count */
-    struct lock **op_lock; /* lock for every op */
+	struct spinlock ft_lock;	/* protects the rest */
+	struct openfile **ft_files;	/* descriptor slots */
+	uint32_t *ft_inuse;		/* bitmap of taken descriptors */
+	unsigned ft_size;		/* number of slots */
+	unsigned ft_freehint;		/* lowest word that may have a 0 */
 };
 
+/* Descriptor table creation/destruction. */
+struct fd_table *fd_table_create(void);
+void fd_table_destroy(struct fd_table *ft);
 
+/*
+ * In-kernel open, for setting up the standard descriptors; PATH is a
+ * kernel string and (as with vfs_open) may be destroyed.
+ */
+int file_open(char *path, int flags, mode_t mode, int *retfd);
 
-struct of_table * cur_of_table;
-
-struct fd_table * create_fd_table(void);
-struct of_table * create_of_table(void);
-
-
-int sys_open(const char *filename, int flags, mode_t mode);
-int sys_read(int filehandle, void *buf, size_t size, int *err);
-int sys_write(int filehandle, const_userptr_t buf, size_t size, int *err);
-off_t sys_lseek(int filehandle, off_t pos, int whence, int *err);
-int sys_close(int filehandle);
-int sys_dup2(int filehandle, int newhandle);
-
-void show_of_table(void);
-void show_fd_table(void);
 
+/*
+ * File system calls. These follow the usual convention of returning
+ * an error code and handing back the result through the last
+ * argument.
+ */
+int sys_open(const_userptr_t path, int flags, mode_t mode, int *retval);
+int sys_read(int fd, userptr_t buf, size_t size, int *retval);
+int sys_write(int fd, const_userptr_t buf, size_t size, int *retval);
+int sys_pread(int fd, userptr_t buf, size_t size, off_t pos, int *retval);
+int sys_pwrite(int fd, const_userptr_t buf, size_t size, off_t pos,
+	       int *retval);
+int sys_readv(int fd, const_userptr_t iov, int iovcnt, int *retval);
+int sys_writev(int fd, const_userptr_t iov, int iovcnt, int *retval);
+int sys_preadv(int fd, const_userptr_t iov, int iovcnt, off_t pos,
+	       int *retval);
+int sys_pwritev(int fd, const_userptr_t iov, int iovcnt, off_t pos,
+		int *retval);
+int sys_lseek(int fd, off_t pos, int whence, off_t *retval);
+int sys_close(int fd);
+int sys_dup2(int oldfd, int newfd, int *retval);
 
 
 #endif /* _FILE_H_ */
-
-
-
-
-
-
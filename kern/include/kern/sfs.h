@@ -41,8 +41,8 @@
 #define SFS_VOLNAME_SIZE  32            /* max length of volume name */
 #define SFS_NDIRECT       15            /* # of direct blocks in inode */
 #define SFS_NINDIRECT     1             /* # of indirect blocks in inode */
-#define SFS_NDINDIRECT    0             /* # of 2x indirect blocks in inode */
-#define SFS_NTINDIRECT    0             /* # of 3x indirect blocks in inode */
+#define SFS_NDINDIRECT    1             /* # of 2x indirect blocks in inode */
+#define SFS_NTINDIRECT    1             /* # of 3x indirect blocks in inode */
 #define SFS_DBPERIDB      128           /* # direct blks per indirect blk */
 #define SFS_NAMELEN       60            /* max length of filename */
 #define SFS_SUPER_BLOCK   0             /* block the superblock lives in */
@@ -67,6 +67,10 @@
 #define SFS_TYPE_FILE     1
 #define SFS_TYPE_DIR      2
 
+/* Flags for sfi_flags */
+#define SFS_IFLAG_DIRHASH 0x1     /* Directory is a hash table */
+#define SFS_IFLAG_EXTENTS 0x2     /* File is mapped by sfi_extents */
+
 /*
  * On-disk superblock
  */
@@ -77,8 +81,37 @@ struct sfs_superblock {
 	uint32_t reserved[118];			/* unused, set to 0 */
 };
 
+/*
+ * On-disk extent: SE_LEN consecutive file blocks starting at
+ * SE_FILEBLOCK, stored in consecutive disk blocks starting at
+ * SE_DISKBLOCK.
+ */
+struct sfs_extent {
+	uint32_t se_fileblock;			/* First file block */
+	uint32_t se_diskblock;			/* Where it is on disk */
+	uint32_t se_len;			/* Number of blocks */
+};
+
+/* Number of extents in an inode */
+#define SFS_NEXTENTS 35
+
 /*
  * On-disk inode
+ *
+ * Block numbers are mapped by the direct blocks, then the indirect
+ * block (SFS_DBPERIDB blocks), then the double indirect block (that
+ * many indirect blocks), then the triple indirect block. Any of the
+ * pointers, at any level, may be 0 for a hole. The double and triple
+ * indirect pointers were taken from the space after sfi_flags, which
+ * older volumes have zeroed, so those read as having none.
+ *
+ * A file with SFS_IFLAG_EXTENTS set is mapped by sfi_extents instead,
+ * and all its block pointers are 0. The extents are sorted by file
+ * block, don't overlap, and are never empty; the list ends at the
+ * first entry whose se_len is 0. Blocks not covered by any extent
+ * are holes. A file whose blocks are too scattered to fit in the
+ * extents is converted back to the block pointers, and its
+ * sfi_extents are then all 0, as they are for any other inode.
  */
 struct sfs_dinode {
 	uint32_t sfi_size;			/* Size of this file (bytes) */
@@ -86,7 +119,12 @@ struct sfs_dinode {
 	uint16_t sfi_linkcount;			/* # hard links to this file */
 	uint32_t sfi_direct[SFS_NDIRECT];	/* Direct blocks */
 	uint32_t sfi_indirect;			/* Indirect block */
-	uint32_t sfi_waste[128-3-SFS_NDIRECT];	/* unused space, set to 0 */
+	uint32_t sfi_flags;			/* SFS_IFLAG_* flags */
+	uint32_t sfi_dindirect;			/* Double indirect block */
+	uint32_t sfi_tindirect;			/* Triple indirect block */
+	struct sfs_extent sfi_extents[SFS_NEXTENTS]; /* Extent map */
+	uint32_t sfi_waste[128-6-SFS_NDIRECT-3*SFS_NEXTENTS];
+						/* unused space, set to 0 */
 };
 
 /*
@@ -97,5 +135,38 @@ struct sfs_direntry {
 	char sfd_name[SFS_NAMELEN];		/* Filename */
 };
 
+/*
+ * Hashed directories
+ *
+ * A directory with SFS_IFLAG_DIRHASH set is a hash table with one
+ * bucket per block, so it has sfi_size / SFS_BLOCKSIZE buckets. All
+ * of its blocks are allocated. The first entry of each bucket is a
+ * header instead of a directory entry. Its first word is SFS_NOINO,
+ * so the directory still reads correctly as an ordinary one.
+ *
+ * A name goes in the first bucket with a free slot, probing upward
+ * (and wrapping around) from bucket hash(name) % nbuckets. Once an
+ * insertion has probed past a full bucket, that bucket's
+ * SFS_DIRHASH_OVERFLOW flag is set, and it stays set. A lookup can
+ * therefore stop at the first bucket without the flag.
+ *
+ * The hash is 32-bit FNV-1a over the bytes of the name, without the
+ * terminating null.
+ */
+#define SFS_DIRHASH_MAGIC     0x64686173  /* magic number for headers */
+#define SFS_DIRHASH_OVERFLOW  0x1         /* entries probed past here */
+#define SFS_DIRHASH_FNVBASIS  2166136261U /* FNV-1a initial value */
+#define SFS_DIRHASH_FNVPRIME  16777619U   /* FNV-1a multiplier */
+
+/*
+ * On-disk hashed directory bucket header
+ */
+struct sfs_dirhashhdr {
+	uint32_t sdh_ino;			/* Always SFS_NOINO */
+	uint32_t sdh_magic;			/* SFS_DIRHASH_MAGIC */
+	uint32_t sdh_flags;			/* SFS_DIRHASH_* flags */
+	char sdh_unused[SFS_NAMELEN-8];		/* unused space, set to 0 */
+};
+
 
 #endif /* _KERN_SFS_H_ */
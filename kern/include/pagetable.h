@@ -0,0 +1,82 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _PAGETABLE_H_
+#define _PAGETABLE_H_
+
+/*
+ * Per-address-space page tables.
+ *
+ * Two-level, like the hardware page tables on many machines: the top
+ * 10 bits of a user virtual address index a directory of pointers to
+ * second-level tables, and the next 10 bits index 1024 page table
+ * entries in the second-level table. Second-level tables are only
+ * allocated for parts of the address space that are actually used,
+ * so the usual layout (text and data at the bottom, stack at the
+ * top) costs three or four of them.
+ *
+ * A page table entry holds the physical address of the frame in its
+ * page-number bits plus flags in the low bits. An entry of 0 means
+ * the page has never been touched; it is created zero-filled on
+ * first fault. PTE_COW marks a page shared with another address
+ * space since fork: it is mapped read-only, and the first write to
+ * it makes a private copy (or, if the other sharers have gone away
+ * in the meantime, just clears the bit).
+ *
+ * A page that has been evicted has PTE_SWAPPED set instead of
+ * PTE_VALID, and holds its swap slot number where the page number
+ * would be.
+ *
+ * Page tables are protected by the VM paging lock.
+ */
+
+typedef uint32_t pte_t;
+
+#define PTE_VALID	0x00000001	/* resident in memory */
+#define PTE_COW		0x00000002	/* shared; copy before writing */
+#define PTE_SWAPPED	0x00000004	/* in swap (not resident) */
+
+#define PTE_MKSWAP(slot)	(((pte_t)(slot) << 12) | PTE_SWAPPED)
+#define PTE_SWAPSLOT(pte)	((pte) >> 12)
+
+#define PT_NDIR		1024		/* directory entries */
+#define PT_NENT		1024		/* entries per second-level table */
+#define PT_DIRINDEX(va)	((va) >> 22)
+#define PT_ENTINDEX(va)	(((va) >> 12) & (PT_NENT - 1))
+
+struct pagetable {
+	pte_t *pt_dir[PT_NDIR];
+};
+
+struct pagetable *pt_create(void);
+void pt_destroy(struct pagetable *pt);
+pte_t *pt_lookup(struct pagetable *pt, vaddr_t va, bool create);
+int pt_share(struct pagetable *old, struct pagetable *new);
+
+#endif /* _PAGETABLE_H_ */
@@ -37,9 +37,9 @@
  */
 
 #include <spinlock.h>
-#include <file.h>
 
 struct addrspace;
+struct fd_table;
 struct thread;
 struct vnode;
 
@@ -64,13 +64,13 @@ struct proc {
 	char *p_name;			/* Name of this process */
 	struct spinlock p_lock;		/* Lock for this structure */
 	unsigned p_numthreads;		/* Number of threads in this process */
-	struct fd_table *fd_tbl;
 
 	/* VM */
 	struct addrspace *p_addrspace;	/* virtual address space */
 
 	/* VFS */
 	struct vnode *p_cwd;		/* current working directory */
+	struct fd_table *p_fdtable;	/* file descriptors */
 
 	/* add more material here as needed */
 };
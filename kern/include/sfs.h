@@ -48,6 +48,42 @@
  */
 #include <kern/sfs.h>
 
+struct lock;		/* from <synch.h> */
+struct sfs_bufcache;	/* buffer cache (private to sfs_buf.c) */
+struct sfs_syncer;	/* syncer thread control (private to sfs_fsops.c) */
+struct sfs_rahead;	/* readahead thread control (private to sfs_rahead.c) */
+
+/*
+ * Locking. SFS does not use the vfs big lock; instead:
+ *
+ *    sv_lock          protects a vnode's inode (sv_i, sv_dirty) and
+ *                     therefore its block map and, for directories,
+ *                     its entries.
+ *    sfs_vnlock       protects the table of loaded vnodes, including
+ *                     the LRU list of unreferenced ones.
+ *    sfs_freemaplock  protects the free block bitmap, the
+ *                     superblock, and the reservation windows.
+ *
+ * The lock order is: the directory's sv_lock, sfs_vnlock, a file's
+ * sv_lock, sfs_freemaplock or the readahead queue lock, and then the
+ * buffer cache's own lock.
+ * sfs_reclaim takes sv_lock while holding sfs_vnlock; this is safe
+ * because it only does so once it knows nobody else has the vnode.
+ */
+
+/*
+ * Block reservation window (see sfs_balloc.c). The free blocks in
+ * [r_start, r_end) are set aside for one file's next allocations, and
+ * other allocations go around them. Windows exist only in memory.
+ * r_last is the block most recently allocated to the file.
+ */
+struct sfs_rsv {
+	daddr_t r_start;		/* first block of window */
+	daddr_t r_end;			/* end of window; == r_start if none */
+	daddr_t r_last;			/* last block allocated, or 0 */
+	struct sfs_rsv *r_next;		/* next in sfs_rsvlist */
+};
+
 /*
  * In-memory inode
  */
@@ -56,8 +92,20 @@ struct sfs_vnode {
 	struct sfs_dinode sv_i;		/* copy of on-disk inode */
 	uint32_t sv_ino;                /* inode number */
 	bool sv_dirty;                  /* true if sv_i modified */
+	struct lock *sv_lock;           /* protects sv_i, sv_dirty, sv_ra* */
+	uint32_t sv_ranext;             /* block a sequential read would hit */
+	uint32_t sv_rawindow;           /* current readahead window */
+	uint32_t sv_raend;              /* first block not yet read ahead */
+	struct sfs_rsv sv_rsv;          /* reservation window */
+	struct sfs_vnode *sv_hashnext;  /* next in vnode table hash chain */
+	struct sfs_vnode *sv_lruprev;   /* LRU list of unreferenced vnodes */
+	struct sfs_vnode *sv_lrunext;
+	bool sv_cached;                 /* true if refcount 0 and on LRU */
 };
 
+/* Number of hash chains in the vnode table (must be a power of 2) */
+#define SFS_VNHASH	128
+
 /*
  * In-memory info for a whole fs volume
  */
@@ -66,9 +114,19 @@ struct sfs_fs {
 	struct sfs_superblock sfs_sb;	/* copy of on-disk superblock */
 	bool sfs_superdirty;            /* true if superblock modified */
 	struct device *sfs_device;      /* device mounted on */
-	struct vnodearray *sfs_vnodes;  /* vnodes loaded into memory */
+	struct lock *sfs_vnlock;        /* protects the sfs_vn* fields */
+	struct sfs_vnode *sfs_vnhash[SFS_VNHASH]; /* loaded vnodes by ino */
+	unsigned sfs_nvnodes;           /* number of vnodes loaded */
+	struct sfs_vnode *sfs_vnlruhead;/* least recently used cached vnode */
+	struct sfs_vnode *sfs_vnlrutail;/* most recently used cached vnode */
+	unsigned sfs_nvncached;         /* number of vnodes on the LRU */
+	struct lock *sfs_freemaplock;   /* protects freemap and superblock */
 	struct bitmap *sfs_freemap;     /* blocks in use are marked 1 */
 	bool sfs_freemapdirty;          /* true if freemap modified */
+	struct sfs_rsv *sfs_rsvlist;    /* open reservation windows */
+	struct sfs_bufcache *sfs_cache; /* block buffer cache */
+	struct sfs_syncer *sfs_syncer;  /* background syncer thread */
+	struct sfs_rahead *sfs_rahead;  /* readahead thread */
 };
 
 /*
@@ -76,5 +134,28 @@ struct sfs_fs {
  */
 int sfs_mount(const char *device);
 
+/*
+ * Print buffer cache statistics (for the kernel menu)
+ */
+void sfs_bufstats(void);
+
+/*
+ * Seconds between background syncs of dirty blocks and inodes
+ * (0 = never). Settable from the kernel menu.
+ */
+extern unsigned sfs_syncinterval;
+
+/*
+ * Maximum number of blocks to read ahead of a sequential reader
+ * (0 = no readahead). Settable from the kernel menu.
+ */
+extern unsigned sfs_ramax;
+
+/*
+ * Whether new regular files are mapped by extents instead of block
+ * pointers. Settable from the kernel menu.
+ */
+extern bool sfs_extents;
+
 
 #endif /* _SFS_H_ */
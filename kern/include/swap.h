@@ -0,0 +1,65 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _SWAP_H_
+#define _SWAP_H_
+
+/*
+ * Swap space.
+ *
+ * Swap is a raw disk device (e.g. lhd1raw:) attached with swap_attach
+ * and divided into page-sized slots. Free slots are tracked with a
+ * bitmap. A slot can be referred to by more than one page table after
+ * fork, and also by the resident frame whose contents it holds, so
+ * slots are reference counted and only returned to the bitmap when
+ * the last reference is dropped.
+ *
+ * Functions:
+ *     swap_attach   - use device DEVNAME for swap.
+ *     swap_alloc    - allocate a slot; ENOSPC if there's none (or no
+ *                     swap at all).
+ *     swap_incref   - add a reference to a slot.
+ *     swap_free     - drop a reference to a slot.
+ *     swap_read     - read a slot into the physical page PA.
+ *     swap_write    - write the physical page PA into a slot.
+ *     swap_stats    - print usage and I/O counts.
+ *
+ * Other than swap_attach and swap_stats these are called with the
+ * VM paging lock held.
+ */
+
+int swap_attach(const char *devname);
+int swap_alloc(unsigned *ret);
+void swap_incref(unsigned slot);
+void swap_free(unsigned slot);
+int swap_read(unsigned slot, paddr_t pa);
+int swap_write(unsigned slot, paddr_t pa);
+void swap_stats(void);
+
+#endif /* _SWAP_H_ */
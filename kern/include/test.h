@@ -44,6 +44,7 @@
 int arraytest(int, char **);
 int arraytest2(int, char **);
 int bitmaptest(int, char **);
+int bitmapbench(int, char **);
 int threadlisttest(int, char **);
 
 /* thread tests */
@@ -86,6 +87,7 @@ int writestress(int, char **);
 int writestress2(int, char **);
 int longstress(int, char **);
 int createstress(int, char **);
+int scalestress(int, char **);
 int printfile(int, char **);
 
 /* other tests */
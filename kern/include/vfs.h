@@ -183,6 +183,38 @@ int vfs_swapon(const char *devname, struct vnode **result);
 int vfs_swapoff(const char *devname);
 int vfs_unmountall(void);
 
+/*
+ * Name cache (vfscache.c). Used by filesystems to remember the
+ * results of directory lookups; see vfscache.c for the rules.
+ *
+ *    vfs_nc_bootstrap - Call during system initialization.
+ *
+ *    vfs_nc_lookup - Look up NAME in DIR. Returns false on a cache
+ *                    miss; otherwise sets *RESULT to the vnode
+ *                    (incref'd) or NULL if the name doesn't exist.
+ *
+ *    vfs_nc_enter  - Record that NAME in DIR is VN, or doesn't exist
+ *                    if VN is NULL.
+ *
+ *    vfs_nc_remove - Forget NAME in DIR. Call whenever the name is
+ *                    created, linked, removed, or renamed.
+ *
+ *    vfs_nc_purge  - Forget everything referring to VN (e.g. rmdir).
+ *
+ *    vfs_nc_purgefs - Forget everything on FS (before unmounting).
+ *
+ *    vfs_nc_stats  - Print hit-rate statistics.
+ */
+
+void vfs_nc_bootstrap(void);
+bool vfs_nc_lookup(struct vnode *dir, const char *name,
+		   struct vnode **result);
+void vfs_nc_enter(struct vnode *dir, const char *name, struct vnode *vn);
+void vfs_nc_remove(struct vnode *dir, const char *name);
+void vfs_nc_purge(struct vnode *vn);
+void vfs_nc_purgefs(struct fs *fs);
+void vfs_nc_stats(void);
+
 /*
  * Array of vnodes.
  */
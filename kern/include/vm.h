@@ -39,6 +39,8 @@
 
 #include <machine/vm.h>
 
+struct addrspace;
+
 /* Fault-type arguments to vm_fault() */
 #define VM_FAULT_READ        0    /* A read was attempted */
 #define VM_FAULT_WRITE       1    /* A write was attempted */
@@ -58,5 +60,53 @@ void free_kpages(vaddr_t addr);
 /* TLB shootdown handling called from interprocessor_interrupt */
 void vm_tlbshootdown(const struct tlbshootdown *);
 
+/*
+ * Machine-dependent TLB management, used by the machine-independent
+ * VM code.
+ *
+ *     vm_tlb_bootstrap  - set up for shootdowns; called once.
+ *     vm_tlb_load       - map VADDR to PADDR in this CPU's TLB,
+ *                         replacing any existing mapping for VADDR.
+ *     vm_tlb_invalidate - drop any mapping for VADDR from this CPU's TLB.
+ *     vm_tlb_flush      - drop all mappings from this CPU's TLB.
+ *
+ *     vm_tlb_shootdown  - drop any mapping for VADDR in address space
+ *                         AS from every CPU's TLB.
+ *     vm_tlb_shootdown_all - drop all mappings for AS (or, if AS is
+ *                         NULL, every address space) from every
+ *                         CPU's TLB.
+ *
+ * The shootdown functions change this CPU's TLB right away, then
+ * sleep until every other CPU that had the address space loaded has
+ * done so too; after they return, nobody can still be using the old
+ * mapping. The caller must hold the paging lock (and no spinlocks).
+ */
+void vm_tlb_bootstrap(void);
+void vm_tlb_load(vaddr_t vaddr, paddr_t paddr, bool writable);
+void vm_tlb_invalidate(vaddr_t vaddr);
+void vm_tlb_flush(void);
+void vm_tlb_shootdown(struct addrspace *as, vaddr_t vaddr);
+void vm_tlb_shootdown_all(struct addrspace *as);
+
+/*
+ * The paging lock. Every page table, and the state of every user page
+ * in the coremap, is protected by this one lock; it's held while
+ * handling faults. A single lock means evicting a page can update
+ * the page table of whichever address space owns it without any
+ * lock ordering problems.
+ */
+void vm_pagelock_acquire(void);
+void vm_pagelock_release(void);
+bool vm_pagelock_held(void);
+
+/* Print paging statistics, for the kernel menu */
+void vm_printstats(void);
+
+/*
+ * Size of the user stack region. Stack pages are allocated on first
+ * touch, so this only costs anything if it's used.
+ */
+#define VM_STACKPAGES    1024
+
 
 #endif /* _VM_H_ */
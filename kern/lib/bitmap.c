@@ -47,6 +47,24 @@
 #define WORD_TYPE       unsigned char
 #define WORD_ALLBITS    (0xff)
 
+/*
+ * Searching and counting work on 32-bit chunks instead. A chunk is
+ * put together from four bytes, so that bit i of chunk cx is always
+ * bit 32*cx+i of the map whatever the byte order. Whether a chunk is
+ * all ones or all zeros, and how many bits it has set, doesn't depend
+ * on byte order, so those questions are answered by loading the four
+ * bytes as one uint32_t; runs of full or empty chunks are skipped
+ * that way.
+ *
+ * The array is padded to a whole number of chunks (kmalloc aligns it
+ * suitably), and bits past nbits are kept set, so a search for a
+ * clear bit never needs to check for the end. Searches for set bits
+ * and counts stop at nbits.
+ */
+#define CHUNK_BITS      32
+#define CHUNK_BYTES     (CHUNK_BITS / BITS_PER_WORD)
+#define CHUNK_ALLBITS   (0xffffffffU)
+
 struct bitmap {
         unsigned nbits;
         WORD_TYPE *v;
@@ -57,9 +75,9 @@ struct bitmap *
 bitmap_create(unsigned nbits)
 {
         struct bitmap *b;
-        unsigned words;
+        unsigned words, j;
 
-        words = DIVROUNDUP(nbits, BITS_PER_WORD);
+        words = DIVROUNDUP(nbits, CHUNK_BITS) * CHUNK_BYTES;
         b = kmalloc(sizeof(struct bitmap));
         if (b == NULL) {
                 return NULL;
@@ -74,16 +92,9 @@ bitmap_create(unsigned nbits)
         b->nbits = nbits;
 
         /* Mark any leftover bits at the end in use */
-        if (words > nbits / BITS_PER_WORD) {
-                unsigned j, ix = words-1;
-                unsigned overbits = nbits - ix*BITS_PER_WORD;
-
-                KASSERT(nbits / BITS_PER_WORD == words-1);
-                KASSERT(overbits > 0 && overbits < BITS_PER_WORD);
-
-                for (j=overbits; j<BITS_PER_WORD; j++) {
-                        b->v[ix] |= ((WORD_TYPE)1 << j);
-                }
+        for (j=nbits; j<words*BITS_PER_WORD; j++) {
+                b->v[j / BITS_PER_WORD] |=
+                        ((WORD_TYPE)1 << (j % BITS_PER_WORD));
         }
 
         return b;
@@ -95,29 +106,204 @@ bitmap_getdata(struct bitmap *b)
         return b->v;
 }
 
+/*
+ * Chunk CX, with bits in order.
+ */
+static
+inline
+uint32_t
+bitmap_chunk(const struct bitmap *b, unsigned cx)
+{
+        const WORD_TYPE *p = &b->v[cx * CHUNK_BYTES];
+
+        return (uint32_t)p[0] | ((uint32_t)p[1] << 8) |
+                ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+/*
+ * Chunk CX, in whatever order the bytes come in.
+ */
+static
+inline
+uint32_t
+bitmap_rawchunk(const struct bitmap *b, unsigned cx)
+{
+        return *(const uint32_t *)&b->v[cx * CHUNK_BYTES];
+}
+
+/*
+ * Number of bits set in X.
+ */
+static
+inline
+unsigned
+bitmap_popcount32(uint32_t x)
+{
+        x = x - ((x >> 1) & 0x55555555);
+        x = (x & 0x33333333) + ((x >> 2) & 0x33333333);
+        x = (x + (x >> 4)) & 0x0f0f0f0f;
+        return (x * 0x01010101) >> 24;
+}
+
+/*
+ * Index of the lowest set bit in X, which must not be 0. Isolate the
+ * bit with x & -x, then look it up with a de Bruijn multiply, which
+ * avoids needing a count-trailing-zeros instruction.
+ */
+unsigned
+bitmap_ctz32(uint32_t x)
+{
+        static const unsigned char debruijn[32] = {
+                0, 1, 28, 2, 29, 14, 24, 3, 30, 22, 20, 15, 25, 17, 4, 8,
+                31, 27, 13, 23, 21, 19, 16, 7, 26, 12, 18, 6, 11, 5, 10, 9,
+        };
+
+        KASSERT(x != 0);
+        return debruijn[(uint32_t)((x & -x) * 0x077cb531U) >> 27];
+}
+
+/*
+ * Find the first bit at or after START that is set (if WANTSET) or
+ * clear. Flipping the chunks we're not interested in makes both
+ * cases a search for a 1.
+ */
+static
+int
+bitmap_find(const struct bitmap *b, unsigned start, bool wantset,
+            unsigned *index)
+{
+        unsigned nchunks = DIVROUNDUP(b->nbits, CHUNK_BITS);
+        uint32_t flip = wantset ? 0 : CHUNK_ALLBITS;
+        unsigned cx;
+        uint32_t c;
+
+        if (start >= b->nbits) {
+                return ENOENT;
+        }
+
+        /* Ignore the bits before START in its chunk */
+        cx = start / CHUNK_BITS;
+        c = (bitmap_chunk(b, cx) ^ flip) &
+                (CHUNK_ALLBITS << (start % CHUNK_BITS));
+
+        while (c == 0) {
+                cx++;
+                while (cx < nchunks && bitmap_rawchunk(b, cx) == flip) {
+                        cx++;
+                }
+                if (cx >= nchunks) {
+                        return ENOENT;
+                }
+                c = bitmap_chunk(b, cx) ^ flip;
+        }
+
+        *index = cx * CHUNK_BITS + bitmap_ctz32(c);
+        if (*index >= b->nbits) {
+                /* Only possible for set bits; see above */
+                KASSERT(wantset);
+                return ENOENT;
+        }
+        return 0;
+}
+
+int
+bitmap_nextset(struct bitmap *b, unsigned start, unsigned *index)
+{
+        return bitmap_find(b, start, true, index);
+}
+
+int
+bitmap_nextclear(struct bitmap *b, unsigned start, unsigned *index)
+{
+        return bitmap_find(b, start, false, index) ? ENOSPC : 0;
+}
+
+/*
+ * Find a run of N clear bits at or after START: find a clear bit,
+ * then the next set bit, and see if they're far enough apart.
+ */
+int
+bitmap_findrun(struct bitmap *b, unsigned start, unsigned n, unsigned *index)
+{
+        unsigned first, end;
+
+        KASSERT(n > 0);
+
+        while (1) {
+                if (bitmap_find(b, start, false, &first)) {
+                        return ENOSPC;
+                }
+                if (bitmap_find(b, first, true, &end)) {
+                        end = b->nbits;
+                }
+                if (end - first >= n) {
+                        *index = first;
+                        return 0;
+                }
+                if (end >= b->nbits) {
+                        return ENOSPC;
+                }
+                start = end;
+        }
+}
+
+int
+bitmap_alloc_hint(struct bitmap *b, unsigned hint, unsigned *index)
+{
+        if (bitmap_find(b, hint, false, index) &&
+            bitmap_find(b, 0, false, index)) {
+                return ENOSPC;
+        }
+        bitmap_mark(b, *index);
+        return 0;
+}
+
 int
 bitmap_alloc(struct bitmap *b, unsigned *index)
 {
-        unsigned ix;
-        unsigned maxix = DIVROUNDUP(b->nbits, BITS_PER_WORD);
-        unsigned offset;
+        return bitmap_alloc_hint(b, 0, index);
+}
+
+/*
+ * Count the bits set in [START, END). The chunks at the ends are
+ * masked; the ones in between are counted whole.
+ */
+unsigned
+bitmap_count(struct bitmap *b, unsigned start, unsigned end)
+{
+        unsigned cx, firstcx, lastcx, total;
+        uint32_t c, raw;
+
+        KASSERT(start <= end && end <= b->nbits);
 
-        for (ix=0; ix<maxix; ix++) {
-                if (b->v[ix]!=WORD_ALLBITS) {
-                        for (offset = 0; offset < BITS_PER_WORD; offset++) {
-                                WORD_TYPE mask = ((WORD_TYPE)1) << offset;
-
-                                if ((b->v[ix] & mask)==0) {
-                                        b->v[ix] |= mask;
-                                        *index = (ix*BITS_PER_WORD)+offset;
-                                        KASSERT(*index < b->nbits);
-                                        return 0;
-                                }
+        if (start == end) {
+                return 0;
+        }
+        firstcx = start / CHUNK_BITS;
+        lastcx = (end - 1) / CHUNK_BITS;
+
+        total = 0;
+        for (cx = firstcx; cx <= lastcx; cx++) {
+                if (cx == firstcx || cx == lastcx) {
+                        c = bitmap_chunk(b, cx);
+                        if (cx == firstcx) {
+                                c &= CHUNK_ALLBITS << (start % CHUNK_BITS);
+                        }
+                        if (cx == lastcx && end % CHUNK_BITS != 0) {
+                                c &= ~(CHUNK_ALLBITS << (end % CHUNK_BITS));
                         }
-                        KASSERT(0);
+                        total += bitmap_popcount32(c);
+                        continue;
+                }
+                raw = bitmap_rawchunk(b, cx);
+                if (raw == CHUNK_ALLBITS) {
+                        total += CHUNK_BITS;
+                }
+                else if (raw != 0) {
+                        total += bitmap_popcount32(raw);
                 }
         }
-        return ENOSPC;
+        return total;
 }
 
 static
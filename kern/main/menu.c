@@ -40,11 +40,14 @@
 #include <thread.h>
 #include <proc.h>
 #include <vfs.h>
+#include <vm.h>
+#include <swap.h>
 #include <sfs.h>
 #include <syscall.h>
 #include <test.h>
 #include "opt-sfs.h"
 #include "opt-net.h"
+#include "opt-dumbvm.h"
 
 /*
  * In-kernel menu and command dispatcher.
@@ -239,6 +242,71 @@ cmd_sync(int nargs, char **args)
 	return 0;
 }
 
+#if OPT_SFS
+/*
+ * Command for showing or setting the SFS syncer interval.
+ */
+static
+int
+cmd_syncint(int nargs, char **args)
+{
+	if (nargs == 2) {
+		sfs_syncinterval = atoi(args[1]);
+	}
+	else if (nargs != 1) {
+		kprintf("Usage: syncint [seconds]\n");
+		return EINVAL;
+	}
+
+	kprintf("SFS syncer interval: %u seconds%s\n", sfs_syncinterval,
+		sfs_syncinterval == 0 ? " (disabled)" : "");
+
+	return 0;
+}
+
+/*
+ * Command for showing or setting the SFS readahead window.
+ */
+static
+int
+cmd_rahead(int nargs, char **args)
+{
+	if (nargs == 2) {
+		sfs_ramax = atoi(args[1]);
+	}
+	else if (nargs != 1) {
+		kprintf("Usage: ra [blocks]\n");
+		return EINVAL;
+	}
+
+	kprintf("SFS readahead window: %u blocks%s\n", sfs_ramax,
+		sfs_ramax == 0 ? " (disabled)" : "");
+
+	return 0;
+}
+
+/*
+ * Command for showing or setting whether new SFS files use extents.
+ */
+static
+int
+cmd_extents(int nargs, char **args)
+{
+	if (nargs == 2) {
+		sfs_extents = atoi(args[1]) != 0;
+	}
+	else if (nargs != 1) {
+		kprintf("Usage: extents [0|1]\n");
+		return EINVAL;
+	}
+
+	kprintf("SFS extents for new files: %s\n",
+		sfs_extents ? "on" : "off");
+
+	return 0;
+}
+#endif
+
 /*
  * Command for dropping to the debugger.
  */
@@ -453,6 +521,32 @@ cmd_bootfs(int nargs, char **args)
 	return vfs_setbootfs(device);
 }
 
+#if !OPT_DUMBVM
+/*
+ * Command for attaching a swap device.
+ */
+static
+int
+cmd_swapon(int nargs, char **args)
+{
+	char *device;
+
+	if (nargs != 2) {
+		kprintf("Usage: swapon device\n");
+		return EINVAL;
+	}
+
+	device = args[1];
+
+	/* Allow (but do not require) colon after device name */
+	if (device[strlen(device)-1]==':') {
+		device[strlen(device)-1] = 0;
+	}
+
+	return swap_attach(device);
+}
+#endif
+
 static
 int
 cmd_kheapstats(int nargs, char **args)
@@ -494,6 +588,46 @@ cmd_kheapdump(int nargs, char **args)
 	return 0;
 }
 
+static
+int
+cmd_ncstats(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	vfs_nc_stats();
+
+	return 0;
+}
+
+#if !OPT_DUMBVM
+static
+int
+cmd_vmstats(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	vm_printstats();
+
+	return 0;
+}
+#endif
+
+#if OPT_SFS
+static
+int
+cmd_sfsbufstats(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	sfs_bufstats();
+
+	return 0;
+}
+#endif
+
 ////////////////////////////////////////
 //
 // Menus.
@@ -533,6 +667,14 @@ static const char *opsmenu[] = {
 	"[cd]      Change directory          ",
 	"[pwd]     Print current directory   ",
 	"[sync]    Sync filesystems          ",
+#if !OPT_DUMBVM
+	"[swapon]  Attach swap device        ",
+#endif
+#if OPT_SFS
+	"[syncint] Set SFS syncer interval   ",
+	"[ra]      Set SFS readahead window  ",
+	"[extents] Set SFS extent mapping    ",
+#endif
 	"[debug]   Drop to debugger          ",
 	"[panic]   Intentional panic         ",
 	"[deadlock] Intentional deadlock     ",
@@ -555,6 +697,7 @@ static const char *testmenu[] = {
 	"[at]  Array test                    ",
 	"[at2] Large array test              ",
 	"[bt]  Bitmap test                   ",
+	"[bb]  Bitmap benchmark              ",
 	"[tlt] Threadlist test               ",
 	"[km1] Kernel malloc test            ",
 	"[km2] kmalloc stress test           ",
@@ -577,6 +720,7 @@ static const char *testmenu[] = {
 	"[fs4] FS write stress 2             ",
 	"[fs5] FS long stress                ",
 	"[fs6] FS create stress              ",
+	"[fs7] FS scaling (vs. threads)      ",
 	NULL
 };
 
@@ -599,6 +743,13 @@ static const char *mainmenu[] = {
 	"[kh] Kernel heap stats              ",
 	"[khgen] Next kernel heap generation ",
 	"[khdump] Dump kernel heap           ",
+	"[nc] Name cache stats               ",
+#if !OPT_DUMBVM
+	"[vm] Paging stats                   ",
+#endif
+#if OPT_SFS
+	"[bc] SFS buffer cache stats         ",
+#endif
 	"[q] Quit and shut down              ",
 	NULL
 };
@@ -639,6 +790,14 @@ static struct {
 	{ "cd",		cmd_chdir },
 	{ "pwd",	cmd_pwd },
 	{ "sync",	cmd_sync },
+#if !OPT_DUMBVM
+	{ "swapon",	cmd_swapon },
+#endif
+#if OPT_SFS
+	{ "syncint",	cmd_syncint },
+	{ "ra",		cmd_rahead },
+	{ "extents",	cmd_extents },
+#endif
 	{ "debug",	cmd_debug },
 	{ "panic",	cmd_panic },
 	{ "deadlock",	cmd_deadlock },
@@ -650,11 +809,19 @@ static struct {
 	{ "kh",         cmd_kheapstats },
 	{ "khgen",      cmd_kheapgeneration },
 	{ "khdump",     cmd_kheapdump },
+	{ "nc",         cmd_ncstats },
+#if !OPT_DUMBVM
+	{ "vm",         cmd_vmstats },
+#endif
+#if OPT_SFS
+	{ "bc",         cmd_sfsbufstats },
+#endif
 
 	/* base system tests */
 	{ "at",		arraytest },
 	{ "at2",	arraytest2 },
 	{ "bt",		bitmaptest },
+	{ "bb",		bitmapbench },
 	{ "tlt",	threadlisttest },
 	{ "km1",	kmalloctest },
 	{ "km2",	kmallocstress },
@@ -704,6 +871,7 @@ static struct {
 	{ "fs4",	writestress2 },
 	{ "fs5",	longstress },
 	{ "fs6",	createstress },
+	{ "fs7",	scalestress },
 
 	{ NULL, NULL }
 };
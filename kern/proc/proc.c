@@ -48,6 +48,7 @@
 #include <current.h>
 #include <addrspace.h>
 #include <vnode.h>
+#include <file.h>
 
 /*
  * The process for the kernel; this holds all the kernel-only threads.
@@ -81,6 +82,7 @@ proc_create(const char *name)
 
 	/* VFS fields */
 	proc->p_cwd = NULL;
+	proc->p_fdtable = NULL;
 
 	return proc;
 }
@@ -112,6 +114,10 @@ proc_destroy(struct proc *proc)
 	 */
 
 	/* VFS fields */
+	if (proc->p_fdtable) {
+		fd_table_destroy(proc->p_fdtable);
+		proc->p_fdtable = NULL;
+	}
 	if (proc->p_cwd) {
 		VOP_DECREF(proc->p_cwd);
 		proc->p_cwd = NULL;
@@ -206,6 +212,12 @@ proc_create_runprogram(const char *name)
 
 	/* VFS fields */
 
+	newproc->p_fdtable = fd_table_create();
+	if (newproc->p_fdtable == NULL) {
+		proc_destroy(newproc);
+		return NULL;
+	}
+
 	/*
 	 * Lock the current process to copy its current directory.
 	 * (We don't need to lock the new process, though, as we have
@@ -1,588 +1,857 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * File handles, descriptor tables, and the file system calls.
+ */
+
 #include <types.h>
 #include <kern/errno.h>
 #include <kern/fcntl.h>
+#include <kern/iovec.h>
 #include <kern/limits.h>
 #include <kern/stat.h>
 #include <kern/seek.h>
 #include <lib.h>
+#include <bitmap.h>
 #include <uio.h>
-#include <thread.h>
-#include <current.h>
-#include <synch.h>
+#include <vm.h>
+#include <wchan.h>
 #include <vfs.h>
 #include <vnode.h>
-#include <file.h>
-#include <syscall.h>
 #include <copyinout.h>
+#include <current.h>
 #include <proc.h>
+#include <file.h>
+
+/* Initial number of descriptor slots in a new table. */
+#define FD_TABLE_INITSIZE	32
+
+/* Descriptor bitmap words. */
+#define FD_WORD_BITS		32
+#define FD_WORD_ALLBITS		0xffffffffU
+#define FD_WORDS(n)		DIVROUNDUP(n, FD_WORD_BITS)
+
+/* Largest transfer whose byte count fits in a (32-bit) return value. */
+#define FILE_MAXIO		0x7fffffffU
+
+/* Number of iovecs readv/writev can handle without allocating. */
+#define FILE_STACKIOV		8
+
+/* Size of each chunk of open file objects allocated for the pool. */
+#define OPENFILE_SLABSIZE	PAGE_SIZE
+#define OPENFILE_PERSLAB	(OPENFILE_SLABSIZE / sizeof(struct openfile))
 
-//#define OPEN_MAX2 OPEN_MAX 
-#define OPEN_MAX2 10 // for debug
-#define IS_DEBUG_FILEDESCRIPTOR 0 // 1 to enable show_of_table() and show_fd_table(). 
-#define DEBUG_MODE 1 // several printf for err
 /*
- * Add your file-related functions here ...
+ * Pool of free open file objects.
+ *
+ * Open file objects are carved out of page-sized slabs and recycled
+ * through a free list, so opening and closing files doesn't churn
+ * the small-object allocator. The slabs are never given back; the
+ * pool only grows to the peak number of files open at once.
  */
- 
-int queue_pop(int *queue, int *front, int *size); // return 0 if non-empty, -1 else
-int queue_front(int *queue, int front, int size); // return queue[front] if non-empty, -1 else
-int queue_push(int *queue, int *end, int *size, int element); // return 0 if not full, -1 else
-int get_of_table_free_slot(struct of_table *table);
-int get_fd_table_free_slot(struct fd_table *table);
-int push_of_empty_free_slot(struct of_table *table, int element);
-int push_fd_empty_free_slot(struct fd_table *table, int element);
-
-
-int sys_open(const char *filename, int flags, mode_t mode){
-    /* if filename is null return error */
-    if (filename == NULL){
-        return ENOENT; //return not a dir error
-    }
-
-    struct vnode *v;
-    /* copy filename */
-    char *filename_copy = kmalloc((strlen(filename) + 5) * sizeof(char));
-    strcpy(filename_copy, filename);
-     
-    /* check whether current of is full of not */
-    int of_free_slot = get_of_table_free_slot(cur_of_table);// get free slot from the queue
-    if (of_free_slot == -1){
-        return ENFILE; // of_table is full. should return too many files error
-    }
-
-    /* check whether current fd is full of not */
-    int fd_free_slot = get_fd_table_free_slot(curproc->fd_tbl); // get free slot from the queue
-    if (fd_free_slot == -1){
-        return EMFILE; // fd_table is full
-    };
-
-    /* create the lock */
-    cur_of_table->op_lock[of_free_slot] = lock_create(filename_copy);
-    /* check the lock status */
-    if (cur_of_table->op_lock[of_free_slot]== NULL) {
-        kprintf("lock fail to be created.\n");
-        return ENOMEM;
-    }
-    
-    /*open the vnode*/
-    int result = vfs_open(filename_copy,flags,mode,&v);
-    kfree(filename_copy);
-    if (IS_DEBUG_FILEDESCRIPTOR){
-        kprintf("\n\n-----------------opening %s: -------------------\n", filename);
-    }
-    if (result) {
-        if (DEBUG_MODE) kprintf("vfs open failed: filename = %s\nflag = %d, mode = %u, error = %d", filename, flags, mode, result);
-        lock_destroy(cur_of_table->op_lock[of_free_slot]);
-        return result;
-    }
-    //kprintf("I am still alive\n");
-
-    /* update of table */
-    cur_of_table->fp[of_free_slot] = 0;
-    cur_of_table->v_ptr[of_free_slot] = v;
-    cur_of_table->availability[of_free_slot] = OCCUPIED;
-    cur_of_table->refcount[of_free_slot] = 1;
-    cur_of_table->flags[of_free_slot] = flags;
-    /* update fd table */
-    curproc->fd_tbl->of_ptr[fd_free_slot] = of_free_slot;
-    curproc->fd_tbl->availability[fd_free_slot] = OCCUPIED;
-
-    if (IS_DEBUG_FILEDESCRIPTOR) show_of_table(); // debug code: show the status of of_table
-    if (IS_DEBUG_FILEDESCRIPTOR) show_fd_table(); // debug code: show the status of fd_table
-
-    return fd_free_slot;   
+static struct spinlock openfile_poollock = SPINLOCK_INITIALIZER;
+static struct openfile *openfile_freelist;
+
+////////////////////////////////////////////////////////////
+// open file objects
+
+/*
+ * Add a fresh slab to the pool.
+ */
+static
+int
+openfile_growpool(void)
+{
+	struct openfile *slab;
+	unsigned i;
+
+	slab = kmalloc(OPENFILE_SLABSIZE);
+	if (slab == NULL) {
+		return ENOMEM;
+	}
+	for (i=0; i<OPENFILE_PERSLAB; i++) {
+		spinlock_init(&slab[i].of_spinlock);
+		slab[i].of_busy = false;
+		slab[i].of_wchan = NULL;
+		slab[i].of_next = (i+1 < OPENFILE_PERSLAB) ? &slab[i+1] : NULL;
+	}
+
+	spinlock_acquire(&openfile_poollock);
+	slab[OPENFILE_PERSLAB-1].of_next = openfile_freelist;
+	openfile_freelist = &slab[0];
+	spinlock_release(&openfile_poollock);
+	return 0;
 }
 
+/*
+ * Take an object from the pool.
+ */
+static
+struct openfile *
+openfile_get(void)
+{
+	struct openfile *of;
+
+	spinlock_acquire(&openfile_poollock);
+	while (openfile_freelist == NULL) {
+		spinlock_release(&openfile_poollock);
+		if (openfile_growpool()) {
+			return NULL;
+		}
+		spinlock_acquire(&openfile_poollock);
+	}
+	of = openfile_freelist;
+	openfile_freelist = of->of_next;
+	spinlock_release(&openfile_poollock);
+
+	of->of_next = NULL;
+	return of;
+}
 
-int sys_read(int filehandle, void *buf, size_t size, int *err){
-    /*return value*/
-    int result = 0;
-
-    /* check availability of filehandle*/
-    if (curproc->fd_tbl->availability[filehandle] == FREE){
-        if (DEBUG_MODE) kprintf("can't read fd = %d : this fd is free\n", filehandle);
-        *err = EBADF;
-        return -1;
-    }
-    
-
-    /* check whether buffer is available */
-    if (buf == NULL){
-        if (DEBUG_MODE) kprintf("the buffer is not available or the size is not available\n");
-        *err = EFAULT;
-        return -1;
-    }
-    /* check availability of open file entry */
-    int of_index = curproc->fd_tbl->of_ptr[filehandle];
-    if (cur_of_table->availability[of_index] == FREE){
-        if (DEBUG_MODE) kprintf("can't read of = %d : this of is free\n", of_index);
-        *err = EBADF;
-        return -1;
-    }
-
-    /* check mode */
-    struct stat cur_file_stat;
-    /* get the stat of current file first */
-    result = VOP_STAT(cur_of_table->v_ptr[of_index],&cur_file_stat);
-    if (result){
-        *err = result;
-        return -1;
-    }
-    int how = cur_file_stat.st_mode&O_ACCMODE;
-    switch(how){
-        case O_RDONLY:
-        case O_RDWR:
-        break;
-        default:
-        *err = EBADF;
-        return -1;
-    }
-
-    struct iovec *iov = kmalloc(sizeof(struct iovec));
-    struct uio *u = kmalloc(sizeof(struct uio));
-
-    uio_kinit(iov, u, buf, size, cur_of_table->fp[of_index],UIO_READ);
-
-    /* acquire lock before read the file */
-    lock_acquire(cur_of_table->op_lock[of_index]);
-   
-    *err = VOP_READ(cur_of_table->v_ptr[of_index],u); 
-    /*check VOP_READ SUCCESS*/
-    if (*err) {
-        if (DEBUG_MODE) kprintf("some error in read(): retval is %d\n",*err);
-        return -1;
-    }
-    
-    result = u->uio_offset - cur_of_table->fp[of_index];
-    cur_of_table->fp[of_index] = u->uio_offset;
-
-    /* release the lock after reading */
-    lock_release(cur_of_table->op_lock[of_index]);
-
-    kfree(iov);
-    kfree(u);
-    /* should add handler for remain of u.uio_resid here */
-    //cur_of_table->fp[of_index] += size;
-    return result;
+/*
+ * Return an object to the pool.
+ */
+static
+void
+openfile_put(struct openfile *of)
+{
+	spinlock_acquire(&openfile_poollock);
+	of->of_next = openfile_freelist;
+	openfile_freelist = of;
+	spinlock_release(&openfile_poollock);
 }
 
+/*
+ * Open a file (kernel pathname) and wrap it in an open file object
+ * with one reference.
+ */
+static
+int
+openfile_open(char *path, int flags, mode_t mode, struct openfile **ret)
+{
+	struct openfile *of;
+	struct vnode *vn;
+	int result;
+
+	of = openfile_get();
+	if (of == NULL) {
+		return ENOMEM;
+	}
+
+	result = vfs_open(path, flags, mode, &vn);
+	if (result) {
+		openfile_put(of);
+		return result;
+	}
+
+	of->of_vnode = vn;
+	of->of_flags = flags;
+	of->of_accmode = flags & O_ACCMODE;
+	of->of_seekable = VOP_ISSEEKABLE(vn);
+	of->of_offset = 0;
+	of->of_refcount = 1;
+	KASSERT(of->of_busy == false);
+	*ret = of;
+	return 0;
+}
 
-int sys_write(int filehandle, const_userptr_t buf, size_t size, int *err){
-    /*return value*/
-    int result = 0;
-    *err = 0;
-    
-    /* check the file pointer */
-    if (curproc->fd_tbl->availability[filehandle] == FREE){
-        if (DEBUG_MODE) kprintf("can't read fd = %d : this fd is free\n", filehandle);
-        *err = EBADF;
-        return -1;
-    }
-
-    /* check whether buffer is available */
-    if (buf == NULL){
-        if (DEBUG_MODE) kprintf("the buffer is not available or the size is not available\n");
-        *err = EFAULT;
-        return -1;
-    }
-    // duplicate string
-    const char *str = (const char *)buf; // may need to replace this duplication into copyinstr
-    char *duplicate_str = kmalloc(sizeof(char) * (size+1)); 
-    size_t i = 0;
-    for (i = 0; i != size; i++){
-        duplicate_str[i] = str[i];
-    }// may need to replace this duplication into copyinstr
-
-    int of_index = curproc->fd_tbl->of_ptr[filehandle];
-    if (cur_of_table->availability[of_index] == FREE){
-        if (DEBUG_MODE) kprintf("can't read of = %d : this of is free\n", of_index);
-        *err = EBADF;
-        return -1;
-    }
-
-
-    // I don't know why this always fail. May instead to put read/write mode in of_table
-    /* get the stat of current file first */
-    // struct stat cur_file_stat;
-    // result = VOP_STAT(cur_of_table->v_ptr[of_index],&cur_file_stat);
-    // if (result){
-    //     return result;
-    // }
-
-    // int how = cur_file_stat.st_mode&O_ACCMODE;
-    // switch(how){
-    //     case O_WRONLY:
-    //     case O_RDWR:
-    //     break;
-    //     default:
-    //     kprintf("not suporting writing! cur_file_stat.st_mode = 0x%x,  how = %d\n", cur_file_stat.st_mode, how);
-    //     return EBADF;
-    // }
-    int how = cur_of_table->flags[of_index]&O_ACCMODE;
-    if (how == O_RDONLY){
-        if (DEBUG_MODE) kprintf("not suporting writing! flags = 0x%x,  how = %d\n", cur_of_table->flags[of_index], how);
-        *err = EBADF;
-        return -1;
-    }
-    
-    
-    /* acquire lock before write to the file */
-    lock_acquire(cur_of_table->op_lock[of_index]);
-    
-    // initialize uio
-    struct iovec *iov = kmalloc(sizeof(struct iovec));
-    struct uio *u = kmalloc(sizeof(struct uio)); 
-    uio_kinit(iov, u, (void *)duplicate_str, size, cur_of_table->fp[of_index], UIO_WRITE);
-    
-    *err = VOP_WRITE(cur_of_table->v_ptr[of_index], u);
-    if (*err) {
-        if (DEBUG_MODE) kprintf("some error in write(): retval is %d\n", *err);
-        return -1;
-    }
-
-    /* find the write offset */
-    result = u->uio_offset - cur_of_table->fp[of_index];
-
-    /* update te offset */
-    cur_of_table->fp[of_index] = u->uio_offset;
-
-    /* release the lock after writing */
-    lock_release(cur_of_table->op_lock[of_index]);
-
-    kfree(duplicate_str);
-    kfree(iov);
-    kfree(u);
-    //if(filehandle > 2) kprintf("write return size = %d\n", size);
-    //cur_of_table->fp[of_index] += size;
-    return result;
+static
+void
+openfile_incref(struct openfile *of)
+{
+	spinlock_acquire(&of->of_spinlock);
+	KASSERT(of->of_refcount > 0);
+	of->of_refcount++;
+	spinlock_release(&of->of_spinlock);
 }
 
-off_t sys_lseek(int filehandle, off_t pos, int whence, int *err){
-    /* returned value */
-    off_t result = 0;
-    *err = 0;
-
-    /* check fd availablity */
-    if ((filehandle < 0) || (filehandle > OPEN_MAX2 + 1)){
-        if (DEBUG_MODE) kprintf("unsupported seek object\n");
-        *err = ESPIPE;
-        return -1;
-    }
-
-    /* check filehandle exists or not */
-    if (curproc->fd_tbl->availability[filehandle] == FREE){
-        if (DEBUG_MODE) kprintf("can't read fd = %d : this fd is free\n", filehandle);
-        *err = EBADF;
-        return -1;
-    }
-
-    int of_index = curproc->fd_tbl->of_ptr[filehandle];
-    if (cur_of_table->availability[of_index] == FREE){
-        if (DEBUG_MODE) kprintf("can't read of = %d : this of is free\n", of_index);
-        *err = EBADF;
-        return -1;
-    }
-
-    /* check vnode seekablity */
-    if (!VOP_ISSEEKABLE(cur_of_table->v_ptr[of_index])){
-        *err = ESPIPE;
-        return -1;
-    }
-
-    /* acquire lock before seeking the file */
-    lock_acquire(cur_of_table->op_lock[of_index]);
-
-    struct stat cur_file_stat;
-    /* get the stat of current file first */
-    *err = VOP_STAT(cur_of_table->v_ptr[of_index],&cur_file_stat);
-    if (*err){
-        return -1;
-    }
-    
-    /* begin to condition */
-    switch(whence){
-
-        case SEEK_SET:
-            /* pos can't be negative */
-            if(pos < 0){
-                return EINVAL;
-            }
-            cur_of_table->fp[of_index] = pos;
-            break;
-
-        case SEEK_CUR:
-            /* final fp can't be negative */
-            if(pos + cur_of_table->fp[of_index] < 0){
-                *err = EINVAL;
-                return -1;
-            }
-            cur_of_table->fp[of_index] += pos;
-            break;
-
-        case SEEK_END:
-            /* final fp can't be negative */
-            if(cur_file_stat.st_size + pos < 0){
-                *err = EINVAL;
-                return -1;
-            }
-            cur_of_table->fp[of_index] = cur_file_stat.st_size + pos;
-            break;
-    }
-    result = cur_of_table->fp[of_index];
-
-    /* release the lock seeking reading */
-    lock_release(cur_of_table->op_lock[of_index]);
-    return result;
+/*
+ * Drop a reference; on the last one, close the file and return the
+ * object to the pool.
+ */
+static
+void
+openfile_decref(struct openfile *of)
+{
+	unsigned refs;
+
+	spinlock_acquire(&of->of_spinlock);
+	KASSERT(of->of_refcount > 0);
+	refs = --of->of_refcount;
+	spinlock_release(&of->of_spinlock);
+
+	if (refs > 0) {
+		return;
+	}
+	KASSERT(of->of_busy == false);
+	vfs_close(of->of_vnode);
+	of->of_vnode = NULL;
+	openfile_put(of);
 }
 
+/*
+ * Take ownership of the seek position. This is only a couple of
+ * spinlock operations unless someone else has it, in which case we
+ * sleep, making the wait channel first if nobody has needed it yet.
+ */
+static
+int
+openfile_lockpos(struct openfile *of)
+{
+	struct wchan *wc;
+
+	spinlock_acquire(&of->of_spinlock);
+	while (of->of_busy) {
+		if (of->of_wchan != NULL) {
+			wchan_sleep(of->of_wchan, &of->of_spinlock);
+			continue;
+		}
+
+		/* Can't allocate with the spinlock held. */
+		spinlock_release(&of->of_spinlock);
+		wc = wchan_create("openfile");
+		if (wc == NULL) {
+			return ENOMEM;
+		}
+		spinlock_acquire(&of->of_spinlock);
+		if (of->of_wchan == NULL) {
+			of->of_wchan = wc;
+		}
+		else {
+			/* Someone else made one meanwhile. */
+			spinlock_release(&of->of_spinlock);
+			wchan_destroy(wc);
+			spinlock_acquire(&of->of_spinlock);
+		}
+	}
+	of->of_busy = true;
+	spinlock_release(&of->of_spinlock);
+	return 0;
+}
 
-int sys_close(int filehandle){
-    /* returned value */
-    int result = 0;
-
-    if (IS_DEBUG_FILEDESCRIPTOR) kprintf("\n\n-----------------closing fd %d: -------------------------\n", filehandle);
-
-    /* check availability of fd table */
-    if (curproc->fd_tbl->availability[filehandle] == FREE) {
-        if (DEBUG_MODE) kprintf("ERROR: fd %d is free! can't close\n", filehandle);
-        return EBADF; /* return bad file number*/
-    }
-
-    int of_index = curproc->fd_tbl->of_ptr[filehandle];
-    if (cur_of_table->availability[of_index] == FREE){
-        if (DEBUG_MODE) kprintf("ERROR: of %d is free! can't close\n", of_index);
-        return EBADF; /* return bad file number */
-    }
-
-    if (push_fd_empty_free_slot(curproc->fd_tbl, filehandle) == -1) {
-        return EMFILE; /* return too many open files */
-    }
-    curproc->fd_tbl->availability[filehandle] = FREE;
-
-    /* acquire lock before read the file */
-    lock_acquire(cur_of_table->op_lock[of_index]);
-
-    /* check the reference count of curr entry */
-    if (cur_of_table->refcount[of_index] > 1){
-        cur_of_table->refcount[of_index] --;
-    }
-    else{
-        if (push_of_empty_free_slot(cur_of_table, of_index) == -1){
-            return ENFILE; /* return too many global open files */
-        }
-        cur_of_table->refcount[of_index]--;
-        cur_of_table->availability[of_index] = FREE; /* set entry free */
-        /* release the lock seeking reading */
-        /* close the vnode */
-        vfs_close(cur_of_table->v_ptr[of_index]); /* free the vnode */
-    }
-
-    /* release the lock after seeking */
-    if (cur_of_table->availability[of_index] == FREE){
-            lock_release(cur_of_table->op_lock[of_index]);
-            lock_destroy(cur_of_table->op_lock[of_index]);
-    }
-    else{
-        lock_release(cur_of_table->op_lock[of_index]);
-    }
-
-    if (IS_DEBUG_FILEDESCRIPTOR) show_of_table(); // debug code: show the status of of_table
-    if (IS_DEBUG_FILEDESCRIPTOR) show_fd_table(); // debug code: show the status of fd_table
-
-    return result;
+static
+void
+openfile_unlockpos(struct openfile *of)
+{
+	spinlock_acquire(&of->of_spinlock);
+	KASSERT(of->of_busy);
+	of->of_busy = false;
+	if (of->of_wchan != NULL) {
+		wchan_wakeone(of->of_wchan, &of->of_spinlock);
+	}
+	spinlock_release(&of->of_spinlock);
 }
 
+////////////////////////////////////////////////////////////
+// descriptor tables
+
+struct fd_table *
+fd_table_create(void)
+{
+	struct fd_table *ft;
+	unsigned i;
+
+	ft = kmalloc(sizeof(*ft));
+	if (ft == NULL) {
+		return NULL;
+	}
+	ft->ft_files = kmalloc(FD_TABLE_INITSIZE * sizeof(ft->ft_files[0]));
+	if (ft->ft_files == NULL) {
+		kfree(ft);
+		return NULL;
+	}
+	ft->ft_inuse = kmalloc(FD_WORDS(FD_TABLE_INITSIZE) *
+			       sizeof(ft->ft_inuse[0]));
+	if (ft->ft_inuse == NULL) {
+		kfree(ft->ft_files);
+		kfree(ft);
+		return NULL;
+	}
+	spinlock_init(&ft->ft_lock);
+	ft->ft_size = FD_TABLE_INITSIZE;
+	ft->ft_freehint = 0;
+	for (i=0; i<FD_TABLE_INITSIZE; i++) {
+		ft->ft_files[i] = NULL;
+	}
+	for (i=0; i<FD_WORDS(FD_TABLE_INITSIZE); i++) {
+		ft->ft_inuse[i] = 0;
+	}
+
+	return ft;
+}
 
-int sys_dup2(int filehandle, int newhandle){
-    /* returned value */
-    int result = 0;
-
-    /* check filehandles are large than 0 and filehandle exists*/
-    if (filehandle < 0 || newhandle <0 || curproc->fd_tbl->availability[filehandle] == FREE){
-        return EBADF;
-    }
-
-    /* if two handles are equal then has no effect */
-    if (filehandle == newhandle){
-        return 0;
-    }
-
-    /* if newhandle point to some file we need to close it*/
-    if (curproc->fd_tbl->availability[newhandle]){
-        /* close the current vnode */
-        int of_index = curproc->fd_tbl->of_ptr[newhandle];
-
-        /* acquire lock before close the file */
-        lock_acquire(cur_of_table->op_lock[of_index]);
-
-        if (cur_of_table->refcount[of_index] > 1){
-            cur_of_table->refcount[of_index]--;
-        }
-        else{
-            if (push_of_empty_free_slot(cur_of_table, of_index) == -1){
-                return ENFILE; /* return too many global open files */
-            }
-            cur_of_table->availability[of_index] = FREE; /* set entry free */
-            vfs_close(cur_of_table->v_ptr[of_index]); /* free the vnode */
-        }
-
-        /* destroy lock or release it */
-        if (cur_of_table->availability[of_index] == FREE){
-            lock_release(cur_of_table->op_lock[of_index]);
-            lock_destroy(cur_of_table->op_lock[of_index]);
-        }
-        else{
-            lock_release(cur_of_table->op_lock[of_index]);
-        }
-        
-        /* make the second fd point to first one */
-        curproc->fd_tbl->of_ptr[newhandle] = curproc->fd_tbl->of_ptr[filehandle];
-        /* find the entry in of_table of first fd */
-        of_index = curproc->fd_tbl->of_ptr[filehandle];
-        cur_of_table->refcount[of_index]++;
-    }
-    else{
-        curproc->fd_tbl->of_ptr[newhandle] = curproc->fd_tbl->of_ptr[filehandle];
-        curproc->fd_tbl->availability[newhandle] = OCCUPIED;
-        cur_of_table->refcount[filehandle]++;
-    }
-
-    return result;
+void
+fd_table_destroy(struct fd_table *ft)
+{
+	unsigned i;
+
+	KASSERT(ft != NULL);
+
+	/* We must have the only reference, so no locking. */
+	for (i=0; i<ft->ft_size; i++) {
+		if (ft->ft_files[i] != NULL) {
+			openfile_decref(ft->ft_files[i]);
+			ft->ft_files[i] = NULL;
+		}
+	}
+	spinlock_cleanup(&ft->ft_lock);
+	kfree(ft->ft_inuse);
+	kfree(ft->ft_files);
+	kfree(ft);
 }
 
+/*
+ * Make the table at least MINSIZE slots long, by doubling. The new
+ * arrays are allocated without the table lock held, so we recheck
+ * afterwards; if someone else grew it meanwhile, start over, since
+ * they may not have grown it far enough.
+ */
+static
+int
+fd_table_grow(struct fd_table *ft, unsigned minsize)
+{
+	struct openfile **newfiles, **oldfiles;
+	uint32_t *newinuse, *oldinuse;
+	unsigned oldsize, newsize, i;
+
+	KASSERT(minsize <= OPEN_MAX);
+
+ retry:
+	spinlock_acquire(&ft->ft_lock);
+	oldsize = ft->ft_size;
+	spinlock_release(&ft->ft_lock);
+
+	newsize = oldsize;
+	while (newsize < minsize) {
+		newsize *= 2;
+	}
+	if (newsize > OPEN_MAX) {
+		newsize = OPEN_MAX;
+	}
+	if (newsize == oldsize) {
+		return 0;
+	}
+	KASSERT(newsize % FD_WORD_BITS == 0);
+
+	newfiles = kmalloc(newsize * sizeof(newfiles[0]));
+	if (newfiles == NULL) {
+		return ENOMEM;
+	}
+	newinuse = kmalloc(FD_WORDS(newsize) * sizeof(newinuse[0]));
+	if (newinuse == NULL) {
+		kfree(newfiles);
+		return ENOMEM;
+	}
+
+	spinlock_acquire(&ft->ft_lock);
+	if (ft->ft_size != oldsize) {
+		/*
+		 * Lost a race; whoever won may not have made it big
+		 * enough, so look again.
+		 */
+		spinlock_release(&ft->ft_lock);
+		kfree(newinuse);
+		kfree(newfiles);
+		goto retry;
+	}
+	for (i=0; i<oldsize; i++) {
+		newfiles[i] = ft->ft_files[i];
+	}
+	for (i=oldsize; i<newsize; i++) {
+		newfiles[i] = NULL;
+	}
+	for (i=0; i<FD_WORDS(oldsize); i++) {
+		newinuse[i] = ft->ft_inuse[i];
+	}
+	for (i=FD_WORDS(oldsize); i<FD_WORDS(newsize); i++) {
+		newinuse[i] = 0;
+	}
+	oldfiles = ft->ft_files;
+	oldinuse = ft->ft_inuse;
+	ft->ft_files = newfiles;
+	ft->ft_inuse = newinuse;
+	ft->ft_size = newsize;
+	spinlock_release(&ft->ft_lock);
+
+	kfree(oldinuse);
+	kfree(oldfiles);
+	return 0;
+}
 
-struct fd_table * create_fd_table(void){
-    struct fd_table * fd = kmalloc(sizeof(struct fd_table));
-    KASSERT(fd != NULL);
-    fd->of_ptr = kmalloc(sizeof(int) * OPEN_MAX2);
-    fd->free_slots = kmalloc(sizeof(int) * OPEN_MAX2);
-    fd->availability= kmalloc(sizeof(int8_t) * OPEN_MAX2);
-    fd->size = 0;
-    fd->front = 0;
-    fd->end = 0;
-
-    int i;
-    for (i = 0; i < OPEN_MAX2; i++){
-        queue_push(fd->free_slots, &(fd->end), &(fd->size), i);
-        fd->availability[i] = FREE;
-    }
-    return fd;
+/*
+ * Mark FD taken or free in the bitmap. Call with the table locked.
+ */
+static
+void
+fd_table_mark(struct fd_table *ft, int fd)
+{
+	uint32_t mask = (uint32_t)1 << (fd % FD_WORD_BITS);
+
+	KASSERT(spinlock_do_i_hold(&ft->ft_lock));
+	KASSERT((ft->ft_inuse[fd / FD_WORD_BITS] & mask) == 0);
+	ft->ft_inuse[fd / FD_WORD_BITS] |= mask;
 }
 
-struct of_table * create_of_table(void){
-    struct of_table *of = kmalloc(sizeof(struct of_table));
-    KASSERT(of != NULL);
-    of->fp = kmalloc(sizeof(off_t) * OPEN_MAX2);
-    of->v_ptr = kmalloc(sizeof(struct vnode) * OPEN_MAX2);
-    of->flags = kmalloc(sizeof(mode_t) * OPEN_MAX2);
-    of->free_slots = kmalloc(sizeof(int) * OPEN_MAX2);
-    of->availability= kmalloc(sizeof(int8_t) * OPEN_MAX2);
-    of->size = 0;
-    of->front = 0;
-    of->end = 0;
-    of->refcount = kmalloc(sizeof(int) * OPEN_MAX2);
-    of->op_lock = kmalloc(sizeof(struct lock) * OPEN_MAX2);
-
-    int i;
-    for (i = 0; i < OPEN_MAX2; i++){
-        queue_push(of->free_slots, &(of->end), &(of->size), i);
-        of->availability[i] = FREE;
-    }
-
-    return of;
+static
+void
+fd_table_unmark(struct fd_table *ft, int fd)
+{
+	uint32_t mask = (uint32_t)1 << (fd % FD_WORD_BITS);
+
+	KASSERT(spinlock_do_i_hold(&ft->ft_lock));
+	KASSERT((ft->ft_inuse[fd / FD_WORD_BITS] & mask) != 0);
+	ft->ft_inuse[fd / FD_WORD_BITS] &= ~mask;
+	if (fd / FD_WORD_BITS < ft->ft_freehint) {
+		ft->ft_freehint = fd / FD_WORD_BITS;
+	}
 }
 
+/*
+ * Install OF in the lowest free descriptor, consuming the caller's
+ * reference.
+ */
+static
+int
+fd_table_add(struct fd_table *ft, struct openfile *of, int *retfd)
+{
+	unsigned size, ix;
+	int fd, result;
+
+	spinlock_acquire(&ft->ft_lock);
+	while (1) {
+		for (ix = ft->ft_freehint; ix < FD_WORDS(ft->ft_size); ix++) {
+			if (ft->ft_inuse[ix] != FD_WORD_ALLBITS) {
+				break;
+			}
+		}
+		ft->ft_freehint = ix;
+		if (ix < FD_WORDS(ft->ft_size)) {
+			break;
+		}
+
+		size = ft->ft_size;
+		spinlock_release(&ft->ft_lock);
+		if (size >= OPEN_MAX) {
+			return EMFILE;
+		}
+		result = fd_table_grow(ft, size + 1);
+		if (result) {
+			return result;
+		}
+		spinlock_acquire(&ft->ft_lock);
+	}
+	fd = ix * FD_WORD_BITS + bitmap_ctz32(~ft->ft_inuse[ix]);
+	KASSERT(ft->ft_files[fd] == NULL);
+	fd_table_mark(ft, fd);
+	ft->ft_files[fd] = of;
+	spinlock_release(&ft->ft_lock);
+
+	*retfd = fd;
+	return 0;
+}
 
+/*
+ * Look up FD and return its open file with a reference added for
+ * the caller, who must drop it with openfile_decref.
+ */
+static
+int
+fd_table_get(struct fd_table *ft, int fd, struct openfile **ret)
+{
+	struct openfile *of;
+
+	if (fd < 0) {
+		return EBADF;
+	}
+	spinlock_acquire(&ft->ft_lock);
+	if ((unsigned)fd >= ft->ft_size || ft->ft_files[fd] == NULL) {
+		spinlock_release(&ft->ft_lock);
+		return EBADF;
+	}
+	of = ft->ft_files[fd];
+	openfile_incref(of);
+	spinlock_release(&ft->ft_lock);
+
+	*ret = of;
+	return 0;
+}
 
+////////////////////////////////////////////////////////////
+// open and close
+
+int
+file_open(char *path, int flags, mode_t mode, int *retfd)
+{
+	struct openfile *of;
+	int result;
+
+	result = openfile_open(path, flags, mode, &of);
+	if (result) {
+		return result;
+	}
+	result = fd_table_add(curproc->p_fdtable, of, retfd);
+	if (result) {
+		openfile_decref(of);
+		return result;
+	}
+	return 0;
+}
 
+int
+sys_open(const_userptr_t path, int flags, mode_t mode, int *retval)
+{
+	char *kpath;
+	int result;
+
+	kpath = kmalloc(PATH_MAX);
+	if (kpath == NULL) {
+		return ENOMEM;
+	}
+	result = copyinstr(path, kpath, PATH_MAX, NULL);
+	if (result) {
+		kfree(kpath);
+		return result;
+	}
+	result = file_open(kpath, flags, mode, retval);
+	kfree(kpath);
+	return result;
+}
 
+int
+sys_close(int fd)
+{
+	struct fd_table *ft = curproc->p_fdtable;
+	struct openfile *of;
+
+	if (fd < 0) {
+		return EBADF;
+	}
+	spinlock_acquire(&ft->ft_lock);
+	if ((unsigned)fd >= ft->ft_size || ft->ft_files[fd] == NULL) {
+		spinlock_release(&ft->ft_lock);
+		return EBADF;
+	}
+	of = ft->ft_files[fd];
+	ft->ft_files[fd] = NULL;
+	fd_table_unmark(ft, fd);
+	spinlock_release(&ft->ft_lock);
+
+	openfile_decref(of);
+	return 0;
+}
 
-// queue operations
-int queue_pop(int *queue, int *front, int *size){
-    (void) queue;
-    if (*size > 0){
-        if (++*front >= OPEN_MAX2) *front = 0; // circular increament
-        --*size;
-        return 0;
-    }
-    else return -1;
+int
+sys_dup2(int oldfd, int newfd, int *retval)
+{
+	struct fd_table *ft = curproc->p_fdtable;
+	struct openfile *of, *oldof;
+	int result;
+
+	if (newfd < 0 || newfd >= OPEN_MAX) {
+		return EBADF;
+	}
+	result = fd_table_get(ft, oldfd, &of);
+	if (result) {
+		return result;
+	}
+	if (oldfd == newfd) {
+		openfile_decref(of);
+		*retval = newfd;
+		return 0;
+	}
+	result = fd_table_grow(ft, newfd + 1);
+	if (result) {
+		openfile_decref(of);
+		return result;
+	}
+
+	/* Our reference from fd_table_get becomes the slot's reference. */
+	spinlock_acquire(&ft->ft_lock);
+	oldof = ft->ft_files[newfd];
+	if (oldof == NULL) {
+		fd_table_mark(ft, newfd);
+	}
+	ft->ft_files[newfd] = of;
+	spinlock_release(&ft->ft_lock);
+
+	if (oldof != NULL) {
+		openfile_decref(oldof);
+	}
+	*retval = newfd;
+	return 0;
 }
 
-int queue_front(int *queue, int front, int size){
-    return (size > 0) ? queue[front] : -1;
+////////////////////////////////////////////////////////////
+// I/O
+
+/*
+ * Common code for all the read and write calls. This is the hot path
+ * for small I/O, so it doesn't allocate anything: the uio lives on
+ * the stack and the access check uses the mode cached at open time.
+ *
+ * IOV is a kernel copy of IOVCNT user iovecs, which are transferred
+ * in order by a single VOP_READ or VOP_WRITE.
+ *
+ * If POS is NULL, the transfer happens at the open file's seek
+ * position, which is held locked for the duration and then advanced.
+ * Otherwise (pread and pwrite) it happens at *POS and the seek
+ * position is neither used nor changed, so no lock is needed and
+ * positional I/O on a shared open file can proceed concurrently;
+ * the file system is responsible for its own consistency.
+ */
+static
+int
+file_io(int fd, struct iovec *iov, unsigned iovcnt, const off_t *pos,
+	enum uio_rw rw, int *retval)
+{
+	struct openfile *of;
+	struct uio u;
+	size_t len;
+	unsigned i;
+	int result;
+
+	/* The byte count has to fit in the (signed) return value. */
+	len = 0;
+	for (i=0; i<iovcnt; i++) {
+		if (iov[i].iov_len > FILE_MAXIO - len) {
+			return EINVAL;
+		}
+		len += iov[i].iov_len;
+	}
+
+	result = fd_table_get(curproc->p_fdtable, fd, &of);
+	if (result) {
+		return result;
+	}
+	if (of->of_accmode == (rw == UIO_READ ? O_WRONLY : O_RDONLY)) {
+		openfile_decref(of);
+		return EBADF;
+	}
+	if (pos != NULL) {
+		if (!of->of_seekable) {
+			openfile_decref(of);
+			return ESPIPE;
+		}
+		if (*pos < 0) {
+			openfile_decref(of);
+			return EINVAL;
+		}
+	}
+
+	u.uio_iov = iov;
+	u.uio_iovcnt = iovcnt;
+	u.uio_resid = len;
+	u.uio_segflg = UIO_USERSPACE;
+	u.uio_rw = rw;
+	u.uio_space = proc_getas();
+
+	if (pos == NULL) {
+		result = openfile_lockpos(of);
+		if (result) {
+			openfile_decref(of);
+			return result;
+		}
+		u.uio_offset = of->of_offset;
+	}
+	else {
+		u.uio_offset = *pos;
+	}
+	if (rw == UIO_READ) {
+		result = VOP_READ(of->of_vnode, &u);
+	}
+	else {
+		result = VOP_WRITE(of->of_vnode, &u);
+	}
+	if (result == 0) {
+		*retval = len - u.uio_resid;
+	}
+	if (pos == NULL) {
+		if (result == 0) {
+			of->of_offset = u.uio_offset;
+		}
+		openfile_unlockpos(of);
+	}
+
+	openfile_decref(of);
+	return result;
 }
 
-int queue_push(int *queue, int *end, int *size, int element){
-    if (*size < OPEN_MAX2){
-        queue[*end] = element;
-        if (++*end >= OPEN_MAX2) *end = 0; // circular increament
-        ++*size;
-        return 0;
-    }
-    else return -1;
-} 
-
-
-int get_of_table_free_slot(struct of_table *table){
-    int of_free_index = queue_front(table->free_slots, table->front, table->size);
-    if (of_free_index == -1) {
-        if (DEBUG_MODE) kprintf("of table is full\n");
-        return -1;
-    }
-    queue_pop(table->free_slots, &(table->front), &(table->size));
-    int free_slot = table->free_slots[of_free_index];
-    return free_slot;
+/*
+ * Single-buffer read and write.
+ */
+static
+int
+file_rw(int fd, userptr_t buf, size_t size, const off_t *pos,
+	enum uio_rw rw, int *retval)
+{
+	struct iovec iov;
+
+	iov.iov_ubase = buf;
+	iov.iov_len = size;
+	return file_io(fd, &iov, 1, pos, rw, retval);
 }
 
-int get_fd_table_free_slot(struct fd_table *table){
-    int of_free_index = queue_front(table->free_slots, table->front, table->size);
-    if (of_free_index == -1) {
-        if (DEBUG_MODE) kprintf("of table is full\n");
-        return -1;
-    }
-    queue_pop(table->free_slots, &(table->front), &(table->size));
-    int free_slot = table->free_slots[of_free_index];
-    return free_slot;
+/*
+ * Vectored read and write. The user's iovec array is copied in once,
+ * onto the stack if it is small and into a temporary buffer if not.
+ */
+static
+int
+file_rwv(int fd, const_userptr_t uiov, int iovcnt, const off_t *pos,
+	 enum uio_rw rw, int *retval)
+{
+	struct iovec stackiov[FILE_STACKIOV];
+	struct iovec *iov;
+	int result;
+
+	if (iovcnt <= 0 || iovcnt > IOV_MAX) {
+		return EINVAL;
+	}
+	if (iovcnt <= FILE_STACKIOV) {
+		iov = stackiov;
+	}
+	else {
+		iov = kmalloc(iovcnt * sizeof(iov[0]));
+		if (iov == NULL) {
+			return ENOMEM;
+		}
+	}
+
+	result = copyin(uiov, iov, iovcnt * sizeof(iov[0]));
+	if (result == 0) {
+		result = file_io(fd, iov, iovcnt, pos, rw, retval);
+	}
+
+	if (iov != stackiov) {
+		kfree(iov);
+	}
+	return result;
 }
 
+int
+sys_read(int fd, userptr_t buf, size_t size, int *retval)
+{
+	return file_rw(fd, buf, size, NULL, UIO_READ, retval);
+}
 
-int push_of_empty_free_slot(struct of_table *table, int element){
-    int retval = queue_push(table->free_slots, &(table->end), &(table->size), element);
-    if (retval == -1 && DEBUG_MODE) kprintf("of table free slot is full, can't push");
-    return retval;
+int
+sys_write(int fd, const_userptr_t buf, size_t size, int *retval)
+{
+	/* The data is copied in by uiomove, straight from the user buffer. */
+	return file_rw(fd, (userptr_t)buf, size, NULL, UIO_WRITE, retval);
 }
-int push_fd_empty_free_slot(struct fd_table *table, int element){
-    int retval = queue_push(table->free_slots, &(table->end), &(table->size), element);
-    if (retval == -1 && DEBUG_MODE) kprintf("fd table free slot is full, can't push");
-    return retval;
+
+int
+sys_pread(int fd, userptr_t buf, size_t size, off_t pos, int *retval)
+{
+	return file_rw(fd, buf, size, &pos, UIO_READ, retval);
 }
 
+int
+sys_pwrite(int fd, const_userptr_t buf, size_t size, off_t pos, int *retval)
+{
+	return file_rw(fd, (userptr_t)buf, size, &pos, UIO_WRITE, retval);
+}
 
-// for debugging: show of table and show fd table
+int
+sys_readv(int fd, const_userptr_t iov, int iovcnt, int *retval)
+{
+	return file_rwv(fd, iov, iovcnt, NULL, UIO_READ, retval);
+}
 
+int
+sys_writev(int fd, const_userptr_t iov, int iovcnt, int *retval)
+{
+	return file_rwv(fd, iov, iovcnt, NULL, UIO_WRITE, retval);
+}
 
-void show_of_table(void){
-    struct of_table *table = cur_of_table;
-    kprintf("\nShowing open file table:\n");
-    kprintf("free slot queue front index = %d, end index = %d, size = %d\n", table->front, table->end, table->size);
+int
+sys_preadv(int fd, const_userptr_t iov, int iovcnt, off_t pos, int *retval)
+{
+	return file_rwv(fd, iov, iovcnt, &pos, UIO_READ, retval);
+}
 
-    int i;
-    for (i = 0; i < OPEN_MAX2; i++){
-        kprintf("position %d: ", i);
-        if (table->availability[i] == FREE) kprintf("free\n");
-        else    kprintf("fp = %lld, vnode = %x : %d, flags = 0x%x\n", table->fp[i], (unsigned int)table->v_ptr[i], 
-            table->v_ptr[i]->vn_refcount, table->flags[i]);
-    }
+int
+sys_pwritev(int fd, const_userptr_t iov, int iovcnt, off_t pos, int *retval)
+{
+	return file_rwv(fd, iov, iovcnt, &pos, UIO_WRITE, retval);
 }
-void show_fd_table(void){
-    struct fd_table *table = curproc->fd_tbl;
-    kprintf("\nShowing file descriptor table:\n");
-    kprintf("free slot queue front index = %d, end index = %d, size = %d\n", table->front, table->end, table->size);
-
-    int i;
-    for (i = 0; i < OPEN_MAX2; i++){
-        kprintf("position %d: ", i);
-        if (table->availability[i] == FREE) kprintf("free\n");
-        else    kprintf("ofptr = %d\n", table->of_ptr[i]);
-    }
+
+int
+sys_lseek(int fd, off_t pos, int whence, off_t *retval)
+{
+	struct openfile *of;
+	struct stat st;
+	off_t newpos;
+	int result;
+
+	result = fd_table_get(curproc->p_fdtable, fd, &of);
+	if (result) {
+		return result;
+	}
+	if (!of->of_seekable) {
+		openfile_decref(of);
+		return ESPIPE;
+	}
+
+	result = openfile_lockpos(of);
+	if (result) {
+		openfile_decref(of);
+		return result;
+	}
+	switch (whence) {
+	    case SEEK_SET:
+		newpos = pos;
+		break;
+	    case SEEK_CUR:
+		newpos = of->of_offset + pos;
+		break;
+	    case SEEK_END:
+		result = VOP_STAT(of->of_vnode, &st);
+		if (result) {
+			goto out;
+		}
+		newpos = st.st_size + pos;
+		break;
+	    default:
+		result = EINVAL;
+		goto out;
+	}
+	if (newpos < 0) {
+		result = EINVAL;
+		goto out;
+	}
+	of->of_offset = newpos;
+	*retval = newpos;
+ out:
+	openfile_unlockpos(of);
+	openfile_decref(of);
+	return result;
 }
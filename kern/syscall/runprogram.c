@@ -44,12 +44,31 @@
 #include <vfs.h>
 #include <syscall.h>
 #include <test.h>
-
-
-
-#include <syscall.h>
 #include <file.h>
 
+/*
+ * Open the console as descriptors 0, 1, and 2. file_open may destroy
+ * the path, so each call gets a fresh copy.
+ */
+static
+int
+runprogram_stdio(void)
+{
+	static const int flags[3] = { O_RDONLY, O_WRONLY, O_WRONLY };
+	char path[5];
+	int i, fd, result;
+
+	for (i=0; i<3; i++) {
+		strcpy(path, "con:");
+		result = file_open(path, flags[i], 0, &fd);
+		if (result) {
+			return result;
+		}
+		KASSERT(fd == i);
+	}
+	return 0;
+}
+
 /*
  * Load program "progname" and start running it in usermode.
  * Does not return except on error.
@@ -102,32 +121,12 @@ runprogram(char *progname)
 		return result;
 	}
 
-	/* first create global of table */
-	cur_of_table = create_of_table();
-
-	curproc->fd_tbl = create_fd_table(); // is the current process the same as the process in user mode?
-	// I can't find the source code of enter_new_process()
-	// Yes, this is the same process. Proved by printf below and printf the same things in syscall (sys_write)
-	//kprintf("address of curproc == %x\n", (unsigned int) curproc);
-	//kprintf("proc name = %s\n", curproc->p_name);
-
-
-
-	char c0[] = "con:";
-	char c1[] = "con:";
-	char c2[] = "con:";
-	int fd[3];
-	fd[0] = sys_open(c0, O_WRONLY, 0); // what does the mode do?
-	fd[1] = sys_open(c1, O_WRONLY, 0); // what does the mode do?
-	fd[2] = sys_open(c2, O_WRONLY, 0); // what does the mode do?
-
-	sys_close(fd[0]);
-
-	//int console_result = sys_close(fd[0]);
-	//if (console_result){
-	//	return -1; // test to debug
-	//}
-	//sys_close(fd[0]);
+	/* Set up the standard descriptors on the console. */
+	result = runprogram_stdio();
+	if (result) {
+		/* the descriptor table goes away when curproc is destroyed */
+		return result;
+	}
 
 	/* Warp to user mode. */
 	enter_new_process(0 /*argc*/, NULL /*userspace addr of argv*/,
@@ -136,7 +135,6 @@ runprogram(char *progname)
 
 	/* enter_new_process does not return. */
 	panic("enter_new_process returned\n");
-	kprintf("debug point 8\n");
 	return EINVAL;
 }
 
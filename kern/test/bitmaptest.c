@@ -28,12 +28,60 @@
  */
 
 #include <types.h>
+#include <kern/errno.h>
 #include <lib.h>
+#include <clock.h>
 #include <bitmap.h>
 #include <test.h>
 
 #define TESTSIZE 533
 
+/* Size of the bitmap for the benchmark: the freemap of a 128M disk */
+#define BENCHSIZE (128*1024*1024/512)
+#define BENCHROUNDS 20
+
+/*
+ * Check the searching and counting functions against DATA, which
+ * holds the value of each bit in B.
+ */
+static
+void
+bitmaptest_search(struct bitmap *b, const char *data)
+{
+	unsigned start, i, x, n, count;
+	int result;
+
+	for (start=0; start<TESTSIZE; start++) {
+		for (i=start; i<TESTSIZE && !data[i]; i++);
+		result = bitmap_nextset(b, start, &x);
+		KASSERT(i < TESTSIZE ? result == 0 && x == i : result != 0);
+
+		for (i=start; i<TESTSIZE && data[i]; i++);
+		result = bitmap_nextclear(b, start, &x);
+		KASSERT(i < TESTSIZE ? result == 0 && x == i : result != 0);
+
+		count = 0;
+		for (i=start; i<TESTSIZE; i++) {
+			count += data[i] ? 1 : 0;
+		}
+		KASSERT(bitmap_count(b, start, TESTSIZE) == count);
+		KASSERT(bitmap_count(b, 0, start) ==
+			bitmap_count(b, 0, TESTSIZE) - count);
+
+		for (n=1; n<=4; n++) {
+			for (i=start; i+n <= TESTSIZE; i++) {
+				for (x=0; x<n && !data[i+x]; x++);
+				if (x == n) {
+					break;
+				}
+			}
+			result = bitmap_findrun(b, start, n, &x);
+			KASSERT(i+n <= TESTSIZE ?
+				result == 0 && x == i : result != 0);
+		}
+	}
+}
+
 int
 bitmaptest(int nargs, char **args)
 {
@@ -71,6 +119,7 @@ bitmaptest(int nargs, char **args)
 			KASSERT(bitmap_isset(b, i)==0);
 		}
 	}
+	bitmaptest_search(b, data);
 
 	for (i=0; i<TESTSIZE; i++) {
 		if (data[i]) {
@@ -104,3 +153,143 @@ bitmaptest(int nargs, char **args)
 	kprintf("Bitmap test complete\n");
 	return 0;
 }
+
+/*
+ * Print how long each of BENCHROUNDS rounds took on average.
+ */
+static
+void
+bitmapbench_report(const char *what, struct timespec *before)
+{
+	struct timespec after, duration;
+	uint64_t nsecs;
+
+	gettime(&after);
+	timespec_sub(&after, before, &duration);
+	nsecs = duration.tv_sec * 1000000000ULL + duration.tv_nsec;
+	kprintf("  %-36s %8llu us\n", what,
+		(unsigned long long)(nsecs / BENCHROUNDS / 1000));
+}
+
+/*
+ * Time the bitmap operations on a large, nearly full bitmap, against
+ * doing the same things one bit at a time with bitmap_isset.
+ */
+int
+bitmapbench(int nargs, char **args)
+{
+	struct bitmap *b;
+	struct timespec before;
+	unsigned i, x, round, count, last;
+
+	(void)nargs;
+	(void)args;
+
+	kprintf("Starting bitmap benchmark (%u bits)...\n", BENCHSIZE);
+
+	b = bitmap_create(BENCHSIZE);
+	if (b == NULL) {
+		kprintf("bitmapbench: Out of memory\n");
+		return ENOMEM;
+	}
+
+	/* Fill all but the last 1/16, and leave a few holes */
+	last = BENCHSIZE - BENCHSIZE / 16;
+	for (i=0; i<last; i++) {
+		if (i % 4099 != 0) {
+			bitmap_mark(b, i);
+		}
+	}
+
+	gettime(&before);
+	for (round=0; round<BENCHROUNDS; round++) {
+		for (i=0; i<BENCHSIZE && bitmap_isset(b, i); i++);
+		KASSERT(i == 0);
+		for (i=1; i<BENCHSIZE && bitmap_isset(b, i); i++);
+		KASSERT(i == 4099);
+	}
+	bitmapbench_report("first clear, one bit at a time", &before);
+
+	gettime(&before);
+	for (round=0; round<BENCHROUNDS; round++) {
+		bitmap_nextclear(b, 1, &x);
+		KASSERT(x == 4099);
+	}
+	bitmapbench_report("first clear, bitmap_nextclear", &before);
+
+	gettime(&before);
+	for (round=0; round<BENCHROUNDS; round++) {
+		for (x=0; x<last; x++) {
+			for (i=0; i<64 && x+i<BENCHSIZE; i++) {
+				if (bitmap_isset(b, x+i)) {
+					break;
+				}
+			}
+			if (i == 64) {
+				break;
+			}
+		}
+		KASSERT(x == last);
+	}
+	bitmapbench_report("run of 64 clear, one bit at a time", &before);
+
+	gettime(&before);
+	for (round=0; round<BENCHROUNDS; round++) {
+		bitmap_findrun(b, 0, 64, &x);
+		KASSERT(x == last);
+	}
+	bitmapbench_report("run of 64 clear, bitmap_findrun", &before);
+
+	gettime(&before);
+	for (round=0; round<BENCHROUNDS; round++) {
+		count = 0;
+		for (i=0; i<BENCHSIZE; i++) {
+			if (bitmap_isset(b, i)) {
+				count++;
+			}
+		}
+	}
+	bitmapbench_report("count set, one bit at a time", &before);
+
+	gettime(&before);
+	for (round=0; round<BENCHROUNDS; round++) {
+		KASSERT(bitmap_count(b, 0, BENCHSIZE) == count);
+	}
+	bitmapbench_report("count set, bitmap_count", &before);
+
+	/* Now mostly empty: iterate over the few set bits */
+	for (i=0; i<last; i++) {
+		if (i % 4099 != 0) {
+			bitmap_unmark(b, i);
+		}
+		else {
+			bitmap_mark(b, i);
+		}
+	}
+
+	gettime(&before);
+	for (round=0; round<BENCHROUNDS; round++) {
+		count = 0;
+		for (i=0; i<BENCHSIZE; i++) {
+			if (bitmap_isset(b, i)) {
+				count++;
+			}
+		}
+	}
+	bitmapbench_report("visit set bits, one at a time", &before);
+
+	gettime(&before);
+	for (round=0; round<BENCHROUNDS; round++) {
+		x = 0;
+		for (i=0; bitmap_nextset(b, i, &x) == 0; i = x + 1) {
+			count--;
+		}
+		KASSERT(count == 0);
+		count = bitmap_count(b, 0, BENCHSIZE);
+	}
+	bitmapbench_report("visit set bits, bitmap_nextset", &before);
+
+	bitmap_destroy(b);
+	kprintf("Bitmap benchmark done\n");
+	return 0;
+}
@@ -43,6 +43,7 @@
 #include <kern/fcntl.h>
 #include <lib.h>
 #include <uio.h>
+#include <clock.h>
 #include <thread.h>
 #include <synch.h>
 #include <vfs.h>
@@ -56,6 +57,9 @@
 #define NTHREADS 12
 #define NLONG    32
 #define NCREATE  24
+#define NSCALE   64	/* fs7: maximum number of threads */
+#define SCALEBLOCKS 8	/* fs7: size of each thread's file, in 512-byte blocks */
+#define SCALEROUNDS 32	/* fs7: times each thread rereads its file */
 
 static struct semaphore *threadsem = NULL;
 
@@ -674,6 +678,161 @@ docreatestress(const char *filesys)
 
 ////////////////////////////////////////////////////////////
 
+/*
+ * Scaling test: N threads each write a small file of their own and
+ * then read it back over and over, and we report the aggregate
+ * throughput for N = 1, 2, 4, ... The files fit in the buffer
+ * cache, so after the first pass this measures how well the
+ * filesystem's own locking lets threads on different CPUs run at
+ * the same time, not how fast the disk is. Run it with different
+ * numbers of CPUs configured in sys161.conf to see the scaling.
+ */
+
+static volatile unsigned scalestress_failures;
+
+static
+int
+scalestress_file(const char *fs, const char *namesuffix)
+{
+	struct vnode *vn;
+	char name[32];
+	char buf[32];
+	char data[512];
+	struct iovec iov;
+	struct uio ku;
+	unsigned i, j, round;
+	int err;
+
+	MAKENAME();
+
+	/* vfs_open destroys the string it's passed */
+	strcpy(buf, name);
+	err = vfs_open(buf, O_RDWR|O_CREAT|O_TRUNC, 0664, &vn);
+	if (err) {
+		kprintf("Could not open %s: %s\n", name, strerror(err));
+		return -1;
+	}
+
+	for (i=0; i<SCALEBLOCKS; i++) {
+		for (j=0; j<sizeof(data); j++) {
+			data[j] = (char)(i + j);
+		}
+		uio_kinit(&iov, &ku, data, sizeof(data), i*sizeof(data),
+			  UIO_WRITE);
+		err = VOP_WRITE(vn, &ku);
+		if (err || ku.uio_resid > 0) {
+			kprintf("%s: Write error: %s\n", name,
+				err ? strerror(err) : "short write");
+			vfs_close(vn);
+			return -1;
+		}
+	}
+
+	for (round=0; round<SCALEROUNDS; round++) {
+		for (i=0; i<SCALEBLOCKS; i++) {
+			uio_kinit(&iov, &ku, data, sizeof(data),
+				  i*sizeof(data), UIO_READ);
+			err = VOP_READ(vn, &ku);
+			if (err || ku.uio_resid > 0) {
+				kprintf("%s: Read error: %s\n", name,
+					err ? strerror(err) : "short read");
+				vfs_close(vn);
+				return -1;
+			}
+			for (j=0; j<sizeof(data); j++) {
+				if (data[j] != (char)(i + j)) {
+					kprintf("%s: Test failed: block %u "
+						"byte %u mismatched\n",
+						name, i, j);
+					vfs_close(vn);
+					return -1;
+				}
+			}
+		}
+	}
+
+	vfs_close(vn);
+	return 0;
+}
+
+static
+void
+scalestress_thread(void *fs, unsigned long num)
+{
+	const char *filesys = fs;
+	char numstr[8];
+
+	snprintf(numstr, sizeof(numstr), "S%lu", num);
+	if (scalestress_file(filesys, numstr)) {
+		scalestress_failures++;
+	}
+	V(threadsem);
+}
+
+static
+void
+doscalestress(const char *filesys, unsigned maxthreads)
+{
+	struct timespec before, after, duration;
+	uint64_t nsecs, kbytes;
+	unsigned nthreads, ran, i;
+	char numstr[8];
+	int err;
+
+	init_threadsem();
+	scalestress_failures = 0;
+
+	kprintf("*** Starting fs scaling test on %s:\n", filesys);
+
+	ran = 0;
+	for (nthreads = 1; nthreads <= maxthreads; nthreads *= 2) {
+		ran = nthreads;
+		gettime(&before);
+		for (i=0; i<nthreads; i++) {
+			err = thread_fork("scalestress", NULL,
+					  scalestress_thread,
+					  (char *)filesys, i);
+			if (err) {
+				panic("scalestress: thread_fork failed %s\n",
+				      strerror(err));
+			}
+		}
+		for (i=0; i<nthreads; i++) {
+			P(threadsem);
+		}
+		gettime(&after);
+		timespec_sub(&after, &before, &duration);
+
+		nsecs = duration.tv_sec * 1000000000ULL + duration.tv_nsec;
+		kbytes = (uint64_t)nthreads * SCALEBLOCKS * (SCALEROUNDS + 1)
+			/ 2;
+		kprintf("%2u threads: %llu KB in %llu.%09lu seconds, "
+			"%llu KB/s\n", nthreads,
+			(unsigned long long) kbytes,
+			(unsigned long long) duration.tv_sec,
+			(unsigned long) duration.tv_nsec,
+			(unsigned long long)
+			(nsecs ? kbytes * 1000000000ULL / nsecs : 0));
+
+		if (scalestress_failures > 0) {
+			break;
+		}
+	}
+
+	for (i=0; i<ran; i++) {
+		snprintf(numstr, sizeof(numstr), "S%u", i);
+		fstest_remove(filesys, numstr);
+	}
+
+	if (scalestress_failures > 0) {
+		kprintf("*** Test failed\n");
+		return;
+	}
+	kprintf("*** fs scaling test done\n");
+}
+
+////////////////////////////////////////////////////////////
+
 static
 int
 checkfilesystem(int nargs, char **args)
@@ -681,7 +840,7 @@ checkfilesystem(int nargs, char **args)
 	char *device;
 
 	if (nargs != 2) {
-		kprintf("Usage: fs[123456] filesystem:\n");
+		kprintf("Usage: fs[1234567] filesystem:\n");
 		return EINVAL;
 	}
 
@@ -715,6 +874,28 @@ DEFTEST(writestress2);
 DEFTEST(longstress);
 DEFTEST(createstress);
 
+int
+scalestress(int nargs, char **args)
+{
+	unsigned maxthreads = 8;
+	int result;
+
+	if (nargs == 3) {
+		maxthreads = atoi(args[2]);
+		if (maxthreads < 1 || maxthreads > NSCALE) {
+			kprintf("Usage: fs7 filesystem [maxthreads]\n");
+			return EINVAL;
+		}
+		nargs--;
+	}
+	result = checkfilesystem(nargs, args);
+	if (result) {
+		return result;
+	}
+	doscalestress(args[1], maxthreads);
+	return 0;
+}
+
 ////////////////////////////////////////////////////////////
 
 int
@@ -0,0 +1,475 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Name cache.
+ *
+ * Remembers the results of looking up names in directories, so that
+ * filesystems don't have to search the directory every time the same
+ * path is resolved. Each entry maps a (directory vnode, name) pair
+ * either to the vnode found or, for names that don't exist, to
+ * nothing (a negative entry).
+ *
+ * Entries hold a reference to the directory and to the vnode found,
+ * so neither can be reclaimed (and have its address reused) while
+ * the entry exists. This means a filesystem with entries in the
+ * cache looks busy; vfs_unmount purges them first.
+ *
+ * The cache does not know when directories change, so the filesystem
+ * is responsible for keeping it right: it must hold the directory
+ * locked across a lookup and the matching vfs_nc_enter, and call
+ * vfs_nc_remove (with the directory still locked) whenever a name is
+ * added to or removed from the directory. That covers create, link,
+ * remove, and both names involved in a rename. When a directory is
+ * removed, vfs_nc_purge throws out everything referring to it.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <synch.h>
+#include <vfs.h>
+#include <fs.h>
+#include <vnode.h>
+
+/* Number of cache entries */
+#define NC_SIZE		256
+
+/* Number of hash chains (must be a power of 2) */
+#define NC_HASH		128
+
+/* Longest name we bother to cache */
+#define NC_NAMELEN	31
+
+struct ncentry {
+	struct ncentry *nc_hashnext;	/* hash chain */
+	struct ncentry *nc_lruprev;	/* LRU list */
+	struct ncentry *nc_lrunext;
+	struct vnode *nc_dir;		/* directory (NULL if entry free) */
+	struct vnode *nc_vn;		/* vnode named (NULL if negative) */
+	unsigned nc_hashval;		/* full hash of dir and name */
+	char nc_name[NC_NAMELEN+1];	/* name */
+};
+
+static struct lock *nc_lock;
+static struct ncentry nc_entries[NC_SIZE];
+static struct ncentry *nc_hashtab[NC_HASH];
+
+/* Least recently used at the head; free entries are kept there too. */
+static struct ncentry *nc_lruhead, *nc_lrutail;
+
+static struct {
+	unsigned hits;
+	unsigned neghits;
+	unsigned misses;
+	unsigned enters;
+	unsigned removes;
+	unsigned toolong;
+} nc_stats;
+
+/*
+ * Hash a directory and name.
+ */
+static
+unsigned
+nc_hashfunc(struct vnode *dir, const char *name)
+{
+	unsigned h;
+
+	h = (unsigned)(uintptr_t)dir >> 4;
+	while (*name) {
+		h = h*31 + (unsigned char)*name++;
+	}
+	return h;
+}
+
+/*
+ * LRU list management.
+ */
+static
+void
+nc_lru_remove(struct ncentry *nc)
+{
+	if (nc->nc_lruprev != NULL) {
+		nc->nc_lruprev->nc_lrunext = nc->nc_lrunext;
+	}
+	else {
+		nc_lruhead = nc->nc_lrunext;
+	}
+	if (nc->nc_lrunext != NULL) {
+		nc->nc_lrunext->nc_lruprev = nc->nc_lruprev;
+	}
+	else {
+		nc_lrutail = nc->nc_lruprev;
+	}
+	nc->nc_lruprev = nc->nc_lrunext = NULL;
+}
+
+static
+void
+nc_lru_append(struct ncentry *nc)
+{
+	nc->nc_lrunext = NULL;
+	nc->nc_lruprev = nc_lrutail;
+	if (nc_lrutail != NULL) {
+		nc_lrutail->nc_lrunext = nc;
+	}
+	else {
+		nc_lruhead = nc;
+	}
+	nc_lrutail = nc;
+}
+
+static
+void
+nc_lru_prepend(struct ncentry *nc)
+{
+	nc->nc_lruprev = NULL;
+	nc->nc_lrunext = nc_lruhead;
+	if (nc_lruhead != NULL) {
+		nc_lruhead->nc_lruprev = nc;
+	}
+	else {
+		nc_lrutail = nc;
+	}
+	nc_lruhead = nc;
+}
+
+/*
+ * Find the entry for DIR and NAME, if there is one.
+ */
+static
+struct ncentry *
+nc_find(struct vnode *dir, const char *name, unsigned hashval)
+{
+	struct ncentry *nc;
+
+	KASSERT(lock_do_i_hold(nc_lock));
+
+	for (nc = nc_hashtab[hashval & (NC_HASH-1)];
+	     nc != NULL; nc = nc->nc_hashnext) {
+		if (nc->nc_hashval == hashval && nc->nc_dir == dir &&
+		    !strcmp(nc->nc_name, name)) {
+			return nc;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Take an entry out of the cache and move it to the front of the LRU
+ * list for reuse. The references it held are handed back through
+ * DIR_RET and VN_RET; they must be dropped after releasing nc_lock,
+ * since dropping them may reclaim the vnodes.
+ */
+static
+void
+nc_kill(struct ncentry *nc, struct vnode **dir_ret, struct vnode **vn_ret)
+{
+	struct ncentry **pp;
+
+	KASSERT(lock_do_i_hold(nc_lock));
+	KASSERT(nc->nc_dir != NULL);
+
+	for (pp = &nc_hashtab[nc->nc_hashval & (NC_HASH-1)];
+	     *pp != nc; pp = &(*pp)->nc_hashnext) {
+		KASSERT(*pp != NULL);
+	}
+	*pp = nc->nc_hashnext;
+	nc->nc_hashnext = NULL;
+
+	*dir_ret = nc->nc_dir;
+	*vn_ret = nc->nc_vn;
+	nc->nc_dir = NULL;
+	nc->nc_vn = NULL;
+
+	nc_lru_remove(nc);
+	nc_lru_prepend(nc);
+}
+
+/*
+ * Drop references handed back by nc_kill.
+ */
+static
+void
+nc_release(struct vnode *dir, struct vnode *vn)
+{
+	if (vn != NULL) {
+		VOP_DECREF(vn);
+	}
+	if (dir != NULL) {
+		VOP_DECREF(dir);
+	}
+}
+
+/*
+ * Setup function.
+ */
+void
+vfs_nc_bootstrap(void)
+{
+	unsigned i;
+
+	nc_lock = lock_create("vfs namecache");
+	if (nc_lock == NULL) {
+		panic("vfs: Could not create name cache lock\n");
+	}
+
+	for (i=0; i<NC_HASH; i++) {
+		nc_hashtab[i] = NULL;
+	}
+	nc_lruhead = nc_lrutail = NULL;
+	for (i=0; i<NC_SIZE; i++) {
+		nc_entries[i].nc_hashnext = NULL;
+		nc_entries[i].nc_dir = NULL;
+		nc_entries[i].nc_vn = NULL;
+		nc_lru_append(&nc_entries[i]);
+	}
+}
+
+/*
+ * Look up NAME in DIR. Returns false if the cache doesn't know.
+ * Otherwise returns true and sets *RET to the vnode found (with a
+ * new reference) or to NULL if NAME is known not to exist.
+ */
+bool
+vfs_nc_lookup(struct vnode *dir, const char *name, struct vnode **ret)
+{
+	struct ncentry *nc;
+	unsigned hashval;
+
+	if (strlen(name) > NC_NAMELEN) {
+		lock_acquire(nc_lock);
+		nc_stats.misses++;
+		lock_release(nc_lock);
+		return false;
+	}
+
+	hashval = nc_hashfunc(dir, name);
+
+	lock_acquire(nc_lock);
+	nc = nc_find(dir, name, hashval);
+	if (nc == NULL) {
+		nc_stats.misses++;
+		lock_release(nc_lock);
+		return false;
+	}
+
+	nc_lru_remove(nc);
+	nc_lru_append(nc);
+
+	if (nc->nc_vn != NULL) {
+		VOP_INCREF(nc->nc_vn);
+		nc_stats.hits++;
+	}
+	else {
+		nc_stats.neghits++;
+	}
+	*ret = nc->nc_vn;
+	lock_release(nc_lock);
+	return true;
+}
+
+/*
+ * Record that NAME in DIR is VN, or doesn't exist if VN is NULL.
+ */
+void
+vfs_nc_enter(struct vnode *dir, const char *name, struct vnode *vn)
+{
+	struct ncentry *nc;
+	struct vnode *olddir = NULL, *oldvn = NULL;
+	unsigned hashval, slot;
+	size_t len;
+
+	len = strlen(name);
+	if (len > NC_NAMELEN) {
+		lock_acquire(nc_lock);
+		nc_stats.toolong++;
+		lock_release(nc_lock);
+		return;
+	}
+
+	hashval = nc_hashfunc(dir, name);
+
+	lock_acquire(nc_lock);
+
+	/*
+	 * Throw out any existing entry; that puts it at the head of
+	 * the LRU list, so we reuse it. Otherwise recycle the least
+	 * recently used entry.
+	 */
+	nc = nc_find(dir, name, hashval);
+	if (nc != NULL) {
+		nc_kill(nc, &olddir, &oldvn);
+	}
+	nc = nc_lruhead;
+	KASSERT(nc != NULL);
+	if (nc->nc_dir != NULL) {
+		nc_kill(nc, &olddir, &oldvn);
+	}
+
+	VOP_INCREF(dir);
+	if (vn != NULL) {
+		VOP_INCREF(vn);
+	}
+	nc->nc_dir = dir;
+	nc->nc_vn = vn;
+	nc->nc_hashval = hashval;
+	memcpy(nc->nc_name, name, len+1);
+
+	slot = hashval & (NC_HASH-1);
+	nc->nc_hashnext = nc_hashtab[slot];
+	nc_hashtab[slot] = nc;
+
+	nc_lru_remove(nc);
+	nc_lru_append(nc);
+
+	nc_stats.enters++;
+	lock_release(nc_lock);
+
+	nc_release(olddir, oldvn);
+}
+
+/*
+ * Forget NAME in DIR.
+ */
+void
+vfs_nc_remove(struct vnode *dir, const char *name)
+{
+	struct ncentry *nc;
+	struct vnode *olddir = NULL, *oldvn = NULL;
+
+	if (strlen(name) > NC_NAMELEN) {
+		return;
+	}
+
+	lock_acquire(nc_lock);
+	nc = nc_find(dir, name, nc_hashfunc(dir, name));
+	if (nc != NULL) {
+		nc_kill(nc, &olddir, &oldvn);
+		nc_stats.removes++;
+	}
+	lock_release(nc_lock);
+
+	nc_release(olddir, oldvn);
+}
+
+/*
+ * Throw out every entry for which MATCH returns true. The references
+ * are dropped after releasing the lock, so we have to start over
+ * after each one.
+ */
+static
+void
+nc_purgeif(bool (*match)(struct ncentry *, const void *), const void *arg)
+{
+	struct vnode *olddir, *oldvn;
+	unsigned i;
+	bool found;
+
+	do {
+		found = false;
+		olddir = oldvn = NULL;
+
+		lock_acquire(nc_lock);
+		for (i=0; i<NC_SIZE; i++) {
+			if (nc_entries[i].nc_dir != NULL &&
+			    match(&nc_entries[i], arg)) {
+				nc_kill(&nc_entries[i], &olddir, &oldvn);
+				nc_stats.removes++;
+				found = true;
+				break;
+			}
+		}
+		lock_release(nc_lock);
+
+		nc_release(olddir, oldvn);
+	} while (found);
+}
+
+static
+bool
+nc_matchvn(struct ncentry *nc, const void *arg)
+{
+	return nc->nc_dir == arg || nc->nc_vn == arg;
+}
+
+static
+bool
+nc_matchfs(struct ncentry *nc, const void *arg)
+{
+	return nc->nc_dir->vn_fs == arg;
+}
+
+/*
+ * Forget everything involving VN, either as a directory or as the
+ * thing named. For rmdir and the like.
+ */
+void
+vfs_nc_purge(struct vnode *vn)
+{
+	nc_purgeif(nc_matchvn, vn);
+}
+
+/*
+ * Forget everything on filesystem FS, so it can be unmounted.
+ */
+void
+vfs_nc_purgefs(struct fs *fs)
+{
+	nc_purgeif(nc_matchfs, fs);
+}
+
+/*
+ * Print the statistics.
+ */
+void
+vfs_nc_stats(void)
+{
+	unsigned hits, neghits, misses, enters, removes, toolong, lookups;
+
+	lock_acquire(nc_lock);
+	hits = nc_stats.hits;
+	neghits = nc_stats.neghits;
+	misses = nc_stats.misses;
+	enters = nc_stats.enters;
+	removes = nc_stats.removes;
+	toolong = nc_stats.toolong;
+	lock_release(nc_lock);
+
+	lookups = hits + neghits + misses;
+	kprintf("Name cache: %u entries\n", NC_SIZE);
+	kprintf("    %u lookups: %u hits, %u negative hits, %u misses\n",
+		lookups, hits, neghits, misses);
+	if (lookups > 0) {
+		kprintf("    hit rate %u%%\n",
+			(hits + neghits) * 100 / lookups);
+	}
+	kprintf("    %u entered, %u removed, %u names too long\n",
+		enters, removes, toolong);
+}
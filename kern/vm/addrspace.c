@@ -32,7 +32,11 @@
 #include <lib.h>
 #include <addrspace.h>
 #include <vm.h>
+#include <pagetable.h>
 #include <proc.h>
+#include <cpu.h>
+#include <current.h>
+#include <spl.h>
 
 /*
  * Note! If OPT_DUMBVM is set, as is the case until you start the VM
@@ -49,29 +53,91 @@ as_create(void)
 	if (as == NULL) {
 		return NULL;
 	}
-
-	/*
-	 * Initialize as needed.
-	 */
+	as->as_pt = pt_create();
+	if (as->as_pt == NULL) {
+		kfree(as);
+		return NULL;
+	}
+	as->as_regions = NULL;
+	as->as_loading = false;
 
 	return as;
 }
 
+/*
+ * Add a region to an address space.
+ */
+static
+int
+as_addregion(struct addrspace *as, vaddr_t base, size_t npages,
+	     bool readable, bool writeable, bool executable)
+{
+	struct vm_region *vr;
+
+	vr = kmalloc(sizeof(*vr));
+	if (vr == NULL) {
+		return ENOMEM;
+	}
+	vr->vr_base = base;
+	vr->vr_npages = npages;
+	vr->vr_readable = readable;
+	vr->vr_writeable = writeable;
+	vr->vr_executable = executable;
+	vr->vr_next = as->as_regions;
+	as->as_regions = vr;
+	return 0;
+}
+
+struct vm_region *
+as_findregion(struct addrspace *as, vaddr_t vaddr)
+{
+	struct vm_region *vr;
+
+	for (vr = as->as_regions; vr != NULL; vr = vr->vr_next) {
+		if (vaddr >= vr->vr_base &&
+		    vaddr - vr->vr_base < vr->vr_npages * PAGE_SIZE) {
+			return vr;
+		}
+	}
+	return NULL;
+}
+
 int
 as_copy(struct addrspace *old, struct addrspace **ret)
 {
 	struct addrspace *newas;
+	struct vm_region *vr;
+	int result;
 
 	newas = as_create();
 	if (newas==NULL) {
 		return ENOMEM;
 	}
 
+	for (vr = old->as_regions; vr != NULL; vr = vr->vr_next) {
+		result = as_addregion(newas, vr->vr_base, vr->vr_npages,
+				      vr->vr_readable, vr->vr_writeable,
+				      vr->vr_executable);
+		if (result) {
+			as_destroy(newas);
+			return result;
+		}
+	}
+
 	/*
-	 * Write this.
+	 * Share the pages copy-on-write rather than copying them, so
+	 * fork costs only the page tables. Even if this fails partway
+	 * some of OLD's pages have been made read-only, so always
+	 * shoot down its TLB entries.
 	 */
-
-	(void)old;
+	vm_pagelock_acquire();
+	result = pt_share(old->as_pt, newas->as_pt);
+	vm_tlb_shootdown_all(old);
+	vm_pagelock_release();
+	if (result) {
+		as_destroy(newas);
+		return result;
+	}
 
 	*ret = newas;
 	return 0;
@@ -80,10 +146,16 @@ as_copy(struct addrspace *old, struct addrspace **ret)
 void
 as_destroy(struct addrspace *as)
 {
-	/*
-	 * Clean up as needed.
-	 */
+	struct vm_region *vr;
 
+	vm_pagelock_acquire();
+	pt_destroy(as->as_pt);
+	vm_pagelock_release();
+	while (as->as_regions != NULL) {
+		vr = as->as_regions;
+		as->as_regions = vr->vr_next;
+		kfree(vr);
+	}
 	kfree(as);
 }
 
@@ -91,6 +163,7 @@ void
 as_activate(void)
 {
 	struct addrspace *as;
+	int spl;
 
 	as = proc_getas();
 	if (as == NULL) {
@@ -102,17 +175,24 @@ as_activate(void)
 	}
 
 	/*
-	 * Write this.
+	 * We don't use address space IDs, so flush everything, and
+	 * note which address space this CPU's TLB now belongs to for
+	 * the benefit of TLB shootdown.
 	 */
+	spl = splhigh();
+	vm_tlb_flush();
+	curcpu->c_vmas = as;
+	splx(spl);
 }
 
 void
 as_deactivate(void)
 {
 	/*
-	 * Write this. For many designs it won't need to actually do
-	 * anything. See proc.c for an explanation of why it (might)
-	 * be needed.
+	 * Nothing to do; as_activate flushes the TLB when the next
+	 * address space is switched in, and nothing is mapped for an
+	 * address space that's being destroyed except by the process
+	 * that's destroying it.
 	 */
 }
 
@@ -122,61 +202,74 @@ as_deactivate(void)
  * VADDR+MEMSIZE.
  *
  * The READABLE, WRITEABLE, and EXECUTABLE flags are set if read,
- * write, or execute permission should be set on the segment. At the
- * moment, these are ignored. When you write the VM system, you may
- * want to implement them.
+ * write, or execute permission should be set on the segment. Writes
+ * to segments without WRITEABLE fault (except while loading); the
+ * MIPS can't distinguish the other two, so they are only recorded.
+ *
+ * No memory is allocated; pages are zero-filled on first touch.
  */
 int
 as_define_region(struct addrspace *as, vaddr_t vaddr, size_t memsize,
 		 int readable, int writeable, int executable)
 {
-	/*
-	 * Write this.
-	 */
+	struct vm_region *vr;
+	size_t npages;
+	vaddr_t top;
+
+	/* Align the region. First, the base... */
+	memsize += vaddr & ~(vaddr_t)PAGE_FRAME;
+	vaddr &= PAGE_FRAME;
+
+	/* ...and now the length. */
+	memsize = (memsize + PAGE_SIZE - 1) & PAGE_FRAME;
+	npages = memsize / PAGE_SIZE;
+
+	/* Must be in user space, below the stack, and not overlap. */
+	top = USERSTACK - VM_STACKPAGES * PAGE_SIZE;
+	if (npages == 0 || vaddr >= top || npages > (top - vaddr) / PAGE_SIZE) {
+		return EFAULT;
+	}
+	for (vr = as->as_regions; vr != NULL; vr = vr->vr_next) {
+		if (vaddr < vr->vr_base + vr->vr_npages * PAGE_SIZE &&
+		    vr->vr_base < vaddr + memsize) {
+			return EINVAL;
+		}
+	}
 
-	(void)as;
-	(void)vaddr;
-	(void)memsize;
-	(void)readable;
-	(void)writeable;
-	(void)executable;
-	return ENOSYS;
+	return as_addregion(as, vaddr, npages,
+			    readable != 0, writeable != 0, executable != 0);
 }
 
 int
 as_prepare_load(struct addrspace *as)
 {
-	/*
-	 * Write this.
-	 */
-
-	(void)as;
+	as->as_loading = true;
 	return 0;
 }
 
 int
 as_complete_load(struct addrspace *as)
 {
-	/*
-	 * Write this.
-	 */
+	as->as_loading = false;
 
-	(void)as;
+	/* Get rid of any writeable mappings of read-only pages. */
+	vm_tlb_flush();
 	return 0;
 }
 
 int
 as_define_stack(struct addrspace *as, vaddr_t *stackptr)
 {
-	/*
-	 * Write this.
-	 */
+	int result;
 
-	(void)as;
+	result = as_addregion(as, USERSTACK - VM_STACKPAGES * PAGE_SIZE,
+			      VM_STACKPAGES, true, true, false);
+	if (result) {
+		return result;
+	}
 
 	/* Initial user-level stack pointer */
 	*stackptr = USERSTACK;
 
 	return 0;
 }
-
@@ -0,0 +1,696 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Physical memory management: the coremap.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <cpu.h>
+#include <thread.h>
+#include <current.h>
+#include <addrspace.h>
+#include <vm.h>
+#include <coremap.h>
+#include <pagetable.h>
+#include <swap.h>
+
+/* Frame states */
+#define CME_FREE	0	/* available */
+#define CME_KERNEL	1	/* kernel memory (alloc_kpages) */
+#define CME_USER	2	/* user page (coremap_alloc_upage) */
+
+/*
+ * A user page is normally owned by one address space, recorded in
+ * cme_as and cme_vaddr. After fork it may be shared copy-on-write by
+ * several; then cme_refcount counts them and cme_as is NULL, since
+ * no single owner can be named. Once the others have let go, the
+ * last sharer becomes its owner again the next time it faults on the
+ * page, whether reading or writing (see coremap_reown_upage). Only
+ * pages with an owner can be evicted, so a page that the last sharer
+ * never faults on again (because it stays in the TLB, or is never
+ * touched) remains pinned until that sharer frees it.
+ *
+ * A user page is clean if its contents are also in swap; then
+ * cme_swapslot is that slot, and the page is kept write-protected in
+ * the TLB so that the first write (which makes the swap copy stale)
+ * can drop the slot. Otherwise cme_swapslot is CME_NOSLOT and the
+ * page has to be written out before it can be evicted.
+ *
+ * cme_referenced is set whenever the page is loaded into a TLB and
+ * cleared by the clock hand; see coremap_evict.
+ *
+ * The fields of user pages other than cme_state only change with the
+ * paging lock held (as well as cm_lock), so the eviction code, which
+ * holds the paging lock, can look at them without cm_lock.
+ */
+struct coremap_entry {
+	struct addrspace *cme_as;	/* owner of a user page, or NULL */
+	vaddr_t cme_vaddr;		/* virtual address of a user page */
+	unsigned cme_npages;		/* length of kernel block, at start */
+	unsigned cme_refcount;		/* mappings of a user page */
+	unsigned cme_swapslot;		/* copy in swap, or CME_NOSLOT */
+	bool cme_referenced;		/* used since the clock hand passed */
+	unsigned char cme_state;	/* CME_* */
+};
+
+#define CME_NOSLOT	((unsigned)-1)
+
+/*
+ * Number of dirty pages to write back together when eviction finds
+ * no clean ones.
+ */
+#define CM_CLEANBATCH	8
+
+/*
+ * The coremap itself, indexed by physical page number. It covers all
+ * of memory; pages below cm_base were already taken when we started
+ * and are marked as kernel pages that will never be freed.
+ *
+ * cm_clock is the clock hand used for choosing pages to evict.
+ *
+ * cm_next is where the next single-page search starts; it rotates
+ * around memory so repeated allocation doesn't rescan the in-use
+ * pages at the bottom every time.
+ */
+static struct coremap_entry *coremap;
+static unsigned cm_npages;		/* total pages */
+static unsigned cm_base;		/* first managed page */
+static unsigned cm_next;		/* search hint */
+static unsigned cm_clock;		/* eviction clock hand */
+static unsigned cm_nfree;		/* free pages */
+static unsigned cm_nkernel;		/* kernel pages */
+static unsigned cm_nuser;		/* user pages */
+static unsigned cm_nevicted;		/* pages evicted */
+static unsigned cm_ncleaned;		/* dirty pages written back */
+static bool cm_ready;			/* coremap_bootstrap has run */
+static struct spinlock cm_lock = SPINLOCK_INITIALIZER;
+
+/*
+ * Take over physical memory. Until this runs, alloc_kpages steals
+ * memory directly from ram.c and free_kpages leaks it.
+ */
+void
+coremap_bootstrap(void)
+{
+	paddr_t lastpaddr, firstpaddr, cmpaddr;
+	unsigned cmpages, i;
+
+	lastpaddr = ram_getsize();
+	cm_npages = lastpaddr / PAGE_SIZE;
+
+	cmpages = DIVROUNDUP(cm_npages * sizeof(struct coremap_entry),
+			     PAGE_SIZE);
+	cmpaddr = ram_stealmem(cmpages);
+	if (cmpaddr == 0) {
+		panic("coremap: no memory for the coremap\n");
+	}
+	coremap = (struct coremap_entry *)PADDR_TO_KVADDR(cmpaddr);
+
+	firstpaddr = ram_getfirstfree();
+	cm_base = firstpaddr / PAGE_SIZE;
+	KASSERT(cm_base > 0 && cm_base < cm_npages);
+
+	for (i=0; i<cm_npages; i++) {
+		coremap[i].cme_as = NULL;
+		coremap[i].cme_vaddr = 0;
+		coremap[i].cme_refcount = 0;
+		coremap[i].cme_swapslot = CME_NOSLOT;
+		coremap[i].cme_referenced = false;
+		if (i < cm_base) {
+			coremap[i].cme_state = CME_KERNEL;
+			coremap[i].cme_npages = 1;
+		}
+		else {
+			coremap[i].cme_state = CME_FREE;
+			coremap[i].cme_npages = 0;
+		}
+	}
+	cm_next = cm_base;
+	cm_clock = cm_base;
+	cm_nfree = cm_npages - cm_base;
+	cm_nkernel = cm_base;
+	cm_nuser = 0;
+
+	spinlock_acquire(&cm_lock);
+	cm_ready = true;
+	spinlock_release(&cm_lock);
+}
+
+/*
+ * Find and claim one free page. Returns the page number, or 0 (which
+ * is never a managed page; it holds the exception handlers).
+ */
+static
+unsigned
+coremap_getpage(unsigned state)
+{
+	unsigned i, ix;
+
+	KASSERT(spinlock_do_i_hold(&cm_lock));
+
+	if (cm_nfree == 0) {
+		return 0;
+	}
+	for (i=0; i<cm_npages - cm_base; i++) {
+		ix = cm_next + i;
+		if (ix >= cm_npages) {
+			ix -= cm_npages - cm_base;
+		}
+		if (coremap[ix].cme_state == CME_FREE) {
+			coremap[ix].cme_state = state;
+			coremap[ix].cme_npages = 1;
+			cm_next = ix + 1 < cm_npages ? ix + 1 : cm_base;
+			cm_nfree--;
+			return ix;
+		}
+	}
+	panic("coremap: free count is %u but found no free page\n", cm_nfree);
+}
+
+/*
+ * Find and claim NPAGES contiguous free pages for the kernel, first
+ * fit. Returns the first page number, or 0.
+ */
+static
+unsigned
+coremap_getrun(unsigned npages)
+{
+	unsigned start, len, i;
+
+	KASSERT(spinlock_do_i_hold(&cm_lock));
+
+	if (cm_nfree < npages) {
+		return 0;
+	}
+	start = cm_base;
+	len = 0;
+	for (i=cm_base; i<cm_npages && len<npages; i++) {
+		if (coremap[i].cme_state == CME_FREE) {
+			len++;
+		}
+		else {
+			start = i + 1;
+			len = 0;
+		}
+	}
+	if (len < npages) {
+		return 0;
+	}
+	for (i=start; i<start+npages; i++) {
+		coremap[i].cme_state = CME_KERNEL;
+		coremap[i].cme_npages = 0;
+	}
+	coremap[start].cme_npages = npages;
+	cm_nfree -= npages;
+	return start;
+}
+
+/*
+ * Release pages from ix to ix+npages.
+ */
+static
+void
+coremap_putpages(unsigned ix, unsigned npages)
+{
+	unsigned i;
+
+	KASSERT(spinlock_do_i_hold(&cm_lock));
+	KASSERT(ix >= cm_base && ix + npages <= cm_npages);
+
+	for (i=ix; i<ix+npages; i++) {
+		KASSERT(coremap[i].cme_state != CME_FREE);
+		coremap[i].cme_state = CME_FREE;
+		coremap[i].cme_npages = 0;
+		coremap[i].cme_as = NULL;
+		coremap[i].cme_vaddr = 0;
+		coremap[i].cme_refcount = 0;
+		coremap[i].cme_referenced = false;
+		KASSERT(coremap[i].cme_swapslot == CME_NOSLOT);
+	}
+	cm_nfree += npages;
+}
+
+////////////////////////////////////////////////////////////
+// eviction
+
+/*
+ * Evict one user page to free its frame. Called with the paging lock
+ * held.
+ *
+ * This is the clock algorithm with a second chance: the hand sweeps
+ * around memory, skipping kernel pages and pages shared after fork,
+ * and clearing the referenced bit of pages that have it. (So that the
+ * bit means something, clearing it also has to drop the page from
+ * every TLB; the next use faults and sets it again. Rather than a
+ * shootdown per page, all the TLBs involved are flushed once when
+ * the sweep is over: those of the one address space whose pages were
+ * cleared, or everyone's if there was more than one. Until then
+ * nobody can fault a page back in, since that takes the paging lock,
+ * and none of the pages cleared are evicted this time around.) The
+ * first unreferenced clean page is the victim, and costs no I/O to
+ * evict.
+ *
+ * Dirty unreferenced pages are collected along the way, and if the
+ * hand gets CM_CLEANBATCH of them before finding a clean page, they
+ * are all written to swap together and the first one is evicted. The
+ * rest stay resident but are now clean, so the next few evictions
+ * will find them without doing any I/O.
+ *
+ * The shootdowns wait for the other CPUs, so by the time a page is
+ * copied to swap nobody can still be writing it, and by the time its
+ * frame is freed nobody can still be using it.
+ */
+static
+int
+coremap_evict(void)
+{
+	unsigned batch[CM_CLEANBATCH];
+	unsigned nbatch, victim, ix, i, slot, scanned;
+	struct coremap_entry *cme;
+	struct addrspace *clearedas;
+	bool cleared;
+	pte_t *pte;
+	int result;
+
+	KASSERT(vm_pagelock_held());
+
+	victim = 0;
+	nbatch = 0;
+	cleared = false;
+	clearedas = NULL;
+
+	spinlock_acquire(&cm_lock);
+	for (scanned = 0; scanned < 2 * (cm_npages - cm_base); scanned++) {
+		ix = cm_clock;
+		cm_clock = ix + 1 < cm_npages ? ix + 1 : cm_base;
+
+		cme = &coremap[ix];
+		if (cme->cme_state != CME_USER || cme->cme_as == NULL) {
+			continue;
+		}
+		if (cme->cme_referenced) {
+			cme->cme_referenced = false;
+			if (!cleared) {
+				cleared = true;
+				clearedas = cme->cme_as;
+			}
+			else if (clearedas != cme->cme_as) {
+				/* More than one; flush them all */
+				clearedas = NULL;
+			}
+			continue;
+		}
+		if (cme->cme_swapslot != CME_NOSLOT) {
+			victim = ix;
+			break;
+		}
+		batch[nbatch++] = ix;
+		if (nbatch == CM_CLEANBATCH) {
+			break;
+		}
+	}
+	spinlock_release(&cm_lock);
+
+	if (cleared) {
+		vm_tlb_shootdown_all(clearedas);
+	}
+
+	if (victim == 0) {
+		/* No clean page; write back the dirty ones we found. */
+		result = ENOMEM;
+		for (i=0; i<nbatch; i++) {
+			cme = &coremap[batch[i]];
+			result = swap_alloc(&slot);
+			if (result) {
+				break;
+			}
+			/* Write-protect it so it can't change underneath. */
+			vm_tlb_shootdown(cme->cme_as, cme->cme_vaddr);
+			result = swap_write(slot, (paddr_t)batch[i] * PAGE_SIZE);
+			if (result) {
+				swap_free(slot);
+				break;
+			}
+			spinlock_acquire(&cm_lock);
+			cme->cme_swapslot = slot;
+			cm_ncleaned++;
+			spinlock_release(&cm_lock);
+			if (victim == 0) {
+				victim = batch[i];
+			}
+		}
+		if (victim == 0) {
+			return result;
+		}
+	}
+
+	/*
+	 * Point the owner's page table entry at the swap copy; the
+	 * slot reference passes from the frame to the entry.
+	 */
+	cme = &coremap[victim];
+	pte = pt_lookup(cme->cme_as->as_pt, cme->cme_vaddr, false);
+	KASSERT(pte != NULL);
+	KASSERT((*pte & (PTE_VALID | PTE_COW)) == PTE_VALID);
+	KASSERT((*pte & PAGE_FRAME) == (paddr_t)victim * PAGE_SIZE);
+	vm_tlb_shootdown(cme->cme_as, cme->cme_vaddr);
+	*pte = PTE_MKSWAP(cme->cme_swapslot);
+
+	spinlock_acquire(&cm_lock);
+	cme->cme_swapslot = CME_NOSLOT;
+	coremap_putpages(victim, 1);
+	cm_nuser--;
+	cm_nevicted++;
+	spinlock_release(&cm_lock);
+
+	return 0;
+}
+
+/*
+ * Try to free a page by evicting something, on behalf of a caller
+ * that found memory full. Only possible if we can sleep.
+ */
+static
+int
+coremap_reclaim(void)
+{
+	bool held;
+	int result;
+
+	if (curthread->t_in_interrupt || curcpu->c_spinlocks > 0) {
+		return ENOMEM;
+	}
+
+	held = vm_pagelock_held();
+	if (!held) {
+		vm_pagelock_acquire();
+	}
+	result = coremap_evict();
+	if (!held) {
+		vm_pagelock_release();
+	}
+	return result;
+}
+
+////////////////////////////////////////////////////////////
+// kernel pages
+
+static struct spinlock stealmem_lock = SPINLOCK_INITIALIZER;
+
+vaddr_t
+alloc_kpages(unsigned npages)
+{
+	paddr_t pa;
+	unsigned ix;
+
+	KASSERT(npages > 0);
+
+	spinlock_acquire(&cm_lock);
+	if (!cm_ready) {
+		spinlock_release(&cm_lock);
+		spinlock_acquire(&stealmem_lock);
+		pa = ram_stealmem(npages);
+		spinlock_release(&stealmem_lock);
+		return pa == 0 ? 0 : PADDR_TO_KVADDR(pa);
+	}
+
+	if (npages == 1) {
+		/*
+		 * If memory is full, page something out. (Not for
+		 * multi-page blocks: evicting pages one at a time
+		 * doesn't make contiguous space.)
+		 */
+		while ((ix = coremap_getpage(CME_KERNEL)) == 0) {
+			spinlock_release(&cm_lock);
+			if (coremap_reclaim()) {
+				return 0;
+			}
+			spinlock_acquire(&cm_lock);
+		}
+	}
+	else {
+		ix = coremap_getrun(npages);
+	}
+	if (ix != 0) {
+		cm_nkernel += npages;
+	}
+	spinlock_release(&cm_lock);
+
+	if (ix == 0) {
+		return 0;
+	}
+	return PADDR_TO_KVADDR((paddr_t)ix * PAGE_SIZE);
+}
+
+void
+free_kpages(vaddr_t addr)
+{
+	unsigned ix, npages;
+
+	ix = KVADDR_TO_PADDR(addr) / PAGE_SIZE;
+
+	spinlock_acquire(&cm_lock);
+	if (!cm_ready || ix < cm_base) {
+		/* Memory from before we started; just leak it. */
+		spinlock_release(&cm_lock);
+		return;
+	}
+	KASSERT(ix < cm_npages);
+	KASSERT(coremap[ix].cme_state == CME_KERNEL);
+	npages = coremap[ix].cme_npages;
+	KASSERT(npages > 0);
+	coremap_putpages(ix, npages);
+	cm_nkernel -= npages;
+	spinlock_release(&cm_lock);
+}
+
+////////////////////////////////////////////////////////////
+// user pages
+
+/*
+ * Claim a frame for user page VADDR of AS, without initializing it,
+ * evicting something if necessary.
+ */
+static
+paddr_t
+coremap_getupage(struct addrspace *as, vaddr_t vaddr)
+{
+	unsigned ix;
+
+	KASSERT(cm_ready);
+	KASSERT(vm_pagelock_held());
+
+	spinlock_acquire(&cm_lock);
+	while ((ix = coremap_getpage(CME_USER)) == 0) {
+		spinlock_release(&cm_lock);
+		if (coremap_evict()) {
+			return 0;
+		}
+		spinlock_acquire(&cm_lock);
+	}
+	coremap[ix].cme_as = as;
+	coremap[ix].cme_vaddr = vaddr;
+	coremap[ix].cme_refcount = 1;
+	coremap[ix].cme_referenced = true;
+	cm_nuser++;
+	spinlock_release(&cm_lock);
+
+	return (paddr_t)ix * PAGE_SIZE;
+}
+
+paddr_t
+coremap_alloc_upage(struct addrspace *as, vaddr_t vaddr)
+{
+	paddr_t pa;
+
+	pa = coremap_getupage(as, vaddr);
+	if (pa != 0) {
+		bzero((void *)PADDR_TO_KVADDR(pa), PAGE_SIZE);
+	}
+	return pa;
+}
+
+paddr_t
+coremap_copy_upage(struct addrspace *as, vaddr_t vaddr, paddr_t srcpa)
+{
+	paddr_t pa;
+
+	pa = coremap_getupage(as, vaddr);
+	if (pa != 0) {
+		memcpy((void *)PADDR_TO_KVADDR(pa),
+		       (const void *)PADDR_TO_KVADDR(srcpa), PAGE_SIZE);
+	}
+	return pa;
+}
+
+int
+coremap_swapin_upage(struct addrspace *as, vaddr_t vaddr, unsigned slot,
+		     paddr_t *ret)
+{
+	paddr_t pa;
+	int result;
+
+	pa = coremap_getupage(as, vaddr);
+	if (pa == 0) {
+		return ENOMEM;
+	}
+	result = swap_read(slot, pa);
+	if (result) {
+		coremap_free_upage(pa);
+		return result;
+	}
+
+	/* The caller's reference to the slot passes to the frame. */
+	spinlock_acquire(&cm_lock);
+	coremap[pa / PAGE_SIZE].cme_swapslot = slot;
+	spinlock_release(&cm_lock);
+
+	*ret = pa;
+	return 0;
+}
+
+/*
+ * Look up the coremap entry for user frame PA. Caller holds cm_lock.
+ */
+static
+struct coremap_entry *
+coremap_uentry(paddr_t pa)
+{
+	unsigned ix;
+
+	KASSERT(spinlock_do_i_hold(&cm_lock));
+	KASSERT((pa & PAGE_FRAME) == pa);
+	ix = pa / PAGE_SIZE;
+	KASSERT(ix >= cm_base && ix < cm_npages);
+	KASSERT(coremap[ix].cme_state == CME_USER);
+	KASSERT(coremap[ix].cme_refcount > 0);
+	return &coremap[ix];
+}
+
+void
+coremap_share_upage(paddr_t pa)
+{
+	struct coremap_entry *cme;
+
+	spinlock_acquire(&cm_lock);
+	cme = coremap_uentry(pa);
+	cme->cme_refcount++;
+	cme->cme_as = NULL;
+	spinlock_release(&cm_lock);
+}
+
+bool
+coremap_reown_upage(paddr_t pa, struct addrspace *as, vaddr_t vaddr)
+{
+	struct coremap_entry *cme;
+	bool ret;
+
+	spinlock_acquire(&cm_lock);
+	cme = coremap_uentry(pa);
+	ret = cme->cme_refcount == 1;
+	if (ret) {
+		cme->cme_as = as;
+		cme->cme_vaddr = vaddr;
+	}
+	spinlock_release(&cm_lock);
+	return ret;
+}
+
+bool
+coremap_touch_upage(paddr_t pa, bool write)
+{
+	struct coremap_entry *cme;
+	unsigned slot;
+
+	spinlock_acquire(&cm_lock);
+	cme = coremap_uentry(pa);
+	cme->cme_referenced = true;
+	slot = cme->cme_swapslot;
+	if (write) {
+		/* The swap copy is about to be stale. */
+		cme->cme_swapslot = CME_NOSLOT;
+	}
+	spinlock_release(&cm_lock);
+
+	if (slot == CME_NOSLOT) {
+		return true;
+	}
+	if (write) {
+		swap_free(slot);
+		return true;
+	}
+	return false;
+}
+
+void
+coremap_free_upage(paddr_t pa)
+{
+	struct coremap_entry *cme;
+	unsigned slot;
+
+	slot = CME_NOSLOT;
+
+	spinlock_acquire(&cm_lock);
+	cme = coremap_uentry(pa);
+	cme->cme_refcount--;
+	if (cme->cme_refcount == 0) {
+		slot = cme->cme_swapslot;
+		cme->cme_swapslot = CME_NOSLOT;
+		coremap_putpages(pa / PAGE_SIZE, 1);
+		cm_nuser--;
+	}
+	spinlock_release(&cm_lock);
+
+	if (slot != CME_NOSLOT) {
+		swap_free(slot);
+	}
+}
+
+void
+coremap_stats(void)
+{
+	unsigned nfree, nkernel, nuser, nevicted, ncleaned;
+
+	spinlock_acquire(&cm_lock);
+	nfree = cm_nfree;
+	nkernel = cm_nkernel;
+	nuser = cm_nuser;
+	nevicted = cm_nevicted;
+	ncleaned = cm_ncleaned;
+	spinlock_release(&cm_lock);
+
+	kprintf("coremap: %u pages: %u kernel, %u user, %u free\n",
+		cm_npages, nkernel, nuser, nfree);
+	kprintf("coremap: %u evictions, %u dirty pages written back\n",
+		nevicted, ncleaned);
+}
@@ -0,0 +1,154 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Two-level page tables. See pagetable.h.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <vm.h>
+#include <coremap.h>
+#include <swap.h>
+#include <pagetable.h>
+
+struct pagetable *
+pt_create(void)
+{
+	struct pagetable *pt;
+	unsigned i;
+
+	pt = kmalloc(sizeof(*pt));
+	if (pt == NULL) {
+		return NULL;
+	}
+	for (i=0; i<PT_NDIR; i++) {
+		pt->pt_dir[i] = NULL;
+	}
+	return pt;
+}
+
+/*
+ * Destroy a page table, releasing every page it maps, both resident
+ * and swapped.
+ */
+void
+pt_destroy(struct pagetable *pt)
+{
+	pte_t *ptes;
+	unsigned i, j;
+
+	for (i=0; i<PT_NDIR; i++) {
+		ptes = pt->pt_dir[i];
+		if (ptes == NULL) {
+			continue;
+		}
+		for (j=0; j<PT_NENT; j++) {
+			if (ptes[j] & PTE_VALID) {
+				coremap_free_upage(ptes[j] & PAGE_FRAME);
+			}
+			else if (ptes[j] & PTE_SWAPPED) {
+				swap_free(PTE_SWAPSLOT(ptes[j]));
+			}
+		}
+		kfree(ptes);
+	}
+	kfree(pt);
+}
+
+/*
+ * Return the page table entry for VA. If its second-level table
+ * doesn't exist, create it if CREATE is set and otherwise return
+ * NULL. (NULL with CREATE set means out of memory.)
+ */
+pte_t *
+pt_lookup(struct pagetable *pt, vaddr_t va, bool create)
+{
+	pte_t *ptes;
+	unsigned j;
+
+	ptes = pt->pt_dir[PT_DIRINDEX(va)];
+	if (ptes == NULL) {
+		if (!create) {
+			return NULL;
+		}
+		ptes = kmalloc(PT_NENT * sizeof(pte_t));
+		if (ptes == NULL) {
+			return NULL;
+		}
+		for (j=0; j<PT_NENT; j++) {
+			ptes[j] = 0;
+		}
+		pt->pt_dir[PT_DIRINDEX(va)] = ptes;
+	}
+	return &ptes[PT_ENTINDEX(va)];
+}
+
+/*
+ * Make NEW, which must be empty, map the same pages as OLD, with
+ * every resident page shared copy-on-write and every swapped page
+ * sharing its swap slot. The second-level tables
+ * are copied (they're cheap, and it keeps every page table private
+ * to its address space); the pages themselves are not. On failure
+ * NEW may be partly filled in; the caller destroys it.
+ *
+ * The caller must shoot down OLD's TLB entries afterwards, since
+ * pages that were writable no longer are.
+ */
+int
+pt_share(struct pagetable *old, struct pagetable *new)
+{
+	pte_t *oldptes, *newptes;
+	unsigned i, j;
+
+	for (i=0; i<PT_NDIR; i++) {
+		oldptes = old->pt_dir[i];
+		if (oldptes == NULL) {
+			continue;
+		}
+		KASSERT(new->pt_dir[i] == NULL);
+		newptes = kmalloc(PT_NENT * sizeof(pte_t));
+		if (newptes == NULL) {
+			return ENOMEM;
+		}
+		for (j=0; j<PT_NENT; j++) {
+			if (oldptes[j] & PTE_VALID) {
+				oldptes[j] |= PTE_COW;
+				coremap_share_upage(oldptes[j] & PAGE_FRAME);
+			}
+			else if (oldptes[j] & PTE_SWAPPED) {
+				swap_incref(PTE_SWAPSLOT(oldptes[j]));
+			}
+			newptes[j] = oldptes[j];
+		}
+		new->pt_dir[i] = newptes;
+	}
+	return 0;
+}
@@ -0,0 +1,244 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Swap space. See swap.h.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/stat.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <bitmap.h>
+#include <uio.h>
+#include <vfs.h>
+#include <vnode.h>
+#include <vm.h>
+#include <pagetable.h>
+#include <swap.h>
+
+/*
+ * The slot number has to fit in the page-number bits of a page table
+ * entry (see PTE_MKSWAP), which limits swap to 4G.
+ */
+#define SWAP_MAXSLOTS	(1U << 20)
+
+static struct vnode *sw_vnode;		/* the device, or NULL */
+static unsigned sw_nslots;		/* number of slots */
+static struct bitmap *sw_map;		/* slots in use */
+static unsigned *sw_refcount;		/* references to each slot */
+static unsigned sw_inuse;		/* slots in use */
+static unsigned sw_reads;		/* pages swapped in */
+static unsigned sw_writes;		/* pages swapped out */
+
+/* Protects the above, once attached; the I/O needs no lock. */
+static struct spinlock sw_lock = SPINLOCK_INITIALIZER;
+
+int
+swap_attach(const char *devname)
+{
+	struct vnode *vn;
+	struct stat st;
+	struct bitmap *map;
+	unsigned *refcount;
+	unsigned nslots, i;
+	int result;
+
+	result = vfs_swapon(devname, &vn);
+	if (result) {
+		return result;
+	}
+
+	result = VOP_STAT(vn, &st);
+	if (result) {
+		goto fail;
+	}
+	nslots = st.st_size / PAGE_SIZE;
+	if (nslots > SWAP_MAXSLOTS) {
+		nslots = SWAP_MAXSLOTS;
+	}
+	if (nslots == 0) {
+		result = ENOSPC;
+		goto fail;
+	}
+
+	map = bitmap_create(nslots);
+	if (map == NULL) {
+		result = ENOMEM;
+		goto fail;
+	}
+	refcount = kmalloc(nslots * sizeof(unsigned));
+	if (refcount == NULL) {
+		bitmap_destroy(map);
+		result = ENOMEM;
+		goto fail;
+	}
+	for (i=0; i<nslots; i++) {
+		refcount[i] = 0;
+	}
+
+	spinlock_acquire(&sw_lock);
+	if (sw_vnode != NULL) {
+		spinlock_release(&sw_lock);
+		kfree(refcount);
+		bitmap_destroy(map);
+		result = EBUSY;
+		goto fail;
+	}
+	sw_map = map;
+	sw_refcount = refcount;
+	sw_nslots = nslots;
+	sw_vnode = vn;
+	spinlock_release(&sw_lock);
+
+	kprintf("swap: %u pages (%uK) on %s\n", nslots,
+		nslots * (PAGE_SIZE / 1024), devname);
+	return 0;
+
+ fail:
+	VOP_DECREF(vn);
+	vfs_swapoff(devname);
+	return result;
+}
+
+int
+swap_alloc(unsigned *ret)
+{
+	unsigned slot;
+
+	spinlock_acquire(&sw_lock);
+	if (sw_vnode == NULL || bitmap_alloc(sw_map, &slot)) {
+		spinlock_release(&sw_lock);
+		return ENOSPC;
+	}
+	KASSERT(sw_refcount[slot] == 0);
+	sw_refcount[slot] = 1;
+	sw_inuse++;
+	spinlock_release(&sw_lock);
+
+	*ret = slot;
+	return 0;
+}
+
+void
+swap_incref(unsigned slot)
+{
+	spinlock_acquire(&sw_lock);
+	KASSERT(slot < sw_nslots);
+	KASSERT(sw_refcount[slot] > 0);
+	sw_refcount[slot]++;
+	spinlock_release(&sw_lock);
+}
+
+void
+swap_free(unsigned slot)
+{
+	spinlock_acquire(&sw_lock);
+	KASSERT(slot < sw_nslots);
+	KASSERT(sw_refcount[slot] > 0);
+	sw_refcount[slot]--;
+	if (sw_refcount[slot] == 0) {
+		bitmap_unmark(sw_map, slot);
+		sw_inuse--;
+	}
+	spinlock_release(&sw_lock);
+}
+
+/*
+ * Move one page between memory and a slot.
+ */
+static
+int
+swap_io(unsigned slot, paddr_t pa, enum uio_rw rw)
+{
+	struct iovec iov;
+	struct uio ku;
+	int result;
+
+	KASSERT(slot < sw_nslots);
+	KASSERT((pa & PAGE_FRAME) == pa);
+
+	uio_kinit(&iov, &ku, (void *)PADDR_TO_KVADDR(pa), PAGE_SIZE,
+		  (off_t)slot * PAGE_SIZE, rw);
+	if (rw == UIO_READ) {
+		result = VOP_READ(sw_vnode, &ku);
+	}
+	else {
+		result = VOP_WRITE(sw_vnode, &ku);
+	}
+	if (result) {
+		return result;
+	}
+	if (ku.uio_resid != 0) {
+		return EIO;
+	}
+
+	spinlock_acquire(&sw_lock);
+	if (rw == UIO_READ) {
+		sw_reads++;
+	}
+	else {
+		sw_writes++;
+	}
+	spinlock_release(&sw_lock);
+	return 0;
+}
+
+int
+swap_read(unsigned slot, paddr_t pa)
+{
+	return swap_io(slot, pa, UIO_READ);
+}
+
+int
+swap_write(unsigned slot, paddr_t pa)
+{
+	return swap_io(slot, pa, UIO_WRITE);
+}
+
+void
+swap_stats(void)
+{
+	unsigned nslots, inuse, reads, writes;
+
+	spinlock_acquire(&sw_lock);
+	nslots = sw_nslots;
+	inuse = sw_inuse;
+	reads = sw_reads;
+	writes = sw_writes;
+	spinlock_release(&sw_lock);
+
+	if (nslots == 0) {
+		kprintf("swap: none\n");
+		return;
+	}
+	kprintf("swap: %u of %u pages in use; %u swap-ins, %u swap-outs\n",
+		inuse, nslots, reads, writes);
+}
@@ -0,0 +1,232 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Machine-independent VM system: initialization and page faults.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <synch.h>
+#include <proc.h>
+#include <current.h>
+#include <addrspace.h>
+#include <vm.h>
+#include <coremap.h>
+#include <pagetable.h>
+#include <swap.h>
+
+static struct lock *vm_pagelock;
+
+/* Fault statistics; protected by vm_pagelock. */
+static unsigned vm_nfaults;		/* faults handled */
+static unsigned vm_nzerofills;		/* pages created zero-filled */
+static unsigned vm_nswapins;		/* pages read back from swap */
+static unsigned vm_ncowcopies;		/* pages copied on write */
+
+void
+vm_bootstrap(void)
+{
+	coremap_bootstrap();
+	vm_pagelock = lock_create("vm_pagelock");
+	if (vm_pagelock == NULL) {
+		panic("vm: Could not create paging lock\n");
+	}
+	vm_tlb_bootstrap();
+}
+
+void
+vm_pagelock_acquire(void)
+{
+	lock_acquire(vm_pagelock);
+}
+
+void
+vm_pagelock_release(void)
+{
+	lock_release(vm_pagelock);
+}
+
+bool
+vm_pagelock_held(void)
+{
+	return vm_pagelock != NULL && lock_do_i_hold(vm_pagelock);
+}
+
+void
+vm_printstats(void)
+{
+	unsigned nfaults, nzerofills, nswapins, ncowcopies;
+
+	lock_acquire(vm_pagelock);
+	nfaults = vm_nfaults;
+	nzerofills = vm_nzerofills;
+	nswapins = vm_nswapins;
+	ncowcopies = vm_ncowcopies;
+	lock_release(vm_pagelock);
+
+	kprintf("vm: %u faults: %u zero-filled, %u from swap, "
+		"%u copied on write\n",
+		nfaults, nzerofills, nswapins, ncowcopies);
+	coremap_stats();
+	swap_stats();
+}
+
+/*
+ * Handle a TLB miss or protection fault on a user address.
+ *
+ * Look up the region containing the address to check that the
+ * access is legal, then find the page (reading it back from swap if
+ * it was evicted, or creating it zero-filled if it has never been
+ * touched) and load the mapping into the TLB. Clean pages, whose
+ * contents are also in swap, are mapped read-only until written.
+ * Pages shared copy-on-write since fork are mapped read-only, and
+ * copied (if still shared) on the first write, which arrives here as
+ * VM_FAULT_READONLY.
+ */
+int
+vm_fault(int faulttype, vaddr_t faultaddress)
+{
+	struct addrspace *as;
+	struct vm_region *vr;
+	pte_t *pte;
+	paddr_t pa, newpa;
+	bool writable;
+	int result;
+
+	faultaddress &= PAGE_FRAME;
+
+	DEBUG(DB_VM, "vm: fault: 0x%x\n", faultaddress);
+
+	switch (faulttype) {
+	    case VM_FAULT_READONLY:
+	    case VM_FAULT_READ:
+	    case VM_FAULT_WRITE:
+		break;
+	    default:
+		return EINVAL;
+	}
+
+	if (curproc == NULL) {
+		/*
+		 * No process. This is probably a kernel fault early
+		 * in boot. Return EFAULT so as to panic instead of
+		 * getting into an infinite faulting loop.
+		 */
+		return EFAULT;
+	}
+
+	as = proc_getas();
+	if (as == NULL) {
+		/*
+		 * No address space set up. This is probably also a
+		 * kernel fault early in boot.
+		 */
+		return EFAULT;
+	}
+
+	vr = as_findregion(as, faultaddress);
+	if (vr == NULL) {
+		return EFAULT;
+	}
+	writable = vr->vr_writeable || as->as_loading;
+	if (faulttype != VM_FAULT_READ && !writable) {
+		return EFAULT;
+	}
+
+	vm_pagelock_acquire();
+	vm_nfaults++;
+
+	pte = pt_lookup(as->as_pt, faultaddress, true);
+	if (pte == NULL) {
+		vm_pagelock_release();
+		return ENOMEM;
+	}
+	if (*pte & PTE_SWAPPED) {
+		result = coremap_swapin_upage(as, faultaddress,
+					      PTE_SWAPSLOT(*pte), &pa);
+		if (result) {
+			vm_pagelock_release();
+			return result;
+		}
+		*pte = pa | PTE_VALID;
+		vm_nswapins++;
+	}
+	else if ((*pte & PTE_VALID) == 0) {
+		/* First touch: zero-fill. */
+		pa = coremap_alloc_upage(as, faultaddress);
+		if (pa == 0) {
+			vm_pagelock_release();
+			return ENOMEM;
+		}
+		*pte = pa | PTE_VALID;
+		vm_nzerofills++;
+	}
+	pa = *pte & PAGE_FRAME;
+
+	if (*pte & PTE_COW) {
+		if (coremap_reown_upage(pa, as, faultaddress)) {
+			/*
+			 * Everyone else has let go of it; it's ours. Do
+			 * this on reads too, so pages that are only read
+			 * after fork can be evicted again.
+			 */
+			*pte &= ~PTE_COW;
+		}
+		else if (faulttype == VM_FAULT_READ) {
+			/* Map it read-only until someone writes. */
+			writable = false;
+		}
+		else {
+			/* Still shared: write to a private copy. */
+			newpa = coremap_copy_upage(as, faultaddress, pa);
+			if (newpa == 0) {
+				vm_pagelock_release();
+				return ENOMEM;
+			}
+			coremap_free_upage(pa);
+			pa = newpa;
+			*pte = pa | PTE_VALID;
+			vm_tlb_shootdown(as, faultaddress);
+			vm_ncowcopies++;
+		}
+	}
+
+	if (!coremap_touch_upage(pa, writable &&
+				 faulttype != VM_FAULT_READ)) {
+		/* Clean; catch the first write. */
+		writable = false;
+	}
+
+	vm_tlb_load(faultaddress, pa, writable);
+
+	vm_pagelock_release();
+	return 0;
+}
@@ -228,18 +228,27 @@ dumpfreemap(uint32_t fsblocks)
 	printf("\n");
 }
 
+/*
+ * Dump an indirect block, and if it's a double or triple indirect
+ * block (LEVEL 2 or 3), the indirect blocks it points to.
+ */
 static
 void
-dumpindirect(uint32_t block)
+dumpindirect(uint32_t block, unsigned level)
 {
+	static const char *const levelnames[] = {
+		"", "Indirect", "Double indirect", "Triple indirect",
+	};
 	uint32_t ib[SFS_BLOCKSIZE/sizeof(uint32_t)];
 	char tmp[128];
 	unsigned i;
 
+	assert(level >= 1 && level <= 3);
+
 	if (block == 0) {
 		return;
 	}
-	printf("Indirect block %u\n", block);
+	printf("%s block %u\n", levelnames[level], block);
 
 	diskread(ib, block);
 	for (i=0; i<ARRAYCOUNT(ib); i++) {
@@ -253,12 +262,22 @@ dumpindirect(uint32_t block)
 			printf("\n");
 		}
 	}
+	if (level > 1) {
+		for (i=0; i<ARRAYCOUNT(ib); i++) {
+			dumpindirect(SWAP32(ib[i]), level - 1);
+		}
+	}
 }
 
+/*
+ * Visit the blocks mapped by an indirect block at indirection level
+ * LEVEL. Holes (including whole missing indirect blocks) are visited
+ * as block 0.
+ */
 static
 uint32_t
 traverse_ib(uint32_t fileblock, uint32_t numblocks, uint32_t block,
-	    void (*doblock)(uint32_t, uint32_t))
+	    unsigned level, void (*doblock)(uint32_t, uint32_t))
 {
 	uint32_t ib[SFS_BLOCKSIZE/sizeof(uint32_t)];
 	unsigned i;
@@ -270,11 +289,51 @@ traverse_ib(uint32_t fileblock, uint32_t numblocks, uint32_t block,
 		diskread(ib, block);
 	}
 	for (i=0; i<ARRAYCOUNT(ib) && fileblock < numblocks; i++) {
-		doblock(fileblock++, SWAP32(ib[i]));
+		if (level > 1) {
+			fileblock = traverse_ib(fileblock, numblocks,
+						SWAP32(ib[i]), level - 1,
+						doblock);
+		}
+		else {
+			doblock(fileblock++, SWAP32(ib[i]));
+		}
 	}
 	return fileblock;
 }
 
+/*
+ * Visit the blocks of a file mapped by extents. Blocks between and
+ * after the extents are holes, and are visited as block 0.
+ */
+static
+void
+traverse_extents(const struct sfs_dinode *sfi, uint32_t numblocks,
+		 void (*doblock)(uint32_t, uint32_t))
+{
+	uint32_t fileblock, start, disk, len;
+	unsigned i;
+
+	fileblock = 0;
+	for (i=0; i<SFS_NEXTENTS && fileblock < numblocks; i++) {
+		start = SWAP32(sfi->sfi_extents[i].se_fileblock);
+		disk = SWAP32(sfi->sfi_extents[i].se_diskblock);
+		len = SWAP32(sfi->sfi_extents[i].se_len);
+		if (len == 0) {
+			break;
+		}
+		while (fileblock < start && fileblock < numblocks) {
+			doblock(fileblock++, 0);
+		}
+		while (fileblock - start < len && fileblock < numblocks) {
+			doblock(fileblock, disk + (fileblock - start));
+			fileblock++;
+		}
+	}
+	while (fileblock < numblocks) {
+		doblock(fileblock++, 0);
+	}
+}
+
 static
 void
 traverse(const struct sfs_dinode *sfi, void (*doblock)(uint32_t, uint32_t))
@@ -285,17 +344,51 @@ traverse(const struct sfs_dinode *sfi, void (*doblock)(uint32_t, uint32_t))
 
 	numblocks = DIVROUNDUP(SWAP32(sfi->sfi_size), SFS_BLOCKSIZE);
 
+	if (SWAP32(sfi->sfi_flags) & SFS_IFLAG_EXTENTS) {
+		traverse_extents(sfi, numblocks, doblock);
+		return;
+	}
+
 	fileblock = 0;
 	for (i=0; i<SFS_NDIRECT && fileblock < numblocks; i++) {
 		doblock(fileblock++, SWAP32(sfi->sfi_direct[i]));
 	}
 	if (fileblock < numblocks) {
 		fileblock = traverse_ib(fileblock, numblocks,
-					SWAP32(sfi->sfi_indirect), doblock);
+					SWAP32(sfi->sfi_indirect), 1, doblock);
+	}
+	if (fileblock < numblocks) {
+		fileblock = traverse_ib(fileblock, numblocks,
+					SWAP32(sfi->sfi_dindirect), 2, doblock);
+	}
+	if (fileblock < numblocks) {
+		fileblock = traverse_ib(fileblock, numblocks,
+					SWAP32(sfi->sfi_tindirect), 3, doblock);
 	}
 	assert(fileblock == numblocks);
 }
 
+/* true while dumping a hashed directory (traverse() has no context arg) */
+static bool dumpinghashed;
+
+static
+void
+dumpdirhashhdr(const struct sfs_direntry *sd)
+{
+	const struct sfs_dirhashhdr *hdr = (const struct sfs_dirhashhdr *)sd;
+	uint32_t flags;
+
+	if (SWAP32(hdr->sdh_ino) != SFS_NOINO ||
+	    SWAP32(hdr->sdh_magic) != SFS_DIRHASH_MAGIC) {
+		printf("        [bad bucket header: ino %u, magic 0x%x]\n",
+		       SWAP32(hdr->sdh_ino), SWAP32(hdr->sdh_magic));
+		return;
+	}
+	flags = SWAP32(hdr->sdh_flags);
+	printf("        [bucket header, flags 0x%x%s]\n", flags,
+	       (flags & SFS_DIRHASH_OVERFLOW) ? " (overflowed)" : "");
+}
+
 static
 void
 dumpdirblock(uint32_t fileblock, uint32_t diskblock)
@@ -304,17 +397,24 @@ dumpdirblock(uint32_t fileblock, uint32_t diskblock)
 	int nsds = SFS_BLOCKSIZE/sizeof(struct sfs_direntry);
 	int i;
 
-	(void)fileblock;
 	if (diskblock == 0) {
 		printf("    [block %u - empty]\n", diskblock);
 		return;
 	}
 	diskread(&sds, diskblock);
 
-	printf("    [block %u]\n", diskblock);
+	if (dumpinghashed) {
+		printf("    [block %u - bucket %u]\n", diskblock, fileblock);
+	}
+	else {
+		printf("    [block %u]\n", diskblock);
+	}
 	for (i=0; i<nsds; i++) {
 		uint32_t ino = SWAP32(sds[i].sfd_ino);
-		if (ino==SFS_NOINO) {
+		if (i == 0 && dumpinghashed) {
+			dumpdirhashhdr(&sds[i]);
+		}
+		else if (ino==SFS_NOINO) {
 			printf("        [free entry]\n");
 		}
 		else {
@@ -334,8 +434,18 @@ dumpdir(uint32_t ino, const struct sfs_dinode *sfi)
 	if (SWAP32(sfi->sfi_size) % sizeof(struct sfs_direntry) != 0) {
 		warnx("Warning: dir size is not a multiple of dir entry size");
 	}
-	printf("Directory contents for inode %u: %d entries\n", ino, nentries);
+	dumpinghashed = (SWAP32(sfi->sfi_flags) & SFS_IFLAG_DIRHASH) != 0;
+	if (dumpinghashed) {
+		printf("Directory contents for inode %u: %d entries "
+		       "(hashed, %u buckets)\n", ino, nentries,
+		       SWAP32(sfi->sfi_size) / SFS_BLOCKSIZE);
+	}
+	else {
+		printf("Directory contents for inode %u: %d entries\n",
+		       ino, nentries);
+	}
 	traverse(sfi, dumpdirblock);
+	dumpinghashed = false;
 }
 
 static
@@ -449,6 +559,10 @@ dumpinode(uint32_t ino, const char *name)
 	dumpvalf("Type", "%u (%s)", SWAP16(sfi.sfi_type), typename);
 	dumpvalf("Size", "%u", SWAP32(sfi.sfi_size));
 	dumpvalf("Link count", "%u", SWAP16(sfi.sfi_linkcount));
+	dumpvalf("Flags", "0x%x%s%s", SWAP32(sfi.sfi_flags),
+		 (SWAP32(sfi.sfi_flags) & SFS_IFLAG_DIRHASH) ? " (hashed)" : "",
+		 (SWAP32(sfi.sfi_flags) & SFS_IFLAG_EXTENTS) ?
+		 " (extents)" : "");
 	printf("\n");
 
         printf("    Direct blocks:\n");
@@ -476,6 +590,22 @@ dumpinode(uint32_t ino, const char *name)
 	}
 	printf("    Indirect block: %u (0x%x)\n",
 	       SWAP32(sfi.sfi_indirect), SWAP32(sfi.sfi_indirect));
+	printf("    Double indirect block: %u (0x%x)\n",
+	       SWAP32(sfi.sfi_dindirect), SWAP32(sfi.sfi_dindirect));
+	printf("    Triple indirect block: %u (0x%x)\n",
+	       SWAP32(sfi.sfi_tindirect), SWAP32(sfi.sfi_tindirect));
+	for (i=0; i<SFS_NEXTENTS; i++) {
+		const struct sfs_extent *se = &sfi.sfi_extents[i];
+
+		if (se->se_fileblock == 0 && se->se_diskblock == 0 &&
+		    se->se_len == 0) {
+			continue;
+		}
+		printf("    Extent %u: file block %u, disk block %u (0x%x), "
+		       "%u blocks\n", i, SWAP32(se->se_fileblock),
+		       SWAP32(se->se_diskblock), SWAP32(se->se_diskblock),
+		       SWAP32(se->se_len));
+	}
 	for (i=0; i<ARRAYCOUNT(sfi.sfi_waste); i++) {
 		if (sfi.sfi_waste[i] != 0) {
 			printf("    Word %u in waste area: 0x%x\n",
@@ -484,7 +614,9 @@ dumpinode(uint32_t ino, const char *name)
 	}
 
 	if (doindirect) {
-		dumpindirect(SWAP32(sfi.sfi_indirect));
+		dumpindirect(SWAP32(sfi.sfi_indirect), 1);
+		dumpindirect(SWAP32(sfi.sfi_dindirect), 2);
+		dumpindirect(SWAP32(sfi.sfi_tindirect), 3);
 	}
 
 	if (SWAP16(sfi.sfi_type) == SFS_TYPE_DIR && dodirs) {
@@ -29,6 +29,7 @@
 
 #include <sys/types.h>
 #include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
 #include <assert.h>
 #include <limits.h>
@@ -63,6 +64,9 @@
 /* Free block bitmap */
 static char freemapbuf[MAXFREEMAPBLOCKS * SFS_BLOCKSIZE];
 
+/* Most buckets a hashed root directory can have (direct + indirect) */
+#define MAXDIRBUCKETS (SFS_NDIRECT + SFS_NINDIRECT * SFS_DBPERIDB)
+
 /*
  * Assert that the on-disk data structures are correctly sized.
  */
@@ -165,11 +169,76 @@ writefreemap(uint32_t fsblocks)
 }
 
 /*
- * Write out the root directory inode.
+ * Write out an empty hash bucket for a hashed directory.
+ */
+static
+void
+writedirbucket(uint32_t block)
+{
+	struct sfs_direntry sds[SFS_BLOCKSIZE/sizeof(struct sfs_direntry)];
+	struct sfs_dirhashhdr *hdr = (struct sfs_dirhashhdr *)&sds[0];
+
+	bzero((void *)sds, sizeof(sds));
+	hdr->sdh_ino = SWAP32(SFS_NOINO);
+	hdr->sdh_magic = SWAP32(SFS_DIRHASH_MAGIC);
+	hdr->sdh_flags = SWAP32(0);
+
+	diskwrite(sds, block);
+}
+
+/*
+ * Make the root directory a hash table with NBUCKETS buckets,
+ * allocating blocks for it after the free block bitmap.
+ */
+static
+void
+hashrootdir(struct sfs_dinode *sfi, uint32_t fsblocks, uint32_t nbuckets)
+{
+	uint32_t ib[SFS_DBPERIDB];
+	uint32_t block, i;
+
+	assert(nbuckets > 0 && nbuckets <= MAXDIRBUCKETS);
+
+	block = SFS_FREEMAP_START + SFS_FREEMAPBLOCKS(fsblocks);
+	if (block + nbuckets + 1 > fsblocks) {
+		errx(1, "Filesystem too small for %u directory buckets",
+		     nbuckets);
+	}
+
+	bzero((void *)ib, sizeof(ib));
+	if (nbuckets > SFS_NDIRECT) {
+		allocblock(block);
+		sfi->sfi_indirect = SWAP32(block);
+		block++;
+	}
+
+	for (i=0; i<nbuckets; i++) {
+		allocblock(block);
+		writedirbucket(block);
+		if (i < SFS_NDIRECT) {
+			sfi->sfi_direct[i] = SWAP32(block);
+		}
+		else {
+			ib[i - SFS_NDIRECT] = SWAP32(block);
+		}
+		block++;
+	}
+
+	if (nbuckets > SFS_NDIRECT) {
+		diskwrite(ib, SWAP32(sfi->sfi_indirect));
+	}
+
+	sfi->sfi_size = SWAP32(nbuckets * SFS_BLOCKSIZE);
+	sfi->sfi_flags = SWAP32(SFS_IFLAG_DIRHASH);
+}
+
+/*
+ * Write out the root directory inode. If NBUCKETS is nonzero, make
+ * the root directory a hash table with that many buckets.
  */
 static
 void
-writerootdir(void)
+writerootdir(uint32_t fsblocks, uint32_t nbuckets)
 {
 	struct sfs_dinode sfi;
 
@@ -179,6 +248,10 @@ writerootdir(void)
 	sfi.sfi_type = SWAP16(SFS_TYPE_DIR);
 	sfi.sfi_linkcount = SWAP16(1);
 
+	if (nbuckets > 0) {
+		hashrootdir(&sfi, fsblocks, nbuckets);
+	}
+
 	/* Write it out */
 	diskwrite(&sfi, SFS_ROOTDIR_INO);
 }
@@ -189,15 +262,27 @@ writerootdir(void)
 int
 main(int argc, char **argv)
 {
-	uint32_t size, blocksize;
+	uint32_t size, blocksize, nbuckets = 0;
 	char *volname, *s;
 
 #ifdef HOST
 	hostcompat_init(argc, argv);
 #endif
 
+	/* -d nbuckets makes the root directory hashed */
+	if (argc==5 && !strcmp(argv[1], "-d")) {
+		nbuckets = atoi(argv[2]);
+		if (nbuckets == 0 || nbuckets > MAXDIRBUCKETS) {
+			errx(1, "Number of directory buckets must be "
+			     "between 1 and %u", MAXDIRBUCKETS);
+		}
+		argc -= 2;
+		argv += 2;
+	}
+
 	if (argc!=3) {
-		errx(1, "Usage: mksfs device/diskfile volume-name");
+		errx(1, "Usage: mksfs [-d nbuckets] device/diskfile "
+		     "volume-name");
 	}
 
 	check();
@@ -230,9 +315,9 @@ main(int argc, char **argv)
 
 	/* Write out the on-disk structures */
 	initfreemap(size);
+	writerootdir(size, nbuckets);
 	writesuper(volname, size);
 	writefreemap(size);
-	writerootdir();
 
 	closedisk();
 
@@ -172,6 +172,106 @@ check_indirect_block(struct ibstate *ibs, uint32_t *ientry, int *iechangedp,
 	}
 }
 
+/*
+ * Check the blocks of inode INO, which is mapped by extents (see
+ * kern/sfs.h), recording the ones in use. The block pointers should
+ * all be 0. Extents that are out of order, or that point outside the
+ * volume, are dropped; blocks past EOF (FILEBLOCKS) are freed.
+ *
+ * Returns nonzero if SFI has been modified and needs to be written
+ * back.
+ */
+static
+int
+check_inode_extents(uint32_t ino, struct sfs_dinode *sfi, uint32_t fileblocks,
+		    blockusage_t usagetype)
+{
+	struct sfs_extent *se;
+	uint32_t volblocks, nextfileblock, keep, j;
+	unsigned i, n, pasteofcount;
+	int changed = 0;
+
+	volblocks = sb_totalblocks();
+
+	if (checkzeroed(sfi->sfi_direct, sizeof(sfi->sfi_direct)) |
+	    checkzeroed(&sfi->sfi_indirect, sizeof(sfi->sfi_indirect)) |
+	    checkzeroed(&sfi->sfi_dindirect, sizeof(sfi->sfi_dindirect)) |
+	    checkzeroed(&sfi->sfi_tindirect, sizeof(sfi->sfi_tindirect))) {
+		warnx("Inode %lu: block pointers in extent-mapped inode "
+		      "(cleared)", (unsigned long) ino);
+		setbadness(EXIT_RECOV);
+		changed = 1;
+	}
+
+	n = 0;
+	nextfileblock = 0;
+	pasteofcount = 0;
+	for (i=0; i<SFS_NEXTENTS; i++) {
+		se = &sfi->sfi_extents[i];
+		if (se->se_len == 0) {
+			break;
+		}
+		if (se->se_fileblock < nextfileblock ||
+		    se->se_len > UINT32_MAX - se->se_fileblock ||
+		    se->se_diskblock == 0 || se->se_diskblock >= volblocks ||
+		    se->se_len > volblocks - se->se_diskblock) {
+			warnx("Inode %lu: invalid extent %u (file block %lu, "
+			      "disk block %lu, length %lu) (dropped)",
+			      (unsigned long) ino, i,
+			      (unsigned long) se->se_fileblock,
+			      (unsigned long) se->se_diskblock,
+			      (unsigned long) se->se_len);
+			setbadness(EXIT_RECOV);
+			changed = 1;
+			continue;
+		}
+		nextfileblock = se->se_fileblock + se->se_len;
+
+		keep = 0;
+		if (se->se_fileblock < fileblocks) {
+			keep = fileblocks - se->se_fileblock;
+			if (keep > se->se_len) {
+				keep = se->se_len;
+			}
+		}
+		for (j=0; j<se->se_len; j++) {
+			if (j < keep) {
+				freemap_blockinuse(se->se_diskblock + j,
+						   usagetype, ino);
+			}
+			else {
+				freemap_blockfree(se->se_diskblock + j);
+				pasteofcount++;
+			}
+		}
+		if (keep < se->se_len) {
+			setbadness(EXIT_RECOV);
+			changed = 1;
+		}
+		if (keep > 0) {
+			sfi->sfi_extents[n] = *se;
+			sfi->sfi_extents[n].se_len = keep;
+			n++;
+		}
+	}
+
+	if (checkzeroed(&sfi->sfi_extents[i],
+			(SFS_NEXTENTS - i) * sizeof(sfi->sfi_extents[0]))) {
+		warnx("Inode %lu: garbage after last extent (cleared)",
+		      (unsigned long) ino);
+		setbadness(EXIT_RECOV);
+		changed = 1;
+	}
+	memset(&sfi->sfi_extents[n], 0, (i - n) * sizeof(sfi->sfi_extents[0]));
+
+	if (pasteofcount > 0) {
+		warnx("Inode %lu: %u blocks after EOF (freed)",
+		     (unsigned long) ino, pasteofcount);
+	}
+
+	return changed;
+}
+
 /*
  * Check the blocks belonging to inode INO, whose inode has already
  * been loaded into SFI. ISDIR is a shortcut telling us if the inode
@@ -198,8 +298,20 @@ check_inode_blocks(uint32_t ino, struct sfs_dinode *sfi, int isdir)
 	ibs.pasteofcount = 0;
 	ibs.usagetype = isdir ? B_DIRDATA : B_DATA;
 
+	if (sfi->sfi_flags & SFS_IFLAG_EXTENTS) {
+		return check_inode_extents(ino, sfi, ibs.fileblocks,
+					   ibs.usagetype);
+	}
+
 	changed = 0;
 
+	if (checkzeroed(sfi->sfi_extents, sizeof(sfi->sfi_extents))) {
+		warnx("Inode %lu: extents in block-mapped inode (cleared)",
+		      (unsigned long) ino);
+		setbadness(EXIT_RECOV);
+		changed = 1;
+	}
+
 	for (ibs.curfileblock=0; ibs.curfileblock<NUM_D; ibs.curfileblock++) {
 		datablock = GET_D(sfi, ibs.curfileblock);
 		if (datablock >= ibs.volblocks) {
@@ -261,6 +373,7 @@ pass1_inode(uint32_t ino, struct sfs_dinode *sfi, int alreadychanged)
 {
 	int changed = alreadychanged;
 	int isdir = sfi->sfi_type == SFS_TYPE_DIR;
+	uint32_t validflags = isdir ? SFS_IFLAG_DIRHASH : SFS_IFLAG_EXTENTS;
 
 	if (inode_add(ino, sfi->sfi_type)) {
 		/* Already been here. */
@@ -270,6 +383,14 @@ pass1_inode(uint32_t ino, struct sfs_dinode *sfi, int alreadychanged)
 
 	freemap_blockinuse(ino, B_INODE, ino);
 
+	if ((sfi->sfi_flags & ~validflags) != 0) {
+		warnx("Inode %lu: invalid flags 0x%lx (cleared)",
+		      (unsigned long) ino, (unsigned long) sfi->sfi_flags);
+		setbadness(EXIT_RECOV);
+		sfi->sfi_flags &= validflags;
+		changed = 1;
+	}
+
 	if (checkzeroed(sfi->sfi_waste, sizeof(sfi->sfi_waste))) {
 		warnx("Inode %lu: sfi_waste section not zeroed (fixed)",
 		      (unsigned long) ino);
@@ -359,10 +480,11 @@ static
 void
 pass1_dir(uint32_t ino, const char *pathsofar)
 {
+	const unsigned perblock = SFS_BLOCKSIZE/sizeof(struct sfs_direntry);
 	struct sfs_dinode sfi;
 	struct sfs_direntry *direntries;
 	uint32_t ndirentries, i;
-	int ichanged=0, dchanged=0;
+	int ichanged=0, dchanged=0, hashed;
 
 	sfs_readinode(ino, &sfi);
 
@@ -374,6 +496,23 @@ pass1_dir(uint32_t ino, const char *pathsofar)
 					   sizeof(struct sfs_direntry));
 		ichanged = 1;
 	}
+
+	/*
+	 * A hashed directory must be a whole number of buckets. If
+	 * not, treat it as an ordinary directory; the bucket headers
+	 * then just look like free entries.
+	 */
+	hashed = (sfi.sfi_flags & SFS_IFLAG_DIRHASH) != 0;
+	if (hashed &&
+	    (sfi.sfi_size == 0 || sfi.sfi_size % SFS_BLOCKSIZE != 0)) {
+		setbadness(EXIT_RECOV);
+		warnx("Directory %s: hashed directory has illegal size %lu "
+		      "(no longer hashed)",
+		      pathsofar, (unsigned long) sfi.sfi_size);
+		sfi.sfi_flags &= ~(uint32_t)SFS_IFLAG_DIRHASH;
+		hashed = 0;
+		ichanged = 1;
+	}
 	count_dirs++;
 
 	if (pass1_inode(ino, &sfi, ichanged)) {
@@ -387,6 +526,11 @@ pass1_dir(uint32_t ino, const char *pathsofar)
 	sfs_readdir(&sfi, direntries, ndirentries);
 
 	for (i=0; i<ndirentries; i++) {
+		if (hashed && i % perblock == 0 &&
+		    direntries[i].sfd_ino == SFS_NOINO) {
+			/* bucket header; checked in pass 2 */
+			continue;
+		}
 		if (pass1_direntry(pathsofar, i, &direntries[i])) {
 			dchanged = 1;
 		}
@@ -62,11 +62,13 @@ static
 int
 pass2_dir(uint32_t ino, uint32_t parentino, const char *pathsofar)
 {
+	const unsigned perblock = SFS_BLOCKSIZE/sizeof(struct sfs_direntry);
 	struct sfs_dinode sfi;
-	struct sfs_direntry *direntries;
+	struct sfs_direntry *direntries, *hashentries;
 	int *sortvector;
 	uint32_t dirsize, ndirentries, maxdirentries, subdircount, i;
-	int ichanged=0, dchanged=0, dotseen=0, dotdotseen=0;
+	uint32_t nbuckets = 0, nlive;
+	int ichanged=0, dchanged=0, dotseen=0, dotdotseen=0, hashed;
 
 	if (inode_visitdir(ino)) {
 		/* crosslinked dir; tell parent to remove the entry */
@@ -96,6 +98,39 @@ pass2_dir(uint32_t ino, uint32_t parentino, const char *pathsofar)
 		bzero(direntries[i].sfd_name, sizeof(direntries[i].sfd_name));
 	}
 
+	/*
+	 * For a hashed directory, check the index, then pull the
+	 * entries out into an ordinary list to work on. The list has
+	 * as many slots as the table can hold, so new entries can go
+	 * in the free ones; the table is rebuilt at the end if
+	 * anything changed. (pass1 made sure the size is a whole
+	 * number of buckets.)
+	 */
+	hashed = (sfi.sfi_flags & SFS_IFLAG_DIRHASH) != 0;
+	if (hashed) {
+		nbuckets = ndirentries / perblock;
+		if (sfsdir_hashcheck(direntries, nbuckets)) {
+			setbadness(EXIT_RECOV);
+			warnx("Directory %s: Hash index damaged (rebuilt)",
+			      pathsofar);
+			dchanged = 1;
+		}
+		nlive = sfsdir_compact(direntries, ndirentries);
+		if (nlive <= nbuckets * (perblock - 1)) {
+			ndirentries = maxdirentries = nbuckets * (perblock-1);
+		}
+		else {
+			/* only possible if entries were in header slots */
+			setbadness(EXIT_RECOV);
+			warnx("Directory %s: Too many entries for hash index "
+			      "(no longer hashed)", pathsofar);
+			sfi.sfi_flags &= ~(uint32_t)SFS_IFLAG_DIRHASH;
+			hashed = 0;
+			ichanged = 1;
+			dchanged = 1;
+		}
+	}
+
 	/*
 	 * Sort by name and check for duplicate names.
 	 */
@@ -301,7 +336,14 @@ pass2_dir(uint32_t ino, uint32_t parentino, const char *pathsofar)
 	 * Write back anything that changed, clean up, and return.
 	 */
 
-	if (dchanged) {
+	if (dchanged && hashed) {
+		hashentries = domalloc(nbuckets * SFS_BLOCKSIZE);
+		sfsdir_hashbuild(direntries, ndirentries, hashentries,
+				 nbuckets);
+		sfs_writedir(&sfi, hashentries, nbuckets * perblock);
+		free(hashentries);
+	}
+	else if (dchanged) {
 		sfs_writedir(&sfi, direntries, ndirentries);
 	}
 
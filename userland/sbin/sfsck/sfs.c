@@ -81,6 +81,7 @@ swapinode(struct sfs_dinode *sfi)
 	sfi->sfi_size = SWAP32(sfi->sfi_size);
 	sfi->sfi_type = SWAP16(sfi->sfi_type);
 	sfi->sfi_linkcount = SWAP16(sfi->sfi_linkcount);
+	sfi->sfi_flags = SWAP32(sfi->sfi_flags);
 
 	for (i=0; i<NUM_D; i++) {
 		SET_D(sfi, i) = SWAP32(GET_D(sfi, i));
@@ -97,6 +98,14 @@ swapinode(struct sfs_dinode *sfi)
 	for (i=0; i<NUM_III; i++) {
 		SET_III(sfi, i) = SWAP32(GET_III(sfi, i));
 	}
+
+	for (i=0; i<SFS_NEXTENTS; i++) {
+		struct sfs_extent *se = &sfi->sfi_extents[i];
+
+		se->se_fileblock = SWAP32(se->se_fileblock);
+		se->se_diskblock = SWAP32(se->se_diskblock);
+		se->se_len = SWAP32(se->se_len);
+	}
 }
 
 static
@@ -161,7 +170,24 @@ static
 uint32_t
 bmap(const struct sfs_dinode *sfi, uint32_t fileblock)
 {
+	const struct sfs_extent *se;
 	uint32_t iblock, offset;
+	unsigned i;
+
+	if (sfi->sfi_flags & SFS_IFLAG_EXTENTS) {
+		for (i=0; i<SFS_NEXTENTS; i++) {
+			se = &sfi->sfi_extents[i];
+			if (se->se_len == 0) {
+				break;
+			}
+			if (fileblock >= se->se_fileblock &&
+			    fileblock - se->se_fileblock < se->se_len) {
+				return se->se_diskblock +
+					(fileblock - se->se_fileblock);
+			}
+		}
+		return 0;
+	}
 
 	if (fileblock < INOMAX_D) {
 		return GET_D(sfi, fileblock);
@@ -462,3 +488,148 @@ sfsdir_tryadd(struct sfs_direntry *d, int nd, const char *name, uint32_t ino)
 	}
 	return -1;
 }
+
+////////////////////////////////////////////////////////////
+// hashed directories
+
+/*
+ * Note that swapdir() only swaps sfd_ino, so the other words of the
+ * bucket headers are kept in disk byte order in memory.
+ */
+
+#define DIRPERBLOCK (SFS_BLOCKSIZE/sizeof(struct sfs_direntry))
+
+/*
+ * The directory hash function. Must match the kernel's.
+ */
+uint32_t
+sfsdir_hash(const char *name)
+{
+	uint32_t h = SFS_DIRHASH_FNVBASIS;
+
+	while (*name) {
+		h ^= (unsigned char)*name++;
+		h *= SFS_DIRHASH_FNVPRIME;
+	}
+	return h;
+}
+
+static
+int
+hashhdr_ok(const struct sfs_direntry *d)
+{
+	const struct sfs_dirhashhdr *hdr = (const struct sfs_dirhashhdr *)d;
+
+	return hdr->sdh_ino == SFS_NOINO &&
+		SWAP32(hdr->sdh_magic) == SFS_DIRHASH_MAGIC;
+}
+
+static
+int
+hashhdr_overflowed(const struct sfs_direntry *d)
+{
+	const struct sfs_dirhashhdr *hdr = (const struct sfs_dirhashhdr *)d;
+
+	return (SWAP32(hdr->sdh_flags) & SFS_DIRHASH_OVERFLOW) != 0;
+}
+
+/*
+ * Check the hashed directory D, which has NBUCKETS buckets: every
+ * bucket must have a valid header, and a lookup must be able to reach
+ * every entry from its home bucket. Returns nonzero if not.
+ */
+int
+sfsdir_hashcheck(struct sfs_direntry *d, unsigned nbuckets)
+{
+	unsigned b, i, h;
+
+	for (b=0; b<nbuckets; b++) {
+		if (!hashhdr_ok(&d[b*DIRPERBLOCK])) {
+			return 1;
+		}
+	}
+
+	for (b=0; b<nbuckets; b++) {
+		for (i=1; i<DIRPERBLOCK; i++) {
+			if (d[b*DIRPERBLOCK + i].sfd_ino == SFS_NOINO) {
+				continue;
+			}
+			h = sfsdir_hash(d[b*DIRPERBLOCK + i].sfd_name)
+				% nbuckets;
+			for (; h != b; h = (h + 1) % nbuckets) {
+				if (!hashhdr_overflowed(&d[h*DIRPERBLOCK])) {
+					return 1;
+				}
+			}
+		}
+	}
+	return 0;
+}
+
+/*
+ * Move all the entries in D (which has ND slots) to the front,
+ * clearing the rest. Returns the number of entries.
+ */
+unsigned
+sfsdir_compact(struct sfs_direntry *d, unsigned nd)
+{
+	unsigned i, n;
+
+	for (i=n=0; i<nd; i++) {
+		if (d[i].sfd_ino != SFS_NOINO) {
+			if (i != n) {
+				d[n] = d[i];
+			}
+			n++;
+		}
+	}
+	for (i=n; i<nd; i++) {
+		memset(&d[i], 0, sizeof(d[i]));
+	}
+	return n;
+}
+
+/*
+ * Lay out the entries in D (ND slots, some of which may be free) as a
+ * hashed directory with NBUCKETS buckets in OUT, which must have
+ * room for NBUCKETS blocks' worth of entries. There must be room in
+ * the table for all the entries.
+ */
+void
+sfsdir_hashbuild(const struct sfs_direntry *d, unsigned nd,
+		 struct sfs_direntry *out, unsigned nbuckets)
+{
+	struct sfs_dirhashhdr *hdr;
+	unsigned b, i, j, probes;
+
+	memset(out, 0, nbuckets * SFS_BLOCKSIZE);
+	for (b=0; b<nbuckets; b++) {
+		hdr = (struct sfs_dirhashhdr *)&out[b*DIRPERBLOCK];
+		hdr->sdh_ino = SFS_NOINO;
+		hdr->sdh_magic = SWAP32(SFS_DIRHASH_MAGIC);
+		hdr->sdh_flags = SWAP32(0);
+	}
+
+	for (j=0; j<nd; j++) {
+		if (d[j].sfd_ino == SFS_NOINO) {
+			continue;
+		}
+		b = sfsdir_hash(d[j].sfd_name) % nbuckets;
+		for (probes=0; probes<nbuckets; probes++) {
+			for (i=1; i<DIRPERBLOCK; i++) {
+				if (out[b*DIRPERBLOCK + i].sfd_ino ==
+				    SFS_NOINO) {
+					break;
+				}
+			}
+			if (i < DIRPERBLOCK) {
+				out[b*DIRPERBLOCK + i] = d[j];
+				break;
+			}
+			hdr = (struct sfs_dirhashhdr *)&out[b*DIRPERBLOCK];
+			hdr->sdh_flags = SWAP32(SFS_DIRHASH_OVERFLOW);
+			b = (b + 1) % nbuckets;
+		}
+		assert(probes < nbuckets);
+	}
+}
@@ -77,5 +77,23 @@ int sfsdir_tryadd(struct sfs_direntry *d, int nd,
 /* Sort a directory by creating a permutation vector. */
 void sfsdir_sort(struct sfs_direntry *d, unsigned nd, int *vector);
 
+/*
+ * Hashed directories. D holds the whole directory, including the
+ * bucket headers.
+ */
+
+/* The directory hash function. */
+uint32_t sfsdir_hash(const char *name);
+
+/* Check the bucket headers and entry placement; nonzero if damaged. */
+int sfsdir_hashcheck(struct sfs_direntry *d, unsigned nbuckets);
+
+/* Squeeze out the free entries (and headers); returns # of entries. */
+unsigned sfsdir_compact(struct sfs_direntry *d, unsigned nd);
+
+/* Lay out the ND slots in D as a hash table with NBUCKETS in OUT. */
+void sfsdir_hashbuild(const struct sfs_direntry *d, unsigned nd,
+		      struct sfs_direntry *out, unsigned nbuckets);
+
 
 #endif /* SFS_H */
@@ -0,0 +1,197 @@
+/*
+ * Copyright (c) 2015
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * syscallbench - time small read, write, and lseek calls.
+ *
+ * Usage: syscallbench [iterations]
+ *
+ * Each test issues the same system call over and over with a tiny
+ * transfer, so that the time is dominated by the system call path
+ * itself (descriptor lookup, uio setup, locking) rather than by the
+ * file system. The result is reported as calls per second; run it
+ * before and after a change to the syscall layer to compare.
+ */
+
+#include <sys/types.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <err.h>
+
+#define DEFAULT_ITERATIONS	20000
+#define TESTFILE		"syscallbench.tmp"
+
+static unsigned iterations = DEFAULT_ITERATIONS;
+static time_t startsecs;
+static unsigned long startnsecs;
+
+static
+void
+starttimer(void)
+{
+	__time(&startsecs, &startnsecs);
+}
+
+/*
+ * Stop the clock and print the rate for NAME.
+ */
+static
+void
+report(const char *name)
+{
+	time_t secs;
+	unsigned long nsecs;
+	uint64_t elapsed, rate;
+
+	__time(&secs, &nsecs);
+	elapsed = (uint64_t)(secs - startsecs) * 1000000000ULL;
+	elapsed = elapsed + nsecs - startnsecs;
+	if (elapsed == 0) {
+		elapsed = 1;
+	}
+	rate = (uint64_t)iterations * 1000000000ULL / elapsed;
+	printf("%-24s %10u calls %6llu.%03llu s  %8llu calls/s\n",
+	       name, iterations,
+	       elapsed / 1000000000ULL, (elapsed / 1000000ULL) % 1000,
+	       rate);
+}
+
+static
+void
+bench_write_null(void)
+{
+	unsigned i;
+	int fd;
+	char c = 'x';
+
+	fd = open("null:", O_WRONLY);
+	if (fd < 0) {
+		err(1, "null:");
+	}
+	starttimer();
+	for (i=0; i<iterations; i++) {
+		if (write(fd, &c, 1) != 1) {
+			err(1, "null: write");
+		}
+	}
+	report("write 1 byte to null:");
+	close(fd);
+}
+
+static
+void
+bench_read_file(int fd)
+{
+	unsigned i;
+	char c;
+
+	starttimer();
+	for (i=0; i<iterations; i++) {
+		if (lseek(fd, 0, SEEK_SET) != 0) {
+			err(1, "%s: lseek", TESTFILE);
+		}
+		if (read(fd, &c, 1) != 1) {
+			err(1, "%s: read", TESTFILE);
+		}
+	}
+	report("lseek+read 1 byte");
+}
+
+static
+void
+bench_write_file(int fd)
+{
+	unsigned i;
+	char c = 'y';
+
+	starttimer();
+	for (i=0; i<iterations; i++) {
+		if (lseek(fd, 0, SEEK_SET) != 0) {
+			err(1, "%s: lseek", TESTFILE);
+		}
+		if (write(fd, &c, 1) != 1) {
+			err(1, "%s: write", TESTFILE);
+		}
+	}
+	report("lseek+write 1 byte");
+}
+
+static
+void
+bench_lseek(int fd)
+{
+	unsigned i;
+
+	starttimer();
+	for (i=0; i<iterations; i++) {
+		if (lseek(fd, i % 64, SEEK_SET) < 0) {
+			err(1, "%s: lseek", TESTFILE);
+		}
+	}
+	report("lseek");
+}
+
+int
+main(int argc, char *argv[])
+{
+	char buf[64];
+	int fd;
+
+	if (argc > 2) {
+		errx(1, "Usage: %s [iterations]", argv[0]);
+	}
+	if (argc == 2) {
+		iterations = atoi(argv[1]);
+		if (iterations == 0) {
+			errx(1, "Usage: %s [iterations]", argv[0]);
+		}
+	}
+
+	fd = open(TESTFILE, O_RDWR|O_CREAT|O_TRUNC, 0664);
+	if (fd < 0) {
+		err(1, "%s", TESTFILE);
+	}
+	memset(buf, 'z', sizeof(buf));
+	if (write(fd, buf, sizeof(buf)) != sizeof(buf)) {
+		err(1, "%s: write", TESTFILE);
+	}
+
+	bench_write_null();
+	bench_lseek(fd);
+	bench_read_file(fd);
+	bench_write_file(fd);
+
+	close(fd);
+	remove(TESTFILE);
+	return 0;
+}